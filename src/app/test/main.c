@@ -12,6 +12,9 @@
 #include "ether.h"
 #include "tools.h"
 #include "timer.h"
+#include "net_bpf.h"
+#include "net_gso.h"
+#include "protocol.h"
 
 static sys_mutex_t mutex;
 static sys_sem_t sem;
@@ -24,19 +27,19 @@ static sys_mutex_t sz_mutex;
 
 void thread1_entry (void * arg) {
 	for (int i = 0; i < 2 * sizeof(buffer_g); i ++) {
-		sys_sem_wait(read_sem, 0);
+		sys_sem_wait(&read_sem, 0);
 		uint8_t data = buffer_g[read_idx++];
 
 		if (read_idx >= sizeof(buffer_g)) {
 			read_idx = 0;
 		}
 
-		sys_mutex_lock(sz_mutex);
+		sys_mutex_lock(&sz_mutex);
 		total --;
-		sys_mutex_unlock(sz_mutex);
+		sys_mutex_unlock(&sz_mutex);
 
 		plat_printf("thread1 : read data = %d\n", data);
-		sys_sem_notify(write_sem);
+		sys_sem_notify(&write_sem);
 		sys_sleep(100);
 	}
 
@@ -44,7 +47,7 @@ void thread1_entry (void * arg) {
 		plat_printf("this is thread1 : %d\n", cc);
 		cc ++;
 		sys_sleep(1000);
-		sys_sem_notify(sem);
+		sys_sem_notify(&sem);
 		sys_sleep(1000);
 	}
 }
@@ -53,22 +56,22 @@ void thread2_entry (void * arg) {
 	sys_sleep(1000);
 
 	for (int i = 0; i < 2 * sizeof(buffer_g); i ++) {
-		sys_sem_wait(write_sem, 0);
+		sys_sem_wait(&write_sem, 0);
 		buffer_g[write_idx++] = i;
 		if (write_idx >= sizeof(buffer_g)) {
 			write_idx = 0;
 		}
 
-		sys_mutex_lock(sz_mutex);
+		sys_mutex_lock(&sz_mutex);
 		total ++;
-		sys_mutex_unlock(sz_mutex);
+		sys_mutex_unlock(&sz_mutex);
 
 		plat_printf("thread2 : write data = %d\n", i);
-		sys_sem_notify(read_sem);
+		sys_sem_notify(&read_sem);
 	}
 
 	while (1) {
-		sys_sem_wait(sem, 0);
+		sys_sem_wait(&sem, 0);
 		plat_printf("this is thread2 : %d\n", cc);
 		cc ++;
 	}
@@ -311,6 +314,364 @@ void pktbuf_test (void) {
 
 }
 
+// 读出整个包，返回包的长度
+static int pktbuf_read_all (pktbuf_t * buf, uint8_t * data) {
+	int size = pktbuf_total(buf);
+	pktbuf_reset_acc(buf);
+	pktbuf_read(buf, data, size);
+	return size;
+}
+
+void pktbuf_cow_test (void) {
+	static uint8_t temp[1200], read_temp[1200];
+	for (int i = 0; i < sizeof(temp); i++) {
+		temp[i] = (uint8_t)(i * 7 + 3);
+	}
+
+	pktbuf_t * buf = pktbuf_alloc(sizeof(temp));
+	pktbuf_reset_acc(buf);
+	pktbuf_write(buf, temp, sizeof(temp));
+
+	// 写克隆出的包，原包不变
+	pktbuf_t * clone = pktbuf_clone(buf);
+	pktbuf_seek(clone, 100);
+	pktbuf_fill(clone, 0x53, 300);
+	pktbuf_read_all(buf, read_temp);
+	if (plat_memcmp(temp, read_temp, sizeof(temp)) != 0) {
+		plat_printf("pktbuf_clone error: source changed\n");
+		return;
+	}
+	pktbuf_read_all(clone, read_temp);
+	if ((plat_memcmp(temp, read_temp, 100) != 0) || (read_temp[100] != 0x53) || (read_temp[399] != 0x53)
+			|| (plat_memcmp(temp + 400, read_temp + 400, sizeof(temp) - 400) != 0)) {
+		plat_printf("pktbuf_clone error: clone not written\n");
+		return;
+	}
+	pktbuf_free(clone);
+
+	// 写共享得到的包，原包不变
+	pktbuf_t * dest = pktbuf_alloc(16);
+	pktbuf_share(dest, buf, 200, 600);
+	pktbuf_seek(dest, 16);
+	pktbuf_fill(dest, 0x35, 600);
+	pktbuf_read_all(buf, read_temp);
+	if (plat_memcmp(temp, read_temp, sizeof(temp)) != 0) {
+		plat_printf("pktbuf_share error: source changed\n");
+		return;
+	}
+	pktbuf_free(dest);
+
+	// 原包先释放，共享的数据仍然有效
+	dest = pktbuf_alloc(0);
+	pktbuf_share(dest, buf, 0, sizeof(temp));
+	pktbuf_free(buf);
+	pktbuf_read_all(dest, read_temp);
+	if (plat_memcmp(temp, read_temp, sizeof(temp)) != 0) {
+		plat_printf("pktbuf_share error: data lost\n");
+		return;
+	}
+	pktbuf_free(dest);
+}
+
+static int iovec_free_cnt;
+static void iovec_free (void * ctx, uint8_t * data) {
+	iovec_free_cnt++;
+}
+
+void pktbuf_iovec_test (void) {
+	static uint8_t temp[3000], read_temp[3000];
+	for (int i = 0; i < sizeof(temp); i++) {
+		temp[i] = (uint8_t)(i * 13 + 5);
+	}
+
+	pktbuf_iovec_t iov[] = {
+		{temp, 1}, {temp + 1, 700}, {temp + 701, 1299}, {temp + 2000, 1000},
+	};
+
+	// 复制和引用两种方式组成的包，数据与各段依次相接的结果相同
+	for (int ref = 0; ref < 2; ref++) {
+		iovec_free_cnt = 0;
+		pktbuf_t * buf = pktbuf_from_iovec(iov, 4, ref ? iovec_free : 0, (void *)0);
+		if (!buf || (pktbuf_total(buf) != sizeof(temp))) {
+			plat_printf("pktbuf_from_iovec error\n");
+			return;
+		}
+		plat_memset(read_temp, 0, sizeof(read_temp));
+		pktbuf_read_all(buf, read_temp);
+		if (plat_memcmp(temp, read_temp, sizeof(temp)) != 0) {
+			plat_printf("pktbuf_from_iovec error: data\n");
+			return;
+		}
+
+		// 再分成多段取出，拼起来应与原数据相同
+		pktbuf_iovec_t out[32];
+		int cnt = pktbuf_to_iovec(buf, 123, 2500, out, 32);
+		if (cnt <= 0) {
+			plat_printf("pktbuf_to_iovec error\n");
+			return;
+		}
+		int size = 0;
+		for (int i = 0; i < cnt; i++) {
+			plat_memcpy(read_temp + size, out[i].data, out[i].size);
+			size += out[i].size;
+		}
+		if ((size != 2500) || (plat_memcmp(temp + 123, read_temp, size) != 0)) {
+			plat_printf("pktbuf_to_iovec error: data\n");
+			return;
+		}
+
+		pktbuf_free(buf);
+		if (iovec_free_cnt != (ref ? 4 : 0)) {
+			plat_printf("pktbuf_from_iovec error: free count %d\n", iovec_free_cnt);
+			return;
+		}
+	}
+}
+
+static pktbuf_t * gro_out_tbl[16];
+static int gro_out_cnt;
+static net_err_t gro_out_in (netif_t * netif, pktbuf_t * buf) {
+	if (gro_out_cnt >= 16) {
+		return NET_ERR_FULL;
+	}
+	gro_out_tbl[gro_out_cnt++] = buf;
+	return NET_ERR_OK;
+}
+
+void gso_test (void) {
+	static uint8_t pkt[14 + 20 + 20 + 4000], read_temp[sizeof(pkt)];
+	static const uint8_t ip_hdr[] = {
+		0x45, 0, 0, 0, 0x12, 0, 0x40, 0, 64, NET_PROTOCOL_TCP, 0, 0, 192, 168, 74, 1, 192, 168, 74, 2,
+	};
+	static const uint8_t tcp_hdr[] = {
+		0, 80, 0, 81, 0xFF, 0xFF, 0xF0, 0, 0, 0, 0, 0, 5 << 4, 0x18, 0x10, 0,
+	};
+	static link_layer_t gro_layer = {.type = NETIF_TYPE_ETHER, .in = gro_out_in};
+	static netif_t gro_netif;
+
+	// 以太网包头、IP包头、TCP包头及数据
+	int ip_size = sizeof(pkt) - 14;
+	uint8_t * ip = pkt + 14, * tcp = ip + 20;
+	plat_memset(pkt, 0, sizeof(pkt));
+	plat_memset(pkt, 0x11, 12);
+	pkt[12] = 0x08;
+	plat_memcpy(ip, ip_hdr, sizeof(ip_hdr));
+	ip[2] = (uint8_t)(ip_size >> 8);
+	ip[3] = (uint8_t)ip_size;
+	uint16_t sum = (uint16_t)~checksum16(ip, 20, 0);
+	ip[10] = (uint8_t)(sum >> 8);
+	ip[11] = (uint8_t)sum;
+	plat_memcpy(tcp, tcp_hdr, sizeof(tcp_hdr));
+	for (int i = 0; i < ip_size - 40; i++) {
+		tcp[20 + i] = (uint8_t)(i * 11 + 1);
+	}
+
+	// 先填入TCP校验和，得到完整的原始包
+	pktbuf_t * buf = pktbuf_alloc(ip_size);
+	pktbuf_reset_acc(buf);
+	pktbuf_write(buf, ip, ip_size);
+	buf->meta.flags |= PKTBUF_CSUM_NEED;
+	buf->meta.l3 = 0;
+	buf->meta.l4 = 20;
+	net_gso_csum(buf);
+	pktbuf_read_all(buf, ip);
+
+	// 分段后每段的数据与原包对应的部分相同
+	nlist_t list;
+	if (net_gso_segment(buf, 1000, &list) < 0) {
+		plat_printf("net_gso_segment error\n");
+		return;
+	}
+	pktbuf_free(buf);
+
+	gro_netif.type = NETIF_TYPE_ETHER;
+	gro_netif.link_layer = &gro_layer;
+	gro_out_cnt = 0;
+	net_gro_t gro;
+	net_gro_init(&gro, &gro_netif);
+
+	int offset = 0;
+	nlist_node_t * node;
+	while ((node = nlist_remove_first(&list))) {
+		pktbuf_t * seg = nlist_entry(node, pktbuf_t, node);
+		int size = pktbuf_read_all(seg, read_temp);
+		if ((size > 1000) || (plat_memcmp(read_temp + 40, tcp + 20 + offset, size - 40) != 0)) {
+			plat_printf("net_gso_segment error: data\n");
+			return;
+		}
+		offset += size - 40;
+
+		pktbuf_add_header(seg, 14, 1);
+		pktbuf_reset_acc(seg);
+		pktbuf_write(seg, pkt, 14);
+		net_gro_receive(&gro, seg);
+	}
+	net_gro_flush(&gro);
+
+	// 合并后应与原包完全相同
+	if ((offset != ip_size - 40) || (gro_out_cnt != 1)) {
+		plat_printf("net_gro_receive error: %d packets\n", gro_out_cnt);
+		return;
+	}
+	int size = pktbuf_read_all(gro_out_tbl[0], read_temp);
+	if ((size != sizeof(pkt)) || (plat_memcmp(pkt, read_temp, size) != 0)) {
+		plat_printf("net_gro_receive error: data\n");
+		return;
+	}
+	pktbuf_free(gro_out_tbl[0]);
+}
+
+// 过滤程序的测试用例：跳转、ALU的边界值、越界读取、除数为0
+typedef struct _bpf_case_t {
+	const char * name;
+	int cnt;
+	net_bpf_insn_t insn[16];
+}bpf_case_t;
+
+static const bpf_case_t bpf_case_tbl[] = {
+	{"jmp_k", 10, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_H | NET_BPF_ABS, 12),
+		NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K, 0x0800, 0, 4),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_B | NET_BPF_ABS, 23),
+		NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JGT | NET_BPF_K, 5, 0, 1),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 100),
+		NET_BPF_STMT(NET_BPF_JMP | NET_BPF_JA, 1),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 0),
+		NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JSET | NET_BPF_K, 0x1, 0, 1),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 7),
+	}},
+	{"jmp_x", 7, {
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_B | NET_BPF_MSH, 14),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_B | NET_BPF_ABS, 15),
+		NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JGE | NET_BPF_X, 0, 0, 2),
+		NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JSET | NET_BPF_X, 0, 0, 1),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+		NET_BPF_STMT(NET_BPF_MISC | NET_BPF_TXA, 0),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"alu_k", 13, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_W | NET_BPF_LEN, 0),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_SUB | NET_BPF_K, 20),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_ADD | NET_BPF_K, 0xFFFFFFFF),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_MUL | NET_BPF_K, 0x9E3779B1),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_LSH | NET_BPF_K, 31),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_RSH | NET_BPF_K, 3),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_NEG, 0),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_XOR | NET_BPF_K, 0xA5A5A5A5),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_OR | NET_BPF_K, 0x100),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_AND | NET_BPF_K, 0xFFFF0FFF),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_DIV | NET_BPF_K, 7),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_MOD | NET_BPF_K, 1000),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"alu_x", 15, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_W | NET_BPF_LEN, 0),
+		NET_BPF_STMT(NET_BPF_MISC | NET_BPF_TAX, 0),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_H | NET_BPF_ABS, 12),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_MUL | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_ST, 3),
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM, 35),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_LSH | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_MEM, 3),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_ADD | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM, 0xFFFFFFFF),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_XOR | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_SUB | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM, 33),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_RSH | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"ld_abs_w", 2, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_W | NET_BPF_ABS, 60),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"ld_abs_h", 2, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_H | NET_BPF_ABS, 62),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"ld_abs_big", 2, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_W | NET_BPF_ABS, 0xFFFFFFFE),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 1),
+	}},
+	{"ld_ind_wrap", 3, {
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM, 0xFFFFFFFF),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_B | NET_BPF_IND, 1),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 1),
+	}},
+	{"ld_ind_h", 3, {
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_B | NET_BPF_MSH, 14),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_H | NET_BPF_IND, 16),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"ld_msh", 3, {
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_B | NET_BPF_MSH, 40),
+		NET_BPF_STMT(NET_BPF_MISC | NET_BPF_TXA, 0),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"div_x", 6, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_B | NET_BPF_ABS, 6),
+		NET_BPF_STMT(NET_BPF_MISC | NET_BPF_TAX, 0),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_W | NET_BPF_LEN, 0),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_ADD | NET_BPF_K, 1000),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_DIV | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_A, 0),
+	}},
+	{"div_x0", 4, {
+		NET_BPF_STMT(NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM, 0),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_IMM, 100),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_DIV | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 1),
+	}},
+	{"mod_x0", 5, {
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_B | NET_BPF_ABS, 5),
+		NET_BPF_STMT(NET_BPF_MISC | NET_BPF_TAX, 0),
+		NET_BPF_STMT(NET_BPF_LD | NET_BPF_W | NET_BPF_LEN, 0),
+		NET_BPF_STMT(NET_BPF_ALU | NET_BPF_MOD | NET_BPF_X, 0),
+		NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 1),
+	}},
+};
+
+void bpf_test (void) {
+	static const uint32_t len_tbl[] = {0, 1, 6, 7, 13, 14, 15, 24, 34, 41, 60, 63, 64};
+	static uint8_t pkt[64];
+	static net_bpf_t prog;
+
+	for (int i = 0; i < sizeof(pkt); i++) {
+		pkt[i] = (uint8_t)(i * 37 + 11);
+	}
+	pkt[5] = 0;
+	pkt[12] = 0x08;
+	pkt[13] = 0x00;
+	pkt[14] = 0x45;
+	pkt[23] = 6;
+
+	for (int i = 0; i < sizeof(bpf_case_tbl) / sizeof(bpf_case_t); i++) {
+		const bpf_case_t * c = bpf_case_tbl + i;
+		if (net_bpf_load(&prog, c->insn, c->cnt) < 0) {
+			plat_printf("bpf %s: load error\n", c->name);
+			return;
+		}
+
+		if (!prog.jit) {
+			plat_printf("bpf %s: no jit, skip\n", c->name);
+			continue;
+		}
+
+		// 编译出的代码与解释执行的结果必须完全一致
+		for (int j = 0; j < sizeof(len_tbl) / sizeof(uint32_t); j++) {
+			uint32_t expect = net_bpf_interp(prog.insn, pkt, len_tbl[j]);
+			uint32_t result = net_bpf_run(&prog, pkt, len_tbl[j]);
+			if (expect != result) {
+				plat_printf("bpf %s: len %d, interp %u, jit %u\n", c->name, (int)len_tbl[j], expect, result);
+				net_bpf_unload(&prog);
+				return;
+			}
+		}
+		net_bpf_unload(&prog);
+	}
+}
+
 void timer0_proc (struct _net_timer_t * timer, void * args) {
 	static int count = 1;
 	plat_printf("this is %s: %d\n", timer->name, count);
@@ -345,6 +706,10 @@ void basic_test (void) {
 	nlist_test();
 	mblock_test();
 	pktbuf_test();
+	pktbuf_cow_test();
+	pktbuf_iovec_test();
+	gso_test();
+	bpf_test();
 
 	uint32_t v1 = x_ntohl(0x12345678);
 	uint16_t v2 = x_ntohs(0x1234);
@@ -365,6 +730,14 @@ int main (void) {
 
 	while (1) {
 		sys_sleep(10);
+
+#if DBG_TRACE_ENABLE
+		// 定期导出跟踪记录，用net_trace工具解码
+		static int count;
+		if (++count % 1000 == 0) {
+			dbg_trace_dump("net.trc");
+		}
+#endif
 	}
 
 	return 0;
@@ -5,6 +5,24 @@
 #include "ether.h"
 #include "nlist.h"
 
+#define ARP_HW_ETHER        1
+#define ARP_REQUEST         1
+#define ARP_REPLY           2
+
+#pragma pack(1)
+typedef struct _arp_pkt_t {
+    uint16_t htype;
+    uint16_t ptype;
+    uint8_t hlen;
+    uint8_t plen;
+    uint16_t opcode;
+    uint8_t send_haddr[ETHER_HWA_SIZE];
+    uint8_t send_paddr[IPV4_ADDR_SIZE];
+    uint8_t target_haddr[ETHER_HWA_SIZE];
+    uint8_t target_paddr[IPV4_ADDR_SIZE];
+}arp_pkt_t;
+#pragma pack()
+
 typedef struct _arp_entry_t {
     uint8_t ipaddr[IPV4_ADDR_SIZE];
     uint8_t hwaddr[ETHER_HWA_SIZE];
@@ -22,5 +40,6 @@ typedef struct _arp_entry_t {
 }arp_entry_t;
 
 net_err_t arp_init (void);
+void arp_destroy (void);
 
 #endif
\ No newline at end of file
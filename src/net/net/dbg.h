@@ -9,17 +9,108 @@
 #define DBG_STYLE_RESET "\033[0m"
 
 #define DBG_LEVEL_NONE      0
-#define DBG_LEVEL_ERROR     1      
-#define DBG_LEVEL_WARNING   2     
-#define DBG_LEVEL_INFO      3     
+#define DBG_LEVEL_ERROR     1
+#define DBG_LEVEL_WARNING   2
+#define DBG_LEVEL_INFO      3
 
 void dbg_print (int m_level, int s_level, const char * file, const char * func, int len, const char * fmt, ...);
 void dbg_dump_hwaddr (const char * msg, const uint8_t * hwaddr, int len);
 void dbg_dump_ip (const char * msg, ipaddr_t * ipaddr);
 
-#define dbg_info(module, fmt, ...) dbg_print(module, DBG_LEVEL_INFO, __FILE__, __FUNCTION__, __LINE__, fmt, ##__VA_ARGS__)
-#define dbg_warning(module, fmt, ...) dbg_print(module, DBG_LEVEL_WARNING, __FILE__, __FUNCTION__, __LINE__, fmt, ##__VA_ARGS__)
-#define dbg_error(module, fmt, ...) dbg_print(module, DBG_LEVEL_ERROR, __FILE__, __FUNCTION__, __LINE__, fmt, ##__VA_ARGS__)
+// 模块级别和输出级别均为常量，不满足时整条语句在编译期被消除
+#define DBG_ENABLE(module, level)   (((level) <= (module)) && ((level) <= DBG_LEVEL_MAX))
+
+#define DBG_PRINT(module, level, fmt, ...) do { \
+        if (DBG_ENABLE(module, level)) { \
+            dbg_print(module, level, __FILE__, __FUNCTION__, __LINE__, fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#if DBG_TRACE_ENABLE
+
+#define DBG_TRACE_MAGIC     0x4352544e          // "NTRC"
+#define DBG_TRACE_VERSION   1
+
+typedef enum _dbg_arg_t {
+    DBG_ARG_INT = 1,
+    DBG_ARG_LONG,
+    DBG_ARG_LLONG,
+    DBG_ARG_SIZE,
+    DBG_ARG_PTR,
+    DBG_ARG_DOUBLE,
+    DBG_ARG_STR,
+}dbg_arg_t;
+
+/**
+ * 输出点，每个dbg_info处一个静态实例。首次执行时登记，格式串只在导出时写出一次
+ */
+typedef struct _dbg_site_t {
+    volatile int id;                    // 0-未登记，-1-登记中，>0-已登记
+    int level;
+    const char * file;
+    const char * func;
+    int line;
+    const char * fmt;
+
+    int arg_cnt;
+    uint8_t arg_type[DBG_TRACE_ARG_MAX];
+}dbg_site_t;
+
+/**
+ * 跟踪记录，参数按类型依次存放，int为4字节，其余为8字节，字符串为长度+内容（可能被截断）
+ */
+typedef struct _dbg_trace_rec_t {
+    uint64_t time;                      // 单调时间，纳秒
+    volatile int seq;                   // 写入序号，导出时用于检测记录是否被覆盖
+    uint16_t site;                      // 输出点id
+    uint16_t size;                      // 参数区已用字节数
+    uint8_t arg[DBG_TRACE_ARG_SIZE];
+}dbg_trace_rec_t;
+
+// 导出文件：dbg_trace_hdr_t，site_cnt个输出点，ring_cnt个跟踪环
+typedef struct _dbg_trace_hdr_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t site_cnt;
+    uint32_t ring_cnt;
+}dbg_trace_hdr_t;
+
+// 输出点之后依次为file、func、fmt三个字符串，不含结束符
+typedef struct _dbg_trace_site_hdr_t {
+    uint16_t id;
+    uint8_t level;
+    uint8_t arg_cnt;
+    uint32_t line;
+    uint8_t arg_type[DBG_TRACE_ARG_MAX];
+    uint16_t file_len;
+    uint16_t func_len;
+    uint16_t fmt_len;
+    uint16_t reserved;
+}dbg_trace_site_hdr_t;
+
+// 跟踪环之后为rec_cnt条按时间顺序的dbg_trace_rec_t
+typedef struct _dbg_trace_ring_hdr_t {
+    uint32_t thread;
+    uint32_t rec_cnt;
+}dbg_trace_ring_hdr_t;
+
+void dbg_trace (dbg_site_t * site, ...);
+int dbg_trace_dump (const char * path);
+
+#define DBG_TRACE(module, level, fmt, ...) do { \
+        if (DBG_ENABLE(module, level)) { \
+            static dbg_site_t _dbg_site = {0, level, __FILE__, __FUNCTION__, __LINE__, fmt}; \
+            dbg_trace(&_dbg_site, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define dbg_info(module, fmt, ...) DBG_TRACE(module, DBG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define dbg_info(module, fmt, ...) DBG_PRINT(module, DBG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#endif
+
+#define dbg_warning(module, fmt, ...) DBG_PRINT(module, DBG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+#define dbg_error(module, fmt, ...) DBG_PRINT(module, DBG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
 
 #define dbg_assert(expr, msg) {\
     if (!(expr)) {\
@@ -28,6 +119,6 @@ void dbg_dump_ip (const char * msg, ipaddr_t * ipaddr);
     }\
 }
 
-#define DBG_DISP_ENABLE(module) (module >= DBG_LEVEL_INFO)
+#define DBG_DISP_ENABLE(module) ((module >= DBG_LEVEL_INFO) && (DBG_LEVEL_MAX >= DBG_LEVEL_INFO))
 
-#endif
\ No newline at end of file
+#endif
@@ -4,10 +4,12 @@
 #include "net_err.h"
 #include <stdint.h>
 #include "netif.h"
+#include "net_stats.h"
 
 #define ETHER_HWA_SIZE      6
 #define ETHER_MTU           1500
 #define ETHER_DATA_MIN      46
+#define ETHER_TYPE_MIN      0x0600              // 小于该值的为802.3长度字段
 
 #pragma pack(1)
 typedef struct _ether_hdr_t {
@@ -22,7 +24,13 @@ typedef struct _ether_pkt_t {
 }ether_pkt_t;
 #pragma pack()
 
+// 上层协议的输入处理，buf已去掉以太网包头；返回错误时由调用者释放buf
+typedef net_err_t (*ether_proto_in_t) (netif_t * netif, pktbuf_t * buf);
+
 net_err_t ether_init (void);
+net_err_t ether_register_proto (uint16_t type, ether_proto_in_t in);
+net_err_t ether_proto_in (netif_t * netif, uint16_t type, pktbuf_t * buf);
+void ether_proto_stats_add (uint16_t type, net_stat_t stat, int size);
 
 const uint8_t * ether_broadcast_addr (void);
 net_err_t ether_raw_out (netif_t * netif, uint16_t protocol, uint8_t * dest, pktbuf_t * buf);
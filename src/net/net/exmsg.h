@@ -17,9 +17,14 @@ typedef struct _exmsg_t {
     union {
         msg_netif_t netif;
     };
+
+#if NET_LAT_ENABLE
+    uint64_t lat_time;                  // 发送时间，为0表示未被采样
+#endif
 } exmsg_t;
 
 net_err_t exmsg_init (void);
+void exmsg_destroy (void);
 net_err_t exmsg_start (void);
 
 net_err_t exmsg_netif_in(netif_t * netif);
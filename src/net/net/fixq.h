@@ -7,7 +7,8 @@
 
 typedef struct _fixq_t {
     int size;
-    int in, out, cnt;
+    int in, out;
+    volatile int cnt;
 
     void ** buf;
 
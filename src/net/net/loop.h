@@ -3,6 +3,16 @@
 
 #include "netif.h"
 
+// 经回环网卡队列转交时的包头，只在本机内使用，主机字节序
+typedef struct _loop_hdr_t {
+    netif_t * netif;                    // 接收的网卡
+    uint16_t protocol;
+}loop_hdr_t;
+
 net_err_t loop_init (void);
+void loop_destroy (void);
+
+netif_t * loop_find (const ipaddr_t * ip);
+net_err_t loop_deliver (netif_t * from, netif_t * to, uint16_t protocol, pktbuf_t * buf);
 
 #endif
\ No newline at end of file
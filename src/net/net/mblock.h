@@ -2,18 +2,32 @@
 #define MBLOCK_H
 
 #include "nlist.h"
+#include <stdint.h>
 #include "nlocker.h"
 
 typedef struct _mblock_t {
-    nlist_t free_list;
+    volatile uint64_t free_head;
+    volatile int free_cnt;
+    volatile int wait_cnt;
     void * start;
+    void * mem;                     // mblock_create分配的内存，销毁时释放
+    void * slab_list;               // 扩充分配的内存
     nlocker_t locker;
     sys_sem_t alloc_sem;
+
+    int blk_size;
+    int cnt;
+    int slab_cnt;
+    int max_cnt;
+    int mem_flags;
 }mblock_t;
 
 net_err_t mblock_init (mblock_t * mblock, void * mem, int blk_size, int cnt, nlocker_type_t type);
+net_err_t mblock_create (mblock_t * mblock, int blk_size, int cnt, nlocker_type_t type, int mem_flags);
+void mblock_set_grow (mblock_t * mblock, int slab_cnt, int max_cnt);
 void * mblock_alloc (mblock_t * mblock, int ms);
 int mblock_free_cnt (mblock_t * mblock);
+int mblock_cnt (mblock_t * mblock);
 void mblock_free (mblock_t * mblock, void * mem);
 void mblock_destroy (mblock_t * mblock);
 
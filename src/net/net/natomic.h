@@ -0,0 +1,140 @@
+#ifndef NATOMIC_H
+#define NATOMIC_H
+
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+static inline int natomic_load (volatile int * v) {
+    return _InterlockedOr((volatile long *)v, 0);
+}
+
+static inline void natomic_store (volatile int * v, int value) {
+    _InterlockedExchange((volatile long *)v, value);
+}
+
+static inline int natomic_add (volatile int * v, int delta) {
+    return _InterlockedExchangeAdd((volatile long *)v, delta) + delta;
+}
+
+static inline int natomic_xchg (volatile int * v, int value) {
+    return _InterlockedExchange((volatile long *)v, value);
+}
+
+static inline int natomic_cas (volatile int * v, int * expect, int value) {
+    int old = _InterlockedCompareExchange((volatile long *)v, value, *expect);
+    if (old == *expect) {
+        return 1;
+    }
+
+    *expect = old;
+    return 0;
+}
+
+static inline uint64_t natomic_load64 (volatile uint64_t * v) {
+    return (uint64_t)_InterlockedCompareExchange64((volatile int64_t *)v, 0, 0);
+}
+
+static inline uint64_t natomic_add64 (volatile uint64_t * v, uint64_t delta) {
+    return (uint64_t)_InterlockedExchangeAdd64((volatile int64_t *)v, (int64_t)delta) + delta;
+}
+
+// 仅有一个线程写入时使用，不加总线锁，其它线程读到的不会是写了一半的值
+static inline void natomic_add64_local (volatile uint64_t * v, uint64_t delta) {
+#if defined(_WIN64)
+    *v = *v + delta;
+#else
+    _InterlockedExchange64((volatile int64_t *)v, (int64_t)(*v + delta));
+#endif
+}
+
+static inline int natomic_cas64 (volatile uint64_t * v, uint64_t * expect, uint64_t value) {
+    uint64_t old = (uint64_t)_InterlockedCompareExchange64((volatile int64_t *)v, (int64_t)value, (int64_t)*expect);
+    if (old == *expect) {
+        return 1;
+    }
+
+    *expect = old;
+    return 0;
+}
+
+// 读到的指针所指向的内容，至少是发布该指针之前写入的
+static inline void * natomic_load_ptr (void * volatile * p) {
+#if defined(_M_IX86) || defined(_M_X64)
+    void * v = *p;
+    _ReadWriteBarrier();
+    return v;
+#else
+    return _InterlockedCompareExchangePointer(p, (void *)0, (void *)0);
+#endif
+}
+
+static inline void natomic_store_ptr (void * volatile * p, void * value) {
+    _InterlockedExchangePointer(p, value);
+}
+
+#else
+
+static inline int natomic_load (volatile int * v) {
+    return __atomic_load_n(v, __ATOMIC_SEQ_CST);
+}
+
+static inline void natomic_store (volatile int * v, int value) {
+    __atomic_store_n(v, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int natomic_add (volatile int * v, int delta) {
+    return __atomic_add_fetch(v, delta, __ATOMIC_SEQ_CST);
+}
+
+static inline int natomic_xchg (volatile int * v, int value) {
+    return __atomic_exchange_n(v, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int natomic_cas (volatile int * v, int * expect, int value) {
+    return __atomic_compare_exchange_n(v, expect, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t natomic_load64 (volatile uint64_t * v) {
+    return __atomic_load_n(v, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t natomic_add64 (volatile uint64_t * v, uint64_t delta) {
+    return __atomic_add_fetch(v, delta, __ATOMIC_SEQ_CST);
+}
+
+// 仅有一个线程写入时使用，不加总线锁，其它线程读到的不会是写了一半的值
+static inline void natomic_add64_local (volatile uint64_t * v, uint64_t delta) {
+    __atomic_store_n(v, __atomic_load_n(v, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+}
+
+static inline int natomic_cas64 (volatile uint64_t * v, uint64_t * expect, uint64_t value) {
+    return __atomic_compare_exchange_n(v, expect, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// 读到的指针所指向的内容，至少是发布该指针之前写入的
+static inline void * natomic_load_ptr (void * volatile * p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void natomic_store_ptr (void * volatile * p, void * value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+#endif
+
+// 自旋等待时调用，降低功耗并让出超线程的执行资源
+static inline void natomic_pause (void) {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    _mm_pause();
+#elif defined(_MSC_VER) && (defined(_M_ARM) || defined(_M_ARM64))
+    __yield();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#endif
\ No newline at end of file
@@ -3,6 +3,23 @@
 
 #include "net_err.h"
 
+typedef struct _net_pool_cfg_t {
+    int pktbuf_blk_cnt;
+    int pktbuf_buf_cnt;
+    int exmsg_msg_cnt;
+    int arp_cache_size;
+
+    int pktbuf_slab_cnt;
+    int pktbuf_blk_max;
+    int pktbuf_buf_max;
+
+    int mem_flags;
+}net_pool_cfg_t;
+
+void net_pool_cfg_default (net_pool_cfg_t * cfg);
+net_err_t net_pool_cfg_set (const net_pool_cfg_t * cfg);
+const net_pool_cfg_t * net_pool_cfg_get (void);
+
 net_err_t net_init (void);
 net_err_t net_start (void);
 
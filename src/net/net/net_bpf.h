@@ -0,0 +1,97 @@
+#ifndef NETBPF_H
+#define NETBPF_H
+
+#include <stdint.h>
+#include "net_cfg.h"
+#include "net_err.h"
+
+// 经典BPF指令，与pcap的struct bpf_insn布局相同，pcap_compile生成的程序可直接使用
+typedef struct _net_bpf_insn_t {
+    uint16_t code;
+    uint8_t jt;
+    uint8_t jf;
+    uint32_t k;
+}net_bpf_insn_t;
+
+// 指令类别
+#define NET_BPF_LD          0x00
+#define NET_BPF_LDX         0x01
+#define NET_BPF_ST          0x02
+#define NET_BPF_STX         0x03
+#define NET_BPF_ALU         0x04
+#define NET_BPF_JMP         0x05
+#define NET_BPF_RET         0x06
+#define NET_BPF_MISC        0x07
+
+// 读取的宽度
+#define NET_BPF_W           0x00
+#define NET_BPF_H           0x08
+#define NET_BPF_B           0x10
+
+// 寻址方式
+#define NET_BPF_IMM         0x00
+#define NET_BPF_ABS         0x20
+#define NET_BPF_IND         0x40
+#define NET_BPF_MEM         0x60
+#define NET_BPF_LEN         0x80
+#define NET_BPF_MSH         0xa0
+
+// 运算
+#define NET_BPF_ADD         0x00
+#define NET_BPF_SUB         0x10
+#define NET_BPF_MUL         0x20
+#define NET_BPF_DIV         0x30
+#define NET_BPF_OR          0x40
+#define NET_BPF_AND         0x50
+#define NET_BPF_LSH         0x60
+#define NET_BPF_RSH         0x70
+#define NET_BPF_NEG         0x80
+#define NET_BPF_MOD         0x90
+#define NET_BPF_XOR         0xa0
+
+// 跳转
+#define NET_BPF_JA          0x00
+#define NET_BPF_JEQ         0x10
+#define NET_BPF_JGT         0x20
+#define NET_BPF_JGE         0x30
+#define NET_BPF_JSET        0x40
+
+// 操作数：常数k、X寄存器，返回值为A寄存器
+#define NET_BPF_K           0x00
+#define NET_BPF_X           0x08
+#define NET_BPF_A           0x10
+
+#define NET_BPF_TAX         0x00
+#define NET_BPF_TXA         0x80
+
+#define NET_BPF_CLASS(code) ((code) & 0x07)
+#define NET_BPF_SIZE(code)  ((code) & 0x18)
+#define NET_BPF_MODE(code)  ((code) & 0xe0)
+#define NET_BPF_OP(code)    ((code) & 0xf0)
+#define NET_BPF_SRC(code)   ((code) & 0x08)
+
+#define NET_BPF_STMT(code, k)           {(uint16_t)(code), 0, 0, (k)}
+#define NET_BPF_JUMP(code, k, jt, jf)   {(uint16_t)(code), (jt), (jf), (k)}
+
+#define NET_BPF_MEM_CNT     16          // 暂存区M[]的字数
+
+// 返回0表示丢弃，否则表示接收
+typedef uint32_t (*net_bpf_func_t) (const uint8_t * pkt, uint32_t len);
+
+typedef struct _net_bpf_t {
+    net_bpf_func_t jit;                 // 编译出的本机代码，为0时解释执行
+    int jit_size;
+    int cnt;
+    net_bpf_insn_t insn[NET_BPF_INSN_MAX];
+}net_bpf_t;
+
+net_err_t net_bpf_check (const net_bpf_insn_t * insn, int cnt);
+net_err_t net_bpf_load (net_bpf_t * prog, const net_bpf_insn_t * insn, int cnt);
+void net_bpf_unload (net_bpf_t * prog);
+uint32_t net_bpf_interp (const net_bpf_insn_t * insn, const uint8_t * pkt, uint32_t len);
+
+static inline uint32_t net_bpf_run (const net_bpf_t * prog, const uint8_t * pkt, uint32_t len) {
+    return prog->jit ? prog->jit(pkt, len) : net_bpf_interp(prog->insn, pkt, len);
+}
+
+#endif
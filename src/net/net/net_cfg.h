@@ -12,25 +12,87 @@
 #define DBG_TOOLS           DBG_LEVEL_INFO
 #define DBG_TIMER           DBG_LEVEL_NONE
 #define DBG_ARP             DBG_LEVEL_INFO
+#define DBG_VLAN            DBG_LEVEL_INFO
+#define DBG_BPF             DBG_LEVEL_INFO
+#define DBG_GSO             DBG_LEVEL_INFO
+
+#ifndef DBG_LEVEL_MAX
+#define DBG_LEVEL_MAX       DBG_LEVEL_INFO      // 编译期允许的最高级别，高于该级别的输出不生成代码，可由编译选项覆盖
+#endif
+#define DBG_TRACE_ENABLE    0                   // 1-info输出写入线程本地的二进制跟踪环，由工具离线解码
+#define DBG_TRACE_SIZE      1024                // 每线程跟踪环的记录数，须为2的幂
+#define DBG_TRACE_THREAD_MAX 16                 // 最多跟踪的线程数
+#define DBG_TRACE_SITE_MAX  256                 // 最多跟踪的输出点数
+#define DBG_TRACE_ARG_MAX   8                   // 每条记录的最多参数数量
+#define DBG_TRACE_ARG_SIZE  48                  // 每条记录的参数区大小
 
 #define NET_ENDIAN_LITTLE   1
 
 #define EXMSG_MSG_CNT       10
 #define EXMSG_LOCKER        NLOCKER_THREAD
+#define EXMSG_CPU_MASK      0                   // 工作线程绑定的CPU集合，每位对应一个CPU，0-不绑定
+#define EXMSG_PRIORITY      0                   // 工作线程的实时优先级，0-普通调度
+#define EXMSG_NUMA_NODE     -1                  // 工作线程所在的NUMA节点，EXMSG_CPU_MASK为0时绑定到该节点的CPU，-1-不限制
+#define NET_THREAD_STACK    0                   // 协议栈及驱动线程的堆栈大小，0-系统默认
+
+#define NET_NUMA_NODE_MAX   4                   // 包缓存按NUMA节点分池的最大节点数，每个节点按相同的配置创建
 
 #define PKTBUF_BLK_SIZE     128
 #define PKTBUF_BLK_CNT      100
 #define PKTBUF_BUF_CNT      100
+#define PKTBUF_SLAB_CNT     0
+#define PKTBUF_BLK_MAX      PKTBUF_BLK_CNT
+#define PKTBUF_BUF_MAX      PKTBUF_BUF_CNT
+#define PKTBUF_IDX_SIZE     8
 
 #define NETIF_HWADDR_SIZE   10
 #define NETIF_NAME_SIZE     10
-#define NET_INQ_SIZE        50
+#define NET_INQ_SIZE        50                  // 输入队列最多排队的包数
+#define NET_INQ_BYTES       0                   // 输入队列最多排队的字节数，0-不限制
+#define NET_INQ_QDISC       QDISC_FIFO          // 输入队列的排队规则，见qdisc_type_t
 #define NET_OUTQ_SIZE       50
+#define NET_OUTQ_BYTES      0
+#define NET_OUTQ_QDISC      QDISC_FIFO
+#define NET_OUTQ_RATE       0                   // 输出队列的限速，字节/秒，0-不限速
+#define NET_OUTQ_BURST      0                   // 限速时可连续发送的字节数，0-按2ms的流量
+#define NET_QDISC_FLOW_MAX  16                  // fq_codel的最多流队列数
+#define NET_QDISC_CTRL_SIZE 16                  // 控制包队列最多排队的包数，0-不区分控制包
+#define NET_QDISC_CTRL_WEIGHT   8               // 连续发送该数量的控制包后发送一个普通包，0-严格优先
+
+#define NETIF_DEV_CNT       10                  // 网卡数量，含VLAN子接口
+#define NETIF_POLL_BUDGET   64                  // 轮询模式下每次从一个网卡最多收取的包数
+#define NETIF_POLL_IDLE_MS  1                   // 存在轮询模式的网卡时，工作线程空闲等待的最长时间，ms
+#define NET_LOOP_DEPTH_MAX  4                   // 发往本机的包直接投递时允许嵌套的层数，超过后经回环网卡的队列转交
 
-#define NETIF_DEV_CNT       10
+#define NET_BPF_INSN_MAX    128                 // 网卡收包过滤程序的最多指令数
+#define NET_BPF_JIT         1                   // 1-在x86-64上将过滤程序编译为本机代码，其它平台总是解释执行
+
+#define NET_GSO_ENABLE      1                   // 1-超过MTU的IPv4包在交给链路层前分段，TCP按MSS分段，其它分片
+#define NET_GRO_ENABLE      1                   // 1-一次取出的连续TCP包合并后再交给协议处理
+#define NET_GRO_FLOW_MAX    8                   // 同时合并的最多流数
+#define NET_GRO_SIZE_MAX    65535               // 合并后的IP包最大长度
 
 #define TIMER_NAME_SIZE     32
 
+#define ETHER_PROTO_TBL_SIZE 32                 // 以太网上层协议分发表的大小，须为2的幂
+
 #define ARP_CACHE_SIZE      50
 
+#define NET_MEM_FLAGS       0
+
+#define NET_STATS_THREAD_MAX 16                 // 拥有独立统计计数的最多线程数，其余线程共用一份
+
+#define NET_METRICS_ENABLE  1                   // 定期将统计信息发布到共享内存
+#define NET_METRICS_NAME    "net_metrics"       // 共享内存名称，Linux下为/dev/shm/net_metrics
+#define NET_METRICS_PERIOD  1000                // 发布周期，ms
+#define NET_METRICS_POOL_MAX (4 + 2 * NET_NUMA_NODE_MAX)
+#define NET_METRICS_QUEUE_MAX 4
+
+#define NET_LAT_ENABLE      1                   // 统计包在各处理阶段的延时
+#define NET_LAT_SAMPLE      64                  // 每多少个包采样一个，须为2的幂
+
+#define NET_BUSY_POLL       0                   // 1-工作线程和驱动线程忙轮询各自的队列，以占用CPU换取更低的延时
+#define NET_BUSY_POLL_US    50                  // 取不到数据时最长的自旋时间，us
+#define NET_BUSY_POLL_MIN_US 2                  // 持续空闲时自旋时间逐次减半，直至该值
+
 #endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef NET_GSO_H
+#define NET_GSO_H
+
+#include <stdint.h>
+#include "net_cfg.h"
+#include "net_err.h"
+#include "nlist.h"
+#include "pktbuf.h"
+
+#define NET_GRO_HDR_MAX     98          // 以太网及VLAN标签、无选项的IP包头、最长的TCP包头
+
+struct _netif_t;
+
+// 正在合并的TCP流，保存第一个包及之后各包的数据
+typedef struct _net_gro_flow_t {
+    pktbuf_t * buf;                     // 为0表示空闲
+    uint8_t hdr[NET_GRO_HDR_MAX];       // 第一个包的包头，用于比较后续的包
+    int hlen;                           // 数据在帧中的起始位置
+    int l3;                             // IP包头在帧中的起始位置
+    int mss;                            // 第一个包的数据长度，更长的包不能合并
+    int size;                           // 已合并的数据长度
+    uint32_t next_seq;
+    uint32_t sum;                       // 已合并数据的16位反码和
+    uint32_t hash;
+    uint16_t window;                    // 最后一个包的窗口
+    int cnt;
+}net_gro_flow_t;
+
+typedef struct _net_gro_t {
+    struct _netif_t * netif;
+    int next;                           // 没有空闲项时，下一个被提前交出的流
+    net_gro_flow_t flow[NET_GRO_FLOW_MAX];
+}net_gro_t;
+
+net_err_t net_gso_segment (pktbuf_t * buf, int mtu, nlist_t * list);
+net_err_t net_gso_csum (pktbuf_t * buf);
+
+void net_gro_init (net_gro_t * gro, struct _netif_t * netif);
+net_err_t net_gro_receive (net_gro_t * gro, pktbuf_t * buf);
+void net_gro_flush (net_gro_t * gro);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef NET_LAT_H
+#define NET_LAT_H
+
+#include <stdint.h>
+#include "net_cfg.h"
+#include "pktbuf.h"
+#include "sys.h"
+
+// 对数-线性分桶：每个2的幂区间再均分为16份，相对误差不超过1/16，最大约18分钟
+#define NET_LAT_SUB_BITS        4
+#define NET_LAT_SUB_CNT         (1 << NET_LAT_SUB_BITS)
+#define NET_LAT_MAX_BITS        40
+#define NET_LAT_BUCKET_CNT      ((NET_LAT_MAX_BITS - NET_LAT_SUB_BITS + 1) * NET_LAT_SUB_CNT)
+
+typedef enum _net_lat_stage_t {
+    NET_LAT_RX = 0,                     // 驱动收到到放入输入队列
+    NET_LAT_INQ,                        // 在netif输入队列中
+    NET_LAT_MSGQ,                       // 在工作线程消息队列中
+    NET_LAT_PROC,                       // 从输入队列取出到放入输出队列
+    NET_LAT_OUTQ,                       // 在netif输出队列中
+    NET_LAT_XMIT,                       // 从输出队列取出到驱动发送完成
+    NET_LAT_TOTAL,                      // 驱动收到到驱动发送完成
+
+    NET_LAT_STAGE_CNT,
+}net_lat_stage_t;
+
+typedef struct _net_lat_hist_t {
+    uint64_t count;
+    uint64_t sum;                       // 总延时，纳秒
+    uint64_t max;
+    uint64_t bucket[NET_LAT_BUCKET_CNT];
+}net_lat_hist_t;
+
+typedef struct _net_lat_stats_t {
+    net_lat_hist_t stage[NET_LAT_STAGE_CNT];
+}net_lat_stats_t;
+
+void net_lat_record (net_lat_stage_t stage, uint64_t ns);
+void net_lat_snapshot (net_lat_stats_t * stats);
+uint64_t net_lat_percentile (const net_lat_hist_t * hist, double percent);
+const char * net_lat_stage_name (net_lat_stage_t stage);
+int net_lat_sample (void);
+
+#if NET_LAT_ENABLE
+/**
+ * 按采样率决定是否跟踪该包，time为进入协议栈的时间
+ */
+static inline void net_lat_begin (pktbuf_t * buf, uint64_t time) {
+    if (net_lat_sample()) {
+        buf->lat_hop = time;
+    }
+}
+
+/**
+ * 被采样的包离开一个阶段，记录在该阶段停留的时间
+ */
+static inline void net_lat_hop (pktbuf_t * buf, net_lat_stage_t stage) {
+    if (buf->lat_hop) {
+        uint64_t now = sys_time_ns();
+        net_lat_record(stage, now - buf->lat_hop);
+        buf->lat_hop = now;
+    }
+}
+
+/**
+ * 包进入输出队列。收到的包记录处理时间，本地生成的包从这里开始采样
+ */
+static inline void net_lat_out (pktbuf_t * buf) {
+    if (buf->lat_hop) {
+        net_lat_hop(buf, NET_LAT_PROC);
+    } else {
+        net_lat_begin(buf, sys_time_ns());
+    }
+}
+
+static inline void net_lat_end (pktbuf_t * buf) {
+    net_lat_hop(buf, NET_LAT_XMIT);
+    if (buf->lat_hop && buf->meta.netif) {
+        net_lat_record(NET_LAT_TOTAL, buf->lat_hop - buf->meta.time);
+    }
+}
+#else
+#define net_lat_begin(buf, time)
+#define net_lat_hop(buf, stage)
+#define net_lat_out(buf)
+#define net_lat_end(buf)
+#endif
+
+#endif
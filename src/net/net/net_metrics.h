@@ -0,0 +1,74 @@
+#ifndef NET_METRICS_H
+#define NET_METRICS_H
+
+#include <stdint.h>
+#include "net_cfg.h"
+#include "net_err.h"
+#include "net_stats.h"
+#include "net_lat.h"
+#include "mblock.h"
+#include "fixq.h"
+
+#define NET_METRICS_MAGIC       0x5254454d      // "METR"
+#define NET_METRICS_VERSION     6
+#define NET_METRICS_NAME_SIZE   16
+
+typedef struct _net_metrics_pool_t {
+    char name[NET_METRICS_NAME_SIZE];
+    int32_t free_cnt;
+    int32_t total_cnt;
+}net_metrics_pool_t;
+
+typedef struct _net_metrics_queue_t {
+    char name[NET_METRICS_NAME_SIZE];
+    int32_t cnt;
+    int32_t size;
+}net_metrics_queue_t;
+
+typedef struct _net_metrics_netif_t {
+    char name[NET_METRICS_NAME_SIZE];
+    int32_t state;                      // 0-不存在，其余同netif_t中的state+1
+    int32_t type;
+    int32_t in_q_cnt;
+    int32_t in_q_size;
+    int32_t out_q_cnt;
+    int32_t out_q_size;
+    uint64_t stats[NET_STAT_CNT];
+}net_metrics_netif_t;
+
+typedef struct _net_metrics_lat_t {
+    uint64_t count;
+    uint64_t p50;                       // 纳秒
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+}net_metrics_lat_t;
+
+/**
+ * 共享内存中的布局。seq为奇数时正在更新，读取方应在读取前后比较seq，不一致时重读
+ */
+typedef struct _net_metrics_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                      // 整个结构的大小
+    volatile int seq;
+    uint64_t update_time;               // 最近一次更新的时间，纳秒
+
+    int32_t netif_cnt;
+    int32_t pool_cnt;
+    int32_t queue_cnt;
+    int32_t timer_cnt;
+
+    net_metrics_netif_t netif[NETIF_DEV_CNT];
+    uint64_t proto[NET_STATS_PROTO_CNT][NET_STAT_CNT];
+    uint64_t pool_stats[NET_STATS_POOL_CNT];
+    net_metrics_pool_t pool[NET_METRICS_POOL_MAX];
+    net_metrics_queue_t queue[NET_METRICS_QUEUE_MAX];
+    net_metrics_lat_t lat[NET_LAT_STAGE_CNT];
+}net_metrics_t;
+
+net_err_t net_metrics_init (void);
+void net_metrics_add_pool (const char * name, mblock_t * mblock);
+void net_metrics_add_queue (const char * name, fixq_t * q);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef NET_POLL_H
+#define NET_POLL_H
+
+#include <stdint.h>
+#include "net_cfg.h"
+
+/**
+ * 忙轮询的自旋控制：取不到数据时先自旋一段时间，预算用完后再阻塞等待
+ * 自旋期间等到数据则预算加倍，自旋落空则减半，流量稀疏时逐渐减少CPU的空转
+ */
+typedef struct _net_poll_t {
+    uint64_t idle_start;                // 本轮自旋的开始时间，0表示未在自旋
+    int budget;                         // 当前的自旋预算，ns
+    int max_budget;
+    int min_budget;
+}net_poll_t;
+
+void net_poll_init (net_poll_t * poll, int max_us, int min_us);
+int net_poll_idle (net_poll_t * poll);
+void net_poll_busy (net_poll_t * poll);
+
+#endif
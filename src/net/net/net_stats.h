@@ -0,0 +1,66 @@
+#ifndef NET_STATS_H
+#define NET_STATS_H
+
+#include <stdint.h>
+#include "net_cfg.h"
+#include "net_err.h"
+
+typedef enum _net_stat_t {
+    NET_STAT_RX_PKTS = 0,
+    NET_STAT_RX_BYTES,
+    NET_STAT_TX_PKTS,
+    NET_STAT_TX_BYTES,
+    NET_STAT_RX_DROP_NOBUF,             // 无可用的包缓存
+    NET_STAT_RX_DROP_QFULL,             // 输入队列已满
+    NET_STAT_RX_DROP_AQM,               // 被输入队列的RED/CoDel提前丢弃
+    NET_STAT_RX_DROP_BAD,               // 包格式错误
+    NET_STAT_RX_DROP_LINK,              // 链路层处理失败
+    NET_STAT_RX_DROP_FILTER,            // 被网卡的过滤程序丢弃
+    NET_STAT_TX_DROP_QFULL,             // 输出队列已满
+    NET_STAT_TX_DROP_AQM,               // 被输出队列的RED/CoDel提前丢弃
+    NET_STAT_TX_ERR,                    // 驱动发送失败
+
+    NET_STAT_CNT,
+}net_stat_t;
+
+typedef enum _net_stats_proto_t {
+    NET_STATS_PROTO_ETHER = 0,
+    NET_STATS_PROTO_ARP,
+    NET_STATS_PROTO_IPV4,
+    NET_STATS_PROTO_VLAN,
+    NET_STATS_PROTO_OTHER,              // 其它未单独统计的以太网协议
+
+    NET_STATS_PROTO_CNT,
+}net_stats_proto_t;
+
+typedef enum _net_stats_pool_t {
+    NET_STAT_PKTBUF_EMPTY = 0,          // pktbuf_t分配失败
+    NET_STAT_PKTBLK_EMPTY,              // 数据块分配失败
+    NET_STAT_EXMSG_EMPTY,               // 消息分配失败
+    NET_STAT_EXMSG_QFULL,               // 消息队列已满
+
+    NET_STATS_POOL_CNT,
+}net_stats_pool_t;
+
+// 快照，各线程的计数累加后的结果；网卡按netif_t的id索引
+typedef struct _net_stats_t {
+    uint64_t netif[NETIF_DEV_CNT][NET_STAT_CNT];
+    uint64_t proto[NET_STATS_PROTO_CNT][NET_STAT_CNT];
+    uint64_t pool[NET_STATS_POOL_CNT];
+}net_stats_t;
+
+struct _netif_t;
+
+net_err_t net_stats_init (void);
+void net_stats_destroy (void);
+
+void net_stats_netif_add (struct _netif_t * netif, net_stat_t stat, int value);
+void net_stats_netif_clear (struct _netif_t * netif);
+void net_stats_proto_add (net_stats_proto_t proto, net_stat_t stat, int value);
+void net_stats_pool_inc (net_stats_pool_t stat);
+
+void net_stats_snapshot (net_stats_t * stats);
+const char * net_stats_name (net_stat_t stat);
+const char * net_stats_pool_name (net_stats_pool_t stat);
+
+#endif
@@ -4,10 +4,14 @@
 #include <stdint.h>
 #include "ipaddr.h"
 #include "nlist.h"
-#include "fixq.h"
+#include "qdisc.h"
 #include "net_cfg.h"
 #include "net_err.h"
 #include "pktbuf.h"
+#include "net_bpf.h"
+#include "net_stats.h"
+#include "natomic.h"
+#include "timer.h"
 
 typedef struct _netif_hwaddr_t {
     uint8_t addr[NETIF_HWADDR_SIZE];
@@ -18,6 +22,7 @@ typedef enum _netif_type_t {
     NETIF_TYPE_NONE = 0,
     NETIF_TYPE_ETHER,
     NETIF_TYPE_LOOP,
+    NETIF_TYPE_VLAN,
 
     NETIF_TYPE_SIZE,
 }netif_type_t;
@@ -27,6 +32,9 @@ typedef struct _netif_ops_t {
     net_err_t (*open) (struct _netif_t * netif, void * data);
     void (*close) (struct _netif_t * netif);
     net_err_t (*xmit) (struct _netif_t * netif);
+
+    // 可选，由工作线程调用：最多收取budget个包直接交给协议栈，并发送输出队列中的包，返回收取的数量
+    int (*poll) (struct _netif_t * netif, int budget);
 }netif_ops_t;
 
 struct _netif_t;
@@ -40,6 +48,7 @@ typedef struct _link_layer_t {
 }link_layer_t;
 
 typedef struct _netif_t {
+    int id;
     char name[NETIF_NAME_SIZE];
     netif_hwaddr_t hwaddr;
 
@@ -62,11 +71,16 @@ typedef struct _netif_t {
     const link_layer_t * link_layer;
 
     nlist_node_t node;
-    fixq_t in_q;
-    void * in_q_buf[NET_INQ_SIZE];
-
-    fixq_t out_q; 
-    void * out_q_buf[NET_OUTQ_SIZE];
+    qdisc_t in_q;                       // 入队不阻塞，满时按排队规则丢弃
+    qdisc_t out_q;
+    net_timer_t tx_timer;               // 输出队列被限速时，到时间后再次发送
+    int tx_timer_on;
+
+    // 收包过滤程序，为0时不过滤。两份轮流使用，设置时写入未在使用的一份再切换
+    net_bpf_t * volatile rx_filter;
+    int rx_filter_idx;
+    net_bpf_t rx_filter_buf[2];
+    volatile int rx_filter_seq;         // 收包线程执行过滤前后各加1，为奇数时正在执行
 }netif_t;
 
 net_err_t netif_init (void);
@@ -81,16 +95,42 @@ net_err_t netif_set_deactive (netif_t * netif);
 net_err_t netif_close (netif_t * netif);
 
 void netif_set_default (netif_t * netif);
+netif_t * netif_get (int id);
+
+void netif_parse_meta (netif_t * netif, pktbuf_t * buf);
 
-net_err_t netif_put_in (netif_t * netif, pktbuf_t * pktbuf, int ms);
+net_err_t netif_put_in (netif_t * netif, pktbuf_t * pktbuf);
 pktbuf_t * netif_get_in (netif_t * netif, int ms);
 
-net_err_t netif_put_out (netif_t * netif, pktbuf_t * pktbuf, int ms);
+net_err_t netif_link_in (netif_t * netif, pktbuf_t * buf);
+net_err_t netif_recv (netif_t * netif, pktbuf_t * buf);
+
+net_err_t netif_put_out (netif_t * netif, pktbuf_t * pktbuf);
 pktbuf_t * netif_get_out (netif_t * netif, int ms);
+net_err_t netif_xmit (netif_t * netif);
 
 net_err_t netif_out(netif_t * netif, ipaddr_t * ipaddr, pktbuf_t * buf);
+netif_t * netif_find_addr (const ipaddr_t * ip);
 
 net_err_t netif_register_layer(int type, const link_layer_t * layer);
 
+net_err_t netif_set_filter (netif_t * netif, const net_bpf_insn_t * insn, int cnt);
+
+/**
+ * 驱动在分配包缓存前对收到的原始帧调用，返回0时应丢弃该帧。每个网卡只能有一个收包线程调用
+ */
+static inline int netif_rx_filter (netif_t * netif, const uint8_t * frame, int len) {
+    int pass = 1;
+
+    natomic_add(&netif->rx_filter_seq, 1);
+    const net_bpf_t * filter = (const net_bpf_t *)natomic_load_ptr((void * volatile *)&netif->rx_filter);
+    if (filter && !net_bpf_run(filter, frame, (uint32_t)len)) {
+        net_stats_netif_add(netif, NET_STAT_RX_DROP_FILTER, 1);
+        pass = 0;
+    }
+    natomic_add(&netif->rx_filter_seq, 1);
+    return pass;
+}
+
 
 #endif
\ No newline at end of file
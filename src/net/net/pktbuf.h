@@ -11,23 +11,80 @@ typedef struct _pktblk_t {
     nlist_node_t node;
     int size;
     uint8_t * data;
+
+    volatile int ref;
+    int pool;                           // 所属的内存池，即NUMA节点序号
+    struct _pktblk_t * owner;
+    uint8_t * base;
     uint8_t payload[PKTBUF_BLK_SIZE];
 }pktblk_t;
 
+typedef struct _pktbuf_iovec_t {
+    uint8_t * data;
+    int size;
+}pktbuf_iovec_t;
+
+// 引用的外部数据不再被使用时调用，data为该段数据的起始地址
+typedef void (*pktbuf_free_fn_t)(void * ctx, uint8_t * data);
+
+typedef struct _pktbuf_idx_t {
+    pktblk_t * blk;
+    int offset;
+}pktbuf_idx_t;
+
+#define PKTBUF_META_PARSED      (1 << 0)    // 已解析包头，偏移及协议有效
+#define PKTBUF_META_HASH        (1 << 1)    // hash有效
+#define PKTBUF_CSUM_OK          (1 << 2)    // 校验和已验证，上层不必再检查
+#define PKTBUF_CSUM_NEED        (1 << 3)    // 上层未计算传输层校验和，发送前填入
+#define PKTBUF_GRO              (1 << 4)    // 由GRO合并，长度可超过MTU
+
+struct _netif_t;
+
+/**
+ * 收包时由网卡及链路层填写一次，上层及分类、分流时直接使用，不再解析包头
+ */
+typedef struct _pktbuf_meta_t {
+    struct _netif_t * netif;            // 收到该包的网卡，发出的包为0
+    uint64_t time;                      // 收到的时间，ns。本机发出的包为0，进入CoDel队列时填入
+    uint32_t hash;                      // 流哈希，同一流的包相同
+    int16_t l2;                         // 各层包头相对当前数据起始的位置，-1为未知或已去掉
+    int16_t l3;
+    int16_t l4;                         // IP分片中除第一片外为-1
+    uint16_t l3_proto;                  // 以太网类型
+    uint8_t l4_proto;                   // IP包头中的协议号
+    uint8_t l4_flags;                   // TCP标志
+    uint16_t flags;
+}pktbuf_meta_t;
+
 typedef struct _pktbuf_t {
     int total_size;
     nlist_t blk_list;
     nlist_node_t node;
 
-    int ref;
+    volatile int ref;
+    int pool;
     int pos;
     pktblk_t * curr_blk;
     uint8_t * blk_offset;
+    int blk_pos;
+
+    int idx_cnt;
+    pktbuf_idx_t idx[PKTBUF_IDX_SIZE];
+
+    pktbuf_meta_t meta;
+
+#if NET_LAT_ENABLE
+    uint64_t lat_hop;                   // 进入当前阶段的时间，为0表示未被采样
+#endif
 }pktbuf_t;
 
 net_err_t pktbuf_init(void);
+void pktbuf_destroy (void);
 pktbuf_t * pktbuf_alloc(int size);
 void pktbuf_free(pktbuf_t * pktbuf);
+pktbuf_t * pktbuf_clone(pktbuf_t * src);
+void pktbuf_set_node (int node);
+void pktbuf_meta_init (pktbuf_t * buf);
 
 static inline pktblk_t * pktblk_blk_next (pktblk_t * blk) {
     nlist_node_t * next = nlist_node_next(&blk->node);
@@ -63,6 +120,8 @@ net_err_t pktbuf_resize (pktbuf_t * buf, int to_size);
 
 net_err_t pktbuf_join (pktbuf_t * dest, pktbuf_t * src);
 
+net_err_t pktbuf_share (pktbuf_t * dest, pktbuf_t * src, int offset, int size);
+
 net_err_t pktbuf_set_cont(pktbuf_t * buf, int size);
 
 void pktbuf_reset_acc(pktbuf_t * buf);
@@ -77,6 +136,17 @@ net_err_t pktbuf_copy(pktbuf_t * dest, pktbuf_t * src, int size);
 
 net_err_t pktbuf_fill(pktbuf_t * buf, uint8_t value, int size);
 
+uint16_t pktbuf_checksum16 (pktbuf_t * buf, int size, uint32_t sum);
+
+int pktbuf_to_iovec(pktbuf_t * buf, int offset, int size, pktbuf_iovec_t * iov, int iov_cnt);
+
+/**
+ * 由多段数据组成包。free_fn为0时复制数据；否则不复制，每段数据由一个数据块引用，
+ * 包及由它克隆、共享、分段得到的包都不再引用某一段时，调用free_fn(ctx, 该段起始地址)，
+ * 此前调用者不能修改或释放该段。失败时返回0，不会调用free_fn
+ */
+pktbuf_t * pktbuf_from_iovec(const pktbuf_iovec_t * iov, int iov_cnt, pktbuf_free_fn_t free_fn, void * ctx);
+
 void pktbuf_inc_ref(pktbuf_t * buf);
 
 #endif
\ No newline at end of file
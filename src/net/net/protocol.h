@@ -4,6 +4,14 @@
 typedef enum _protocol_t { 
     NET_PROTOCOL_IPv4 = 0x0800,
     NET_PROTOCOL_ARP = 0x0806,
+    NET_PROTOCOL_VLAN = 0x8100,
+    NET_PROTOCOL_IPv6 = 0x86DD,
+
+    // IP包头中的协议号
+    NET_PROTOCOL_ICMPv4 = 0x1,
+    NET_PROTOCOL_IGMP = 0x2,
+    NET_PROTOCOL_TCP = 0x6,
+    NET_PROTOCOL_UDP = 0x11,
 }protocol_t;
 
 #endif
\ No newline at end of file
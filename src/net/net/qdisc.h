@@ -0,0 +1,118 @@
+#ifndef QDISC_H
+#define QDISC_H
+
+#include <stdint.h>
+#include "net_cfg.h"
+#include "net_err.h"
+#include "nlist.h"
+#include "nlocker.h"
+#include "natomic.h"
+#include "pktbuf.h"
+#include "sys.h"
+#include "tbucket.h"
+
+typedef enum _qdisc_type_t {
+    QDISC_FIFO = 0,                     // 超过上限时丢弃新到的包
+    QDISC_RED,                          // 按平均排队字节数随机提前丢弃
+    QDISC_CODEL,                        // 按包在队列中的停留时间丢弃
+    QDISC_FQ_CODEL,                     // 按流分队列轮流发送，各流独立执行CoDel，超限时丢弃最长的流
+
+    QDISC_TYPE_CNT,
+}qdisc_type_t;
+
+typedef struct _qdisc_cfg_t {
+    qdisc_type_t type;
+    int limit;                          // 最多排队的包数
+    int limit_bytes;                    // 最多排队的字节数，0-不限制
+
+    int red_min;                        // RED：平均排队字节数低于该值时不丢弃
+    int red_max;                        // 高于该值时全部丢弃
+    int red_prob;                       // 平均值接近red_max时的丢弃概率，以1/256为单位
+    int red_wlog;                       // 每个包对平均值的权重为1/2^red_wlog
+
+    int codel_target_us;                // CoDel：可接受的停留时间
+    int codel_interval_us;              // 停留时间持续超过target达到该时长后开始丢弃
+
+    int fq_flows;                       // fq_codel：流队列数，不超过NET_QDISC_FLOW_MAX
+    int fq_quantum;                     // 每个流每轮可发送的字节数
+
+    int ctrl_limit;                     // 控制包队列最多排队的包数，0-不区分
+    int ctrl_weight;                    // 连续取出该数量的控制包后取一个普通包，0-严格优先
+
+    uint64_t rate;                      // 整个队列的限速，字节/秒，0-不限速
+    int burst;                          // 可连续发送的字节数，0-按2ms的流量
+    uint64_t flow_rate;                 // fq_codel：每个流的限速
+    int flow_burst;
+}qdisc_cfg_t;
+
+typedef struct _qdisc_codel_t {
+    uint64_t first_above;               // 停留时间超过target后，允许开始丢弃的时间
+    uint64_t drop_next;                 // 丢弃状态下，下一次丢弃的时间
+    uint32_t count;                     // 本次丢弃状态中已丢弃的包数
+    uint32_t lastcount;
+    int dropping;
+}qdisc_codel_t;
+
+typedef struct _qdisc_flow_t {
+    nlist_t q;                          // 排队的包，经pktbuf_t的node链接
+    nlist_node_t node;                  // 在新流或旧流列表中
+    int active;
+    int backlog;                        // 排队的字节数
+    int deficit;
+    qdisc_codel_t codel;
+    tbucket_t tb;
+    uint64_t ready;                     // 被限速时，可以再次发送的时间
+}qdisc_flow_t;
+
+struct _netif_t;
+typedef struct _qdisc_t {
+    qdisc_cfg_t cfg;
+    struct _netif_t * netif;            // 丢弃的包计入该网卡的统计
+    int drop_full;                      // 超过上限及被AQM丢弃时计入的统计项
+    int drop_aqm;
+
+    nlocker_t locker;
+    sys_sem_t sem;                      // 有线程等待时，入队后通知
+    volatile int waiters;
+
+    volatile int cnt;                   // 含控制包
+    int bytes;                          // 不含控制包
+
+    // ARP、ICMP及TCP连接控制包单独排队，不受普通包的排队规则影响，优先取出
+    nlist_t ctrl_q;
+    int ctrl_cnt;
+    int ctrl_run;                       // 连续取出的控制包数
+
+    uint64_t red_avg;                   // 平均排队字节数，左移red_wlog位
+    int red_count;                      // 上次丢弃后进入队列的包数，-1为平均值低于red_min
+    uint32_t seed;                      // RED的随机数
+    uint32_t perturb;                   // 流哈希的扰动值，使外部难以构造冲突的流
+
+    // 限速：控制包不等待但扣除额度，普通包等到额度足够时才取出
+    tbucket_t shaper;
+    uint64_t next_ns;                   // 因限速取不到包时，可以再取的时间，0-未被限速
+
+    nlist_t new_flows;
+    nlist_t old_flows;
+    nlist_t throttled;                  // 被限速的流
+    qdisc_flow_t flow[NET_QDISC_FLOW_MAX];  // fq_codel以外只使用flow[0]
+}qdisc_t;
+
+void qdisc_cfg_init (qdisc_cfg_t * cfg, qdisc_type_t type, int limit, int limit_bytes);
+
+net_err_t qdisc_init (qdisc_t * q, struct _netif_t * netif, int is_out, const qdisc_cfg_t * cfg);
+void qdisc_destroy (qdisc_t * q);
+net_err_t qdisc_set (qdisc_t * q, const qdisc_cfg_t * cfg);
+net_err_t qdisc_set_rate (qdisc_t * q, uint64_t rate, int burst, uint64_t flow_rate, int flow_burst);
+int qdisc_next_ms (qdisc_t * q);
+void qdisc_flush (qdisc_t * q);
+
+net_err_t qdisc_enqueue (qdisc_t * q, pktbuf_t * buf);
+pktbuf_t * qdisc_dequeue (qdisc_t * q, int ms);
+
+static inline int qdisc_cnt (qdisc_t * q) {
+    // 只读取一个计数，不需要加锁
+    return natomic_load(&q->cnt);
+}
+
+#endif
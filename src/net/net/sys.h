@@ -5,18 +5,22 @@
 
 void sys_time_curr (net_time_t * time);
 int sys_time_goes (net_time_t * pre);
+uint64_t sys_time_ns (void);
 
-sys_sem_t sys_sem_create(int init_count);
-void sys_sem_free(sys_sem_t sem);
-int sys_sem_wait(sys_sem_t sem, uint32_t ms);
-void sys_sem_notify(sys_sem_t sem);
+void * sys_mem_alloc(int size, int flags);
+void sys_mem_free(void * mem);
+void * sys_shm_create(const char * name, int size);
+
+int sys_sem_init(sys_sem_t * sem, int init_count);
+void sys_sem_destroy(sys_sem_t * sem);
+int sys_sem_wait(sys_sem_t * sem, uint32_t ms);
+void sys_sem_notify(sys_sem_t * sem);
 
 // 互斥信号量：由具体平台实现
-sys_mutex_t sys_mutex_create(void);
-void sys_mutex_free(sys_mutex_t mutex);
-void sys_mutex_lock(sys_mutex_t mutex);
-void sys_mutex_unlock(sys_mutex_t mutex);
-int sys_mutex_is_valid(sys_mutex_t mutex);
+int sys_mutex_init(sys_mutex_t * mutex);
+void sys_mutex_destroy(sys_mutex_t * mutex);
+void sys_mutex_lock(sys_mutex_t * mutex);
+void sys_mutex_unlock(sys_mutex_t * mutex);
 
 // 线程相关：由具体平台实现
 typedef void (*sys_thread_func_t)(void * arg);
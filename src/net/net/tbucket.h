@@ -0,0 +1,54 @@
+#ifndef TBUCKET_H
+#define TBUCKET_H
+
+#include <stdint.h>
+
+#define TBUCKET_NS          1000000000LL
+
+/**
+ * 令牌桶，令牌以按rate发送所需的ns计，时间额度逐ns累积，不因取整丢失速率。
+ * 额度不小于0时可以发送，发送后按包长扣除，可以为负，等待回到0后再发送
+ */
+typedef struct _tbucket_t {
+    uint64_t rate;                      // 字节/秒，0-不限速
+    int64_t depth;                      // 桶深，按rate发送burst字节所需的ns
+    int64_t credit;                     // 剩余的时间额度
+    int64_t rem;                        // 扣除时不足1ns的部分，以1/rate ns计，累积到下次扣除
+    uint64_t time;                      // 上次更新额度的时间
+}tbucket_t;
+
+static inline void tbucket_init (tbucket_t * tb, uint64_t rate, int burst, uint64_t now) {
+    tb->rate = rate;
+    tb->depth = rate ? (int64_t)burst * TBUCKET_NS / (int64_t)rate : 0;
+    tb->credit = tb->depth;
+    tb->rem = 0;
+    tb->time = now;
+}
+
+/**
+ * 更新额度，返回还需等待的ns，0表示可以发送
+ */
+static inline uint64_t tbucket_wait (tbucket_t * tb, uint64_t now) {
+    if (!tb->rate) {
+        return 0;
+    }
+
+    if (now > tb->time) {
+        tb->credit += (int64_t)(now - tb->time);
+        tb->time = now;
+        if (tb->credit > tb->depth) {
+            tb->credit = tb->depth;
+        }
+    }
+    return tb->credit >= 0 ? 0 : (uint64_t)-tb->credit;
+}
+
+static inline void tbucket_take (tbucket_t * tb, int size) {
+    if (tb->rate) {
+        int64_t cost = (int64_t)size * TBUCKET_NS + tb->rem;
+        tb->credit -= cost / (int64_t)tb->rate;
+        tb->rem = cost % (int64_t)tb->rate;
+    }
+}
+
+#endif
@@ -21,12 +21,13 @@ static inline uint32_t swap_u32 (uint32_t x) {
 #define x_htonl(v) swap_u32(v)
 #define x_ntohl(v) swap_u32(v)
 #else
-#define x_htons(v)
-#define x_ntohs(v)
-#define x_htonl(v)
-#define x_ntohl(v)
+#define x_htons(v) (v)
+#define x_ntohs(v) (v)
+#define x_htonl(v) (v)
+#define x_ntohl(v) (v)
 #endif
 
 net_err_t tools_init (void);
+uint16_t checksum16 (const void * data, int size, uint32_t sum);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef VLAN_H
+#define VLAN_H
+
+#include <stdint.h>
+#include "ether.h"
+#include "netif.h"
+
+#define VLAN_VID_CNT        4096
+#define VLAN_VID_MASK       0x0FFF
+#define VLAN_PRIO_SHIFT     13
+#define VLAN_DATA_MIN       42          // 带标签时最小的数据长度，保证帧长不小于64字节
+
+#pragma pack(1)
+// 以太网包头之后的标签
+typedef struct _vlan_hdr_t {
+    uint16_t tci;
+    uint16_t protocol;
+}vlan_hdr_t;
+
+typedef struct _vlan_ether_hdr_t {
+    uint8_t dest[ETHER_HWA_SIZE];
+    uint8_t src[ETHER_HWA_SIZE];
+    uint16_t tpid;
+    uint16_t tci;
+    uint16_t protocol;
+}vlan_ether_hdr_t;
+#pragma pack()
+
+net_err_t vlan_init (void);
+
+netif_t * vlan_open (const char * name, netif_t * parent, int vid);
+net_err_t vlan_raw_out (netif_t * netif, uint16_t protocol, const uint8_t * dest, pktbuf_t * buf);
+
+#endif
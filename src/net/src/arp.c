@@ -2,22 +2,61 @@
 #include "net_cfg.h"
 #include "dbg.h"
 #include "mblock.h"
+#include "net_metrics.h"
+#include "net.h"
+#include "net_stats.h"
+#include "protocol.h"
+#include "tools.h"
 
-static arp_entry_t cache_tbl[ARP_CACHE_SIZE];
 static mblock_t cache_block;
 static nlist_t cache_list;
 
 static net_err_t cache_init (void) {
     nlist_init(&cache_list);
 
-    plat_memset(cache_tbl, 0, sizeof(cache_tbl));
-
-    net_err_t err = mblock_init(&cache_block, cache_tbl, sizeof(arp_entry_t), ARP_CACHE_SIZE, NLOCKER_NONE);
+    const net_pool_cfg_t * cfg = net_pool_cfg_get();
+    net_err_t err = mblock_create(&cache_block, sizeof(arp_entry_t), cfg->arp_cache_size, NLOCKER_NONE, cfg->mem_flags);
     if (err < 0) {
         dbg_error(DBG_ARP, "mblock_init failed");
         return err;
     }
 
+    net_metrics_add_pool("arp", &cache_block);
+
+    return NET_ERR_OK;
+}
+
+static net_err_t is_pkt_ok (arp_pkt_t * pkt, int size) {
+    if (size < sizeof(arp_pkt_t)) {
+        dbg_warning(DBG_ARP, "packet size too small! %d", size);
+        return NET_ERR_SIZE;
+    }
+
+    uint16_t opcode = x_ntohs(pkt->opcode);
+    if ((x_ntohs(pkt->htype) != ARP_HW_ETHER) || (pkt->hlen != ETHER_HWA_SIZE)
+            || (x_ntohs(pkt->ptype) != NET_PROTOCOL_IPv4) || (pkt->plen != IPV4_ADDR_SIZE)
+            || ((opcode != ARP_REQUEST) && (opcode != ARP_REPLY))) {
+        dbg_warning(DBG_ARP, "packet incorrect");
+        return NET_ERR_NONE;
+    }
+
+    return NET_ERR_OK;
+}
+
+/**
+ * 以太网层交来的ARP包，已去掉以太网包头
+ */
+static net_err_t arp_in (netif_t * netif, pktbuf_t * buf) {
+    dbg_info(DBG_ARP, "arp in");
+
+    net_err_t err = pktbuf_set_cont(buf, sizeof(arp_pkt_t));
+    if ((err < 0) || ((err = is_pkt_ok((arp_pkt_t *)pktbuf_data(buf), pktbuf_total(buf))) < 0)) {
+        net_stats_proto_add(NET_STATS_PROTO_ARP, NET_STAT_RX_DROP_BAD, 1);
+        return err;
+    }
+
+    // 请求与响应的处理尚未实现
+    pktbuf_free(buf);
     return NET_ERR_OK;
 }
 
@@ -28,5 +67,16 @@ net_err_t arp_init (void) {
         return err;
     }
 
+    err = ether_register_proto(NET_PROTOCOL_ARP, arp_in);
+    if (err < 0) {
+        dbg_error(DBG_ARP, "register arp failed");
+        mblock_destroy(&cache_block);
+        return err;
+    }
+
     return NET_ERR_OK;
+}
+
+void arp_destroy (void) {
+    mblock_destroy(&cache_block);
 }
\ No newline at end of file
@@ -2,6 +2,27 @@
 #include "sys_plat.h"
 #include <stdarg.h>
 
+#if DBG_TRACE_ENABLE
+#include "sys.h"
+#include "natomic.h"
+
+#ifndef SYS_THREAD_LOCAL
+#error "DBG_TRACE_ENABLE needs thread local storage"
+#endif
+
+typedef struct _dbg_trace_ring_t {
+    volatile int head;                  // 已写入的记录总数
+    int thread;
+    dbg_trace_rec_t rec[DBG_TRACE_SIZE];
+}dbg_trace_ring_t;
+
+static dbg_site_t * site_tbl[DBG_TRACE_SITE_MAX];
+static volatile int site_cnt;
+static dbg_trace_ring_t * ring_tbl[DBG_TRACE_THREAD_MAX];
+static volatile int ring_cnt;
+static SYS_THREAD_LOCAL dbg_trace_ring_t * curr_ring;
+#endif
+
 void dbg_print (int m_level, int s_level, const char * file, const char * func, int len, const char * fmt, ...) {
     static const char * title[] = {
         [DBG_LEVEL_NONE] = "NONE",
@@ -60,4 +81,282 @@ void dbg_dump_ip (const char * msg, ipaddr_t * ipaddr) {
     } else {
         plat_printf("0.0.0.0\n");
     }
-}
\ No newline at end of file
+}
+
+#if DBG_TRACE_ENABLE
+static int char_in (char c, const char * set) {
+    while (*set) {
+        if (*set++ == c) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 解析格式串，确定各参数的类型，不支持*指定的宽度和精度
+ */
+static void trace_parse_fmt (dbg_site_t * site) {
+    const char * c = site->fmt;
+
+    site->arg_cnt = 0;
+    while (*c && (site->arg_cnt < DBG_TRACE_ARG_MAX)) {
+        if (*c++ != '%') {
+            continue;
+        }
+
+        // 跳过标志、宽度和精度
+        while (*c && char_in(*c, "-+ #0123456789.")) {
+            c++;
+        }
+
+        int lng = 0;
+        int is_size = 0;
+        while (*c && char_in(*c, "hlzjt")) {
+            if (*c == 'l') {
+                lng++;
+            } else if (*c != 'h') {
+                is_size = 1;
+            }
+            c++;
+        }
+
+        int type;
+        switch (*c) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            type = is_size ? DBG_ARG_SIZE : (lng == 0) ? DBG_ARG_INT : (lng == 1) ? DBG_ARG_LONG : DBG_ARG_LLONG;
+            break;
+        case 'p':
+            type = DBG_ARG_PTR;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            type = DBG_ARG_DOUBLE;
+            break;
+        case 's':
+            type = DBG_ARG_STR;
+            break;
+        default:
+            // %%，或不支持的格式，其后的参数均不记录
+            if (*c != '%') {
+                return;
+            }
+            c++;
+            continue;
+        }
+
+        site->arg_type[site->arg_cnt++] = (uint8_t)type;
+        c++;
+    }
+}
+
+/**
+ * 登记输出点，多个线程同时首次执行时只有一个完成登记，其余丢弃本次输出
+ */
+static int trace_site_register (dbg_site_t * site) {
+    int id = 0;
+    if (!natomic_cas(&site->id, &id, -1)) {
+        return id;
+    }
+
+    int idx = natomic_add(&site_cnt, 1) - 1;
+    if (idx >= DBG_TRACE_SITE_MAX) {
+        // 表已满，该输出点不再记录
+        return -1;
+    }
+
+    trace_parse_fmt(site);
+    site_tbl[idx] = site;
+    natomic_store(&site->id, idx + 1);
+    return idx + 1;
+}
+
+static dbg_trace_ring_t * trace_ring_alloc (void) {
+    int idx = natomic_add(&ring_cnt, 1) - 1;
+    if (idx >= DBG_TRACE_THREAD_MAX) {
+        return (dbg_trace_ring_t *)0;
+    }
+
+    dbg_trace_ring_t * ring = (dbg_trace_ring_t *)sys_mem_alloc(sizeof(dbg_trace_ring_t), 0);
+    if (ring) {
+        plat_memset(ring, 0, sizeof(dbg_trace_ring_t));
+        ring->thread = idx;
+    }
+    ring_tbl[idx] = ring;
+    return ring;
+}
+
+/**
+ * 将一条输出写入本线程的跟踪环，不格式化，不加锁；环满时覆盖最旧的记录
+ */
+void dbg_trace (dbg_site_t * site, ...) {
+    int id = natomic_load(&site->id);
+    if ((id <= 0) && ((id = trace_site_register(site)) <= 0)) {
+        return;
+    }
+
+    dbg_trace_ring_t * ring = curr_ring;
+    if (ring == (dbg_trace_ring_t *)0) {
+        ring = curr_ring = trace_ring_alloc();
+        if (ring == (dbg_trace_ring_t *)0) {
+            return;
+        }
+    }
+
+    int seq = ring->head;
+    dbg_trace_rec_t * rec = ring->rec + (seq & (DBG_TRACE_SIZE - 1));
+
+    // 写入期间标记为无效，导出线程据此丢弃写了一半的记录
+    natomic_store(&rec->seq, -1);
+    rec->time = sys_time_ns();
+    rec->site = (uint16_t)id;
+
+    uint8_t * arg = rec->arg;
+    uint8_t * end = rec->arg + DBG_TRACE_ARG_SIZE;
+
+    va_list args;
+    va_start(args, site);
+    for (int i = 0; i < site->arg_cnt; i++) {
+        int type = site->arg_type[i];
+        if (type == DBG_ARG_STR) {
+            const char * str = va_arg(args, const char *);
+            int len = str ? (int)plat_strlen(str) : 0;
+            if (end - arg < 1) {
+                break;
+            }
+            if (len > end - arg - 1) {
+                len = (int)(end - arg - 1);
+            }
+            *arg++ = (uint8_t)len;
+            plat_memcpy(arg, str, len);
+            arg += len;
+            continue;
+        }
+
+        if (type == DBG_ARG_INT) {
+            if (end - arg < (int)sizeof(int)) {
+                break;
+            }
+            int v = va_arg(args, int);
+            plat_memcpy(arg, &v, sizeof(v));
+            arg += sizeof(v);
+            continue;
+        }
+
+        if (end - arg < 8) {
+            break;
+        }
+
+        uint64_t v;
+        switch (type) {
+        case DBG_ARG_LONG:
+            v = (uint64_t)(int64_t)va_arg(args, long);
+            break;
+        case DBG_ARG_LLONG:
+            v = (uint64_t)va_arg(args, long long);
+            break;
+        case DBG_ARG_SIZE:
+            v = (uint64_t)va_arg(args, size_t);
+            break;
+        case DBG_ARG_PTR:
+            v = (uint64_t)(uintptr_t)va_arg(args, void *);
+            break;
+        case DBG_ARG_DOUBLE:
+        default: {
+            double d = va_arg(args, double);
+            plat_memcpy(&v, &d, sizeof(v));
+            break;
+        }
+        }
+        plat_memcpy(arg, &v, sizeof(v));
+        arg += sizeof(v);
+    }
+    va_end(args);
+
+    rec->size = (uint16_t)(arg - rec->arg);
+    natomic_store(&rec->seq, seq);
+    natomic_store(&ring->head, (int)((unsigned)seq + 1));
+}
+
+static int trace_write (FILE * file, const void * data, int size) {
+    return fwrite(data, 1, size, file) == (size_t)size ? 0 : -1;
+}
+
+/**
+ * 导出所有线程的跟踪环，可在协议栈运行期间调用，但不能多个线程同时调用。正被覆盖的记录会被跳过
+ */
+int dbg_trace_dump (const char * path) {
+    FILE * file = fopen(path, "wb");
+    if (file == (FILE *)0) {
+        return -1;
+    }
+
+    int sites = natomic_load(&site_cnt);
+    int rings = natomic_load(&ring_cnt);
+    sites = sites > DBG_TRACE_SITE_MAX ? DBG_TRACE_SITE_MAX : sites;
+    rings = rings > DBG_TRACE_THREAD_MAX ? DBG_TRACE_THREAD_MAX : rings;
+
+    dbg_trace_hdr_t hdr = {DBG_TRACE_MAGIC, DBG_TRACE_VERSION, 0, 0};
+    for (int i = 0; i < sites; i++) {
+        hdr.site_cnt += site_tbl[i] && (natomic_load(&site_tbl[i]->id) > 0);
+    }
+    for (int i = 0; i < rings; i++) {
+        hdr.ring_cnt += ring_tbl[i] != (dbg_trace_ring_t *)0;
+    }
+
+    int err = trace_write(file, &hdr, sizeof(hdr));
+    for (int i = 0; (i < sites) && !err; i++) {
+        dbg_site_t * site = site_tbl[i];
+        if (!site || (natomic_load(&site->id) <= 0)) {
+            continue;
+        }
+
+        dbg_trace_site_hdr_t site_hdr;
+        plat_memset(&site_hdr, 0, sizeof(site_hdr));
+        site_hdr.id = (uint16_t)site->id;
+        site_hdr.level = (uint8_t)site->level;
+        site_hdr.arg_cnt = (uint8_t)site->arg_cnt;
+        site_hdr.line = site->line;
+        plat_memcpy(site_hdr.arg_type, site->arg_type, sizeof(site_hdr.arg_type));
+        site_hdr.file_len = (uint16_t)plat_strlen(site->file);
+        site_hdr.func_len = (uint16_t)plat_strlen(site->func);
+        site_hdr.fmt_len = (uint16_t)plat_strlen(site->fmt);
+
+        err = trace_write(file, &site_hdr, sizeof(site_hdr))
+            || trace_write(file, site->file, site_hdr.file_len)
+            || trace_write(file, site->func, site_hdr.func_len)
+            || trace_write(file, site->fmt, site_hdr.fmt_len);
+    }
+
+    static dbg_trace_rec_t rec_buf[DBG_TRACE_SIZE];
+    for (int i = 0; (i < rings) && !err; i++) {
+        dbg_trace_ring_t * ring = ring_tbl[i];
+        if (ring == (dbg_trace_ring_t *)0) {
+            continue;
+        }
+
+        unsigned head = (unsigned)natomic_load(&ring->head);
+        unsigned start = head > DBG_TRACE_SIZE ? head - DBG_TRACE_SIZE : 0;
+
+        // 拷贝前后序号一致，说明记录在此期间未被改写
+        dbg_trace_ring_hdr_t ring_hdr = {ring->thread, 0};
+        for (unsigned seq = start; seq != head; seq++) {
+            dbg_trace_rec_t * rec = ring->rec + (seq & (DBG_TRACE_SIZE - 1));
+            if (natomic_load(&rec->seq) != (int)seq) {
+                continue;
+            }
+
+            dbg_trace_rec_t * copy = rec_buf + ring_hdr.rec_cnt;
+            plat_memcpy(copy, rec, sizeof(dbg_trace_rec_t));
+            if (natomic_load(&rec->seq) == (int)seq) {
+                ring_hdr.rec_cnt++;
+            }
+        }
+
+        err = trace_write(file, &ring_hdr, sizeof(ring_hdr))
+            || trace_write(file, rec_buf, ring_hdr.rec_cnt * sizeof(dbg_trace_rec_t));
+    }
+
+    fclose(file);
+    return err ? -1 : 0;
+}
+#endif
@@ -4,6 +4,8 @@
 #include "tools.h"
 #include "protocol.h"
 #include "ipaddr.h"
+#include "net_stats.h"
+#include "loop.h"
 
 #if DBG_DISP_ENABLE(DBG_ETHER)
 static void display_ether_pkt (char * title, ether_pkt_t * pkt, int total_size) {
@@ -32,6 +34,92 @@ static void display_ether_pkt (char * title, ether_pkt_t * pkt, int total_size)
 #define display_ether_pkt(title, pkt, total_size)
 #endif
 
+typedef struct _ether_proto_t {
+    uint16_t type;                      // 协议类型，主机字节序
+    net_stats_proto_t stats;            // 对应的协议统计项
+    ether_proto_in_t in;
+}ether_proto_t;
+
+// 按类型直接映射，每个槽只放一个协议，常用的协议类型互不冲突
+#define ETHER_PROTO_HASH(type)      (((type) ^ ((type) >> 8)) & (ETHER_PROTO_TBL_SIZE - 1))
+
+static ether_proto_t proto_tbl[ETHER_PROTO_TBL_SIZE];
+
+static net_err_t proto_unknown_in (struct _netif_t * netif, pktbuf_t * buf) {
+    dbg_info(DBG_ETHER, "unknown protocol, drop it\n");
+    pktbuf_free(buf);
+    return NET_ERR_OK;
+}
+
+static const ether_proto_t proto_unknown = {
+    .type = 0,
+    .stats = NET_STATS_PROTO_OTHER,
+    .in = proto_unknown_in,
+};
+
+static inline const ether_proto_t * proto_find (uint16_t type) {
+    const ether_proto_t * proto = proto_tbl + ETHER_PROTO_HASH(type);
+    return proto->type == type ? proto : &proto_unknown;
+}
+
+static net_stats_proto_t proto_stats (uint16_t type) {
+    switch (type) {
+        case NET_PROTOCOL_ARP:
+            return NET_STATS_PROTO_ARP;
+        case NET_PROTOCOL_IPv4:
+            return NET_STATS_PROTO_IPV4;
+        case NET_PROTOCOL_VLAN:
+            return NET_STATS_PROTO_VLAN;
+        default:
+            return NET_STATS_PROTO_OTHER;
+    }
+}
+
+/**
+ * 注册上层协议的输入处理函数，须在ether_init之后调用
+ */
+net_err_t ether_register_proto (uint16_t type, ether_proto_in_t in) {
+    if ((type < ETHER_TYPE_MIN) || !in) {
+        dbg_error(DBG_ETHER, "invalid protocol %04x", type);
+        return NET_ERR_PARAM;
+    }
+
+    ether_proto_t * proto = proto_tbl + ETHER_PROTO_HASH(type);
+    if (proto->in != proto_unknown_in) {
+        if (proto->type == type) {
+            dbg_error(DBG_ETHER, "protocol %04x already registered", type);
+            return NET_ERR_EXIST;
+        }
+
+        dbg_error(DBG_ETHER, "protocol %04x conflicts with %04x, enlarge ETHER_PROTO_TBL_SIZE", type, proto->type);
+        return NET_ERR_EXIST;
+    }
+
+    proto->type = type;
+    proto->stats = proto_stats(type);
+    proto->in = in;
+    return NET_ERR_OK;
+}
+
+// stat为包数，其后紧跟对应的字节数；各层按本层的包大小统计
+static void ether_stats_add (net_stats_proto_t proto, net_stat_t stat, int size) {
+    net_stats_proto_add(proto, stat, 1);
+    net_stats_proto_add(proto, stat + 1, size);
+}
+
+void ether_proto_stats_add (uint16_t type, net_stat_t stat, int size) {
+    ether_stats_add(proto_find(type)->stats, stat, size);
+}
+
+/**
+ * 交给上层协议处理，buf已去掉链路层包头，如VLAN等封装层解开后也由此分发
+ */
+net_err_t ether_proto_in (netif_t * netif, uint16_t type, pktbuf_t * buf) {
+    const ether_proto_t * proto = proto_find(type);
+    ether_stats_add(proto->stats, NET_STAT_RX_PKTS, pktbuf_total(buf));
+    return proto->in(netif, buf);
+}
+
 static net_err_t ether_open (struct _netif_t * netif) {
     return NET_ERR_OK;
 }
@@ -39,8 +127,12 @@ static void ether_close (struct _netif_t * netif) {
 
 }
 
-static net_err_t is_pkt_ok (ether_pkt_t * pkt, int size) {
-    if (size > (ETHER_MTU + sizeof(ether_pkt_t) - 1)) {
+// 可带一个VLAN标签；GRO合并的包可超过MTU，按合并的上限计算
+#define ETHER_RX_MAX        (ETHER_MTU + sizeof(ether_hdr_t) + 4)
+#define ETHER_GRO_RX_MAX    (NET_GRO_SIZE_MAX + sizeof(ether_hdr_t) + 4)
+
+static net_err_t is_pkt_ok (ether_pkt_t * pkt, int size, int max) {
+    if (size > max) {
         dbg_error(DBG_ETHER, "packet size too big! %d\n", size);
         return NET_ERR_SIZE;
     }
@@ -60,14 +152,24 @@ static net_err_t ether_in (struct _netif_t * netif, pktbuf_t * buf) {
     ether_pkt_t * pkt = (ether_pkt_t *)pktbuf_data(buf);
     
     net_err_t err;
-    if ((err = is_pkt_ok(pkt, buf->total_size)) < 0) {
+    int max = (buf->meta.flags & PKTBUF_GRO) ? ETHER_GRO_RX_MAX : ETHER_RX_MAX;
+    if ((err = is_pkt_ok(pkt, buf->total_size, max)) < 0) {
+        net_stats_proto_add(NET_STATS_PROTO_ETHER, NET_STAT_RX_DROP_BAD, 1);
         dbg_warning(DBG_ETHER, "pkt error\n");
         return err;
     }
 
+    uint16_t type = x_ntohs(pkt->hdr.protocol);
+    ether_stats_add(NET_STATS_PROTO_ETHER, NET_STAT_RX_PKTS, buf->total_size);
+
     display_ether_pkt("ethernet in", pkt, buf->total_size);
-    pktbuf_free(buf);
-    return NET_ERR_OK;
+
+    err = pktbuf_remove_header(buf, sizeof(ether_hdr_t));
+    if (err < 0) {
+        dbg_error(DBG_ETHER, "remove header failed!");
+        return err;
+    }
+    return ether_proto_in(netif, type, buf);
 }
 
 static net_err_t ether_out (struct _netif_t * netif, ipaddr_t * dest, pktbuf_t * buf) {
@@ -89,6 +191,10 @@ net_err_t ether_init (void) {
     
     dbg_info(DBG_ETHER, "init ethernet");
 
+    for (int i = 0; i < ETHER_PROTO_TBL_SIZE; i++) {
+        proto_tbl[i] = proto_unknown;
+    }
+
     net_err_t err = netif_register_layer(NETIF_TYPE_ETHER, &ether_layer);
     if (err < 0) {
         dbg_error(DBG_ETHER, "register ethernet layer failed!");
@@ -106,6 +212,11 @@ const uint8_t * ether_broadcast_addr (void) {
 }
 
 net_err_t ether_raw_out (netif_t * netif, uint16_t protocol, uint8_t * dest, pktbuf_t * buf) {
+    // 发给自己的包不组帧，直接交给上层协议
+    if (plat_memcmp(dest, netif->hwaddr.addr, ETHER_HWA_SIZE) == 0) {
+        return loop_deliver(netif, netif, protocol, buf);
+    }
+
     int size = pktbuf_total(buf);
     if (size < ETHER_DATA_MIN) {
         dbg_info(DBG_ETHER, "packet size is too small!");
@@ -122,6 +233,7 @@ net_err_t ether_raw_out (netif_t * netif, uint16_t protocol, uint8_t * dest, pkt
 
         size = ETHER_DATA_MIN;
     }
+    ether_proto_stats_add(protocol, NET_STAT_TX_PKTS, size);
 
     net_err_t err = pktbuf_add_header(buf, sizeof(ether_hdr_t), 1);
     if (err < 0) {
@@ -135,18 +247,15 @@ net_err_t ether_raw_out (netif_t * netif, uint16_t protocol, uint8_t * dest, pkt
     pkt->hdr.protocol = x_htons(protocol);
 
     display_ether_pkt("ether out", pkt, size);
+    ether_stats_add(NET_STATS_PROTO_ETHER, NET_STAT_TX_PKTS, pktbuf_total(buf));
 
-    if (plat_memcmp(dest, netif->hwaddr.addr, ETHER_HWA_SIZE) == 0) {
-        return netif_put_in(netif, buf, -1);
-    } else {
-        err = netif_put_out(netif, buf, -1);
-        if (err < 0) {
-            dbg_error(DBG_ETHER, "put out failed!");
-            return err;
-        }
-
-        return netif->ops->xmit(netif);
+    err = netif_put_out(netif, buf);
+    if (err < 0) {
+        dbg_error(DBG_ETHER, "put out failed!");
+        return err;
     }
+
+    return netif_xmit(netif);
 }
 
 
@@ -5,46 +5,86 @@
 #include "mblock.h"
 #include "timer.h"
 #include "sys.h"
+#include "net.h"
+#include "net_stats.h"
+#include "net_metrics.h"
+#include "net_lat.h"
+#include "net_poll.h"
+#include "natomic.h"
+#include "net_gso.h"
 
 
-static void * msg_tbl[EXMSG_MSG_CNT];
 static fixq_t msg_queue;
-
-static exmsg_t msg_buffer[EXMSG_MSG_CNT];
 static mblock_t msg_block;
 
+#if NET_BUSY_POLL
+static volatile int worker_sleep;       // 工作线程已阻塞在消息队列上，需要发消息唤醒
+#endif
+
 net_err_t exmsg_init (void) {
     dbg_info(DBG_MSG, "exmsg init");
 
-    net_err_t err = fixq_init(&msg_queue, msg_tbl, EXMSG_MSG_CNT, EXMSG_LOCKER);
+    const net_pool_cfg_t * cfg = net_pool_cfg_get();
+    void ** msg_tbl = (void **)sys_mem_alloc(cfg->exmsg_msg_cnt * sizeof(void *), cfg->mem_flags);
+    if (!msg_tbl) {
+        dbg_error(DBG_MSG, "alloc msg table failed");
+        return NET_ERR_MEM;
+    }
+
+    net_err_t err = fixq_init(&msg_queue, msg_tbl, cfg->exmsg_msg_cnt, EXMSG_LOCKER);
     if (err < 0) {
         dbg_error(DBG_MSG, "fixq init failed");
+        sys_mem_free(msg_tbl);
         return err;
     }
 
-    err = mblock_init(&msg_block, msg_buffer, sizeof(exmsg_t), EXMSG_MSG_CNT, EXMSG_LOCKER);
+    err = mblock_create(&msg_block, sizeof(exmsg_t), cfg->exmsg_msg_cnt, EXMSG_LOCKER, cfg->mem_flags);
     if (err < 0) {
         dbg_error(DBG_MSG, "mblock init failed");
+        fixq_destroy(&msg_queue);
+        sys_mem_free(msg_tbl);
         return err;
     }
 
+    net_metrics_add_pool("exmsg", &msg_block);
+    net_metrics_add_queue("exmsg", &msg_queue);
+
     dbg_info(DBG_MSG, "exmsg init ok");
 
     return NET_ERR_OK;
 }
 
+void exmsg_destroy (void) {
+    mblock_destroy(&msg_block);
+    fixq_destroy(&msg_queue);
+    sys_mem_free(msg_queue.buf);
+}
+
 net_err_t exmsg_netif_in(netif_t * netif) {
+#if NET_BUSY_POLL
+    // 工作线程自旋时直接检查各网卡的输入队列，只在其阻塞时才发消息
+    // 使用读-改-写操作，保证包入队后再读取该标志，与工作线程的检查不会错过
+    if (natomic_add(&worker_sleep, 0) == 0) {
+        return NET_ERR_OK;
+    }
+#endif
+
     exmsg_t * msg = mblock_alloc(&msg_block, -1);
     if (!msg) {
+        net_stats_pool_inc(NET_STAT_EXMSG_EMPTY);
         dbg_warning(DBG_MSG, "no free msg");
         return NET_ERR_MEM;
     }
 
     msg->type = NET_EXMSG_NETIF_IN;
     msg->netif.netif = netif;
+#if NET_LAT_ENABLE
+    msg->lat_time = net_lat_sample() ? sys_time_ns() : 0;
+#endif
 
     net_err_t err = fixq_send(&msg_queue, msg, -1);
     if (err < 0) {
+        net_stats_pool_inc(NET_STAT_EXMSG_QFULL);
         dbg_warning(DBG_MSG, "fixq full");
         mblock_free(&msg_block, msg);
         return err;
@@ -53,39 +93,146 @@ net_err_t exmsg_netif_in(netif_t * netif) {
     return err;
 }
 
-static net_err_t do_netif_in (exmsg_t * msg) {
-    netif_t * netif = msg->netif.netif;
+static int netif_in_drain (netif_t * netif) {
+    int cnt = 0;
+
+#if NET_GRO_ENABLE
+    // 本次取出的包中同一TCP流的连续包合并后再交出
+    net_gro_t gro;
+    net_gro_init(&gro, netif);
+#endif
 
     pktbuf_t * buf;
     while ((buf = netif_get_in(netif, -1))) {
+        cnt++;
         dbg_info(DBG_MSG, "netif in recv a packet");
+#if NET_GRO_ENABLE
+        net_gro_receive(&gro, buf);
+#else
+        netif_link_in(netif, buf);
+#endif
+    }
 
-        if (netif->link_layer) {
-            net_err_t err = netif->link_layer->in(netif, buf);
-            if (err < 0) {
-                dbg_warning(DBG_MSG, "link layer in failed");
-                pktbuf_free(buf);
-                continue;
-            }
-        } else {
-            pktbuf_free(buf);
+#if NET_GRO_ENABLE
+    net_gro_flush(&gro);
+#endif
+    return cnt;
+}
+
+static net_err_t do_netif_in (exmsg_t * msg) {
+    netif_in_drain(msg->netif.netif);
+    return NET_ERR_OK;
+}
+
+/**
+ * 轮询所有提供poll接口的网卡，返回收取的包数；没有这类网卡时返回-1
+ */
+static int netif_poll_all (void) {
+    int cnt = -1;
+    for (int i = 0; i < NETIF_DEV_CNT; i++) {
+        netif_t * netif = netif_get(i);
+        if (netif && netif->ops->poll) {
+            cnt = (cnt < 0 ? 0 : cnt) + netif->ops->poll(netif, NETIF_POLL_BUDGET);
         }
     }
+    return cnt;
+}
 
-    return NET_ERR_OK;
+/**
+ * 空闲时阻塞等待的时间：存在轮询模式的网卡时，最多只等待NETIF_POLL_IDLE_MS
+ */
+static int idle_tmo (int polled) {
+    int tmo = net_timer_first_tmo();
+    if ((polled >= 0) && ((tmo <= 0) || (tmo > NETIF_POLL_IDLE_MS))) {
+        tmo = NETIF_POLL_IDLE_MS;
+    }
+    return tmo;
 }
 
+#if NET_BUSY_POLL
+/**
+ * 处理所有网卡输入队列中的包，返回处理的数量
+ */
+static int netif_poll_in (void) {
+    int cnt = 0;
+    for (int i = 0; i < NETIF_DEV_CNT; i++) {
+        netif_t * netif = netif_get(i);
+        if (netif && qdisc_cnt(&netif->in_q)) {
+            cnt += netif_in_drain(netif);
+        }
+    }
+    return cnt;
+}
+
+static int netif_in_pending (void) {
+    for (int i = 0; i < NETIF_DEV_CNT; i++) {
+        netif_t * netif = netif_get(i);
+        if (netif && qdisc_cnt(&netif->in_q)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 忙轮询：自旋检查消息队列和各网卡的输入队列，预算用完后才阻塞等待消息或定时器
+ */
+static exmsg_t * busy_recv (net_poll_t * poll) {
+    int polled;
+    while (1) {
+        if (fixq_cnt(&msg_queue)) {
+            net_poll_busy(poll);
+            return (exmsg_t *)fixq_recv(&msg_queue, -1);
+        }
+
+        polled = netif_poll_all();
+        if (netif_poll_in() || (polled > 0)) {
+            net_poll_busy(poll);
+            return (exmsg_t *)0;
+        }
+
+        if (!net_poll_idle(poll)) {
+            break;
+        }
+    }
+
+    // 先置标志再检查一次，此后入队的包一定会发消息唤醒
+    exmsg_t * msg = (exmsg_t *)0;
+    natomic_store(&worker_sleep, 1);
+    if (!netif_in_pending()) {
+        msg = (exmsg_t *)fixq_recv(&msg_queue, idle_tmo(polled));
+    }
+    natomic_store(&worker_sleep, 0);
+    return msg;
+}
+#endif
+
 static void work_thread (void * arg) {
     dbg_info(DBG_MSG, "exmsg is running....\n");
 
     net_time_t time;
     sys_time_curr(&time);
 
+#if NET_BUSY_POLL
+    net_poll_t poll;
+    net_poll_init(&poll, NET_BUSY_POLL_US, NET_BUSY_POLL_MIN_US);
+#endif
+
     while (1) {
-        int first_tmo = net_timer_first_tmo();
-        exmsg_t * msg = (exmsg_t *)fixq_recv(&msg_queue, first_tmo);
+#if NET_BUSY_POLL
+        exmsg_t * msg = busy_recv(&poll);
+#else
+        // 轮询的网卡有包时不阻塞，处理完消息后继续轮询
+        int polled = netif_poll_all();
+        exmsg_t * msg = (exmsg_t *)fixq_recv(&msg_queue, polled > 0 ? -1 : idle_tmo(polled));
+#endif
         if (msg) {
             dbg_info(DBG_MSG, "exmsg recv msg type: %d", msg->type);
+#if NET_LAT_ENABLE
+            if (msg->lat_time) {
+                net_lat_record(NET_LAT_MSGQ, sys_time_ns() - msg->lat_time);
+            }
+#endif
             switch (msg->type) {
             case NET_EXMSG_NETIF_IN:
                 do_netif_in(msg);
@@ -103,7 +250,21 @@ static void work_thread (void * arg) {
 }
 
 net_err_t exmsg_start (void) {
-    sys_thread_t thread = sys_thread_create(work_thread, (void *)0);
+    sys_thread_attr_t attr = {
+        .name = "net_worker",
+        .cpu_mask = EXMSG_CPU_MASK,
+        .priority = EXMSG_PRIORITY,
+        .stack_size = NET_THREAD_STACK,
+    };
+
+#if EXMSG_NUMA_NODE >= 0
+    // 绑定到节点后，工作线程从该节点的内存池中分配包缓存
+    if (!attr.cpu_mask) {
+        attr.cpu_mask = sys_numa_cpu_mask(EXMSG_NUMA_NODE);
+    }
+#endif
+
+    sys_thread_t thread = sys_thread_create_attr(work_thread, (void *)0, &attr);
     if (thread == SYS_THREAD_INVALID) {
         return NET_ERR_SYS;
     }
@@ -1,12 +1,11 @@
 #include "fixq.h"
 #include "dbg.h"
+#include "natomic.h"
 
 net_err_t fixq_init (fixq_t * q, void ** buf, int size, nlocker_type_t type) {
     q->size = size;
     q->in = q->out = q->cnt = 0;
     q->buf = buf;
-    q->send_sem = SYS_SEM_INVALID;
-    q->recv_sem = SYS_SEM_INVALID;
 
     net_err_t err = nlocker_init (&q->locker, type);
     if (err < 0) {
@@ -14,31 +13,23 @@ net_err_t fixq_init (fixq_t * q, void ** buf, int size, nlocker_type_t type) {
         return err;
     }
 
-    q->send_sem = sys_sem_create(size);
-    if (q->send_sem == SYS_SEM_INVALID) {
-        dbg_error(DBG_QUEUE, "sys_sem_create failed");
+    if (sys_sem_init(&q->send_sem, size) < 0) {
+        dbg_error(DBG_QUEUE, "sys_sem_init failed");
         err = NET_ERR_SYS;
-        goto init_failed;
+        goto send_failed;
     }
 
-    q->recv_sem = sys_sem_create(0);
-    if (q->recv_sem == SYS_SEM_INVALID) {
-        dbg_error(DBG_QUEUE, "sys_sem_create failed");
+    if (sys_sem_init(&q->recv_sem, 0) < 0) {
+        dbg_error(DBG_QUEUE, "sys_sem_init failed");
         err = NET_ERR_SYS;
-        goto init_failed;
+        goto recv_failed;
     }
 
     return NET_ERR_OK;
 
-init_failed:
-    if (q->send_sem != SYS_SEM_INVALID) {
-        sys_sem_free(q->send_sem);
-    }
-
-    if (q->recv_sem != SYS_SEM_INVALID) {
-        sys_sem_free(q->recv_sem);
-    }
-
+recv_failed:
+    sys_sem_destroy(&q->send_sem);
+send_failed:
     nlocker_destroy (&q->locker);
     return err;
 
@@ -53,7 +44,7 @@ net_err_t fixq_send (fixq_t * q, void * msg, int ms) {
     }
     nlocker_unlock (&q->locker);
 
-    if (sys_sem_wait(q->send_sem, ms) < 0) {
+    if (sys_sem_wait(&q->send_sem, ms) < 0) {
         return NET_ERR_TMO;
     }
 
@@ -65,7 +56,7 @@ net_err_t fixq_send (fixq_t * q, void * msg, int ms) {
     q->cnt++;
     nlocker_unlock (&q->locker);
 
-    sys_sem_notify(q->recv_sem);
+    sys_sem_notify(&q->recv_sem);
     return NET_ERR_OK;
 
 }
@@ -78,7 +69,7 @@ void * fixq_recv (fixq_t * q, int ms) {
     }
     nlocker_unlock (&q->locker);
 
-    if (sys_sem_wait(q->recv_sem, ms) < 0) {
+    if (sys_sem_wait(&q->recv_sem, ms) < 0) {
         return (void *)0;
     }
 
@@ -90,22 +81,19 @@ void * fixq_recv (fixq_t * q, int ms) {
     q->cnt--;
     nlocker_unlock (&q->locker);
 
-    sys_sem_notify(q->send_sem);
+    sys_sem_notify(&q->send_sem);
     return msg;
 
 }
 
 void fixq_destroy (fixq_t * q) {
     nlocker_destroy (&q->locker);
-    sys_sem_free(q->recv_sem);
-    sys_sem_free(q->send_sem);
+    sys_sem_destroy(&q->recv_sem);
+    sys_sem_destroy(&q->send_sem);
     return;
 }
  
 int fixq_cnt (fixq_t * q) {
-    nlocker_lock (&q->locker);
-    int count = q->cnt;
-    nlocker_unlock (&q->locker);
-
-    return count;
+    // 只读取一个计数，不需要加锁
+    return natomic_load(&q->cnt);
 }
@@ -1,26 +1,32 @@
 #include "loop.h"
 #include "dbg.h"
 #include "exmsg.h"
+#include "ether.h"
+#include "protocol.h"
+#include "net_stats.h"
 
-static net_err_t loop_open (netif_t * netif, void * data) { 
+static netif_t * loop_netif;
+static int loop_depth;                  // 直接投递的嵌套层数，只在工作线程中使用
+
+static net_err_t loop_open (netif_t * netif, void * data) {
     netif->type = NETIF_TYPE_LOOP;
     return NET_ERR_OK;
 }
 
-static void loop_close (netif_t * netif) { 
+static void loop_close (netif_t * netif) {
     dbg_info(DBG_NETIF, "loop close");
 }
 
-static net_err_t loop_xmit (netif_t * netif) { 
+static net_err_t loop_xmit (netif_t * netif) {
     dbg_info(DBG_NETIF, "loop xmit");
-    pktbuf_t * pktbuf = netif_get_out (netif, -1);
-    if (pktbuf) {
-        net_err_t err = netif_put_in (netif, pktbuf, -1);
+    // 取出所有可发送的包，限速时剩余的包由定时器再次发送
+    pktbuf_t * pktbuf;
+    while ((pktbuf = netif_get_out (netif, -1))) {
+        net_err_t err = netif_put_in (netif, pktbuf);
         if (err < 0) {
             pktbuf_free (pktbuf);
             return err;
         }
-
     }
     return NET_ERR_OK;
 }
@@ -31,9 +37,109 @@ static const netif_ops_t loop_ops = {
     .xmit = loop_xmit,
 };
 
+/**
+ * 在接收网卡上计入统计并交给协议输入处理，失败时计入丢弃并释放包
+ */
+static void loop_proto_in (netif_t * to, uint16_t protocol, pktbuf_t * buf) {
+    net_stats_netif_add(to, NET_STAT_RX_PKTS, 1);
+    net_stats_netif_add(to, NET_STAT_RX_BYTES, pktbuf_total(buf));
+
+    // 不离开本机的包不需要校验和
+    buf->meta.netif = to;
+    if (buf->meta.flags & PKTBUF_CSUM_NEED) {
+        buf->meta.flags = (buf->meta.flags & ~PKTBUF_CSUM_NEED) | PKTBUF_CSUM_OK;
+    }
+
+    pktbuf_reset_acc(buf);
+    net_err_t err = ether_proto_in(to, protocol, buf);
+    if (err < 0) {
+        net_stats_netif_add(to, NET_STAT_RX_DROP_LINK, 1);
+        pktbuf_free(buf);
+    }
+}
+
+/**
+ * 发往本机的包直接交给接收网卡上的协议输入处理，不组帧、不排队，须在工作线程中调用。
+ * 协议在输入处理中再次发往本机时会嵌套调用，超过NET_LOOP_DEPTH_MAX层后，
+ * 加上回环包头后经回环网卡的输入队列转交，避免堆栈过深
+ */
+net_err_t loop_deliver (netif_t * from, netif_t * to, uint16_t protocol, pktbuf_t * buf) {
+    int size = pktbuf_total(buf);
+    net_stats_netif_add(from, NET_STAT_TX_PKTS, 1);
+    net_stats_netif_add(from, NET_STAT_TX_BYTES, size);
+    ether_proto_stats_add(protocol, NET_STAT_TX_PKTS, size);
+
+    if (loop_depth >= NET_LOOP_DEPTH_MAX) {
+        net_err_t err = pktbuf_add_header(buf, sizeof(loop_hdr_t), 1);
+        if (err < 0) {
+            dbg_error(DBG_NETIF, "loop add header failed");
+            return err;
+        }
+
+        loop_hdr_t * hdr = (loop_hdr_t *)pktbuf_data(buf);
+        hdr->netif = to;
+        hdr->protocol = protocol;
+
+        // 只借用回环网卡的队列，接收统计在取出后计入目的网卡
+        err = qdisc_enqueue(&loop_netif->in_q, buf);
+        if (err < 0) {
+            return err;
+        }
+        exmsg_netif_in(loop_netif);
+        return NET_ERR_OK;
+    }
+
+    loop_depth++;
+    loop_proto_in(to, protocol, buf);
+    loop_depth--;
+    return NET_ERR_OK;
+}
+
+static net_err_t loop_link_open (netif_t * netif) {
+    return NET_ERR_OK;
+}
+
+static void loop_link_close (netif_t * netif) {
+}
+
+/**
+ * 输入队列中的包以回环包头开始，交给包头中记录的接收网卡
+ */
+static net_err_t loop_link_in (netif_t * netif, pktbuf_t * buf) {
+    net_err_t err = pktbuf_set_cont(buf, sizeof(loop_hdr_t));
+    if (err < 0) {
+        return err;
+    }
+
+    loop_hdr_t * hdr = (loop_hdr_t *)pktbuf_data(buf);
+    netif_t * to = hdr->netif;
+    uint16_t protocol = hdr->protocol;
+    pktbuf_remove_header(buf, sizeof(loop_hdr_t));
+    loop_proto_in(to, protocol, buf);
+    return NET_ERR_OK;
+}
+
+static net_err_t loop_link_out (netif_t * netif, ipaddr_t * dest, pktbuf_t * buf) {
+    return loop_deliver(netif, netif, NET_PROTOCOL_IPv4, buf);
+}
+
 net_err_t loop_init (void) {
+    static const link_layer_t loop_layer = {
+        .type = NETIF_TYPE_LOOP,
+        .open = loop_link_open,
+        .close = loop_link_close,
+        .in = loop_link_in,
+        .out = loop_link_out,
+    };
+
     dbg_info(DBG_NETIF, "loop init");
 
+    net_err_t err = netif_register_layer(NETIF_TYPE_LOOP, &loop_layer);
+    if (err < 0) {
+        dbg_error(DBG_NETIF, "register loop layer failed!");
+        return err;
+    }
+
     netif_t * netif = netif_open("loop", &loop_ops, (void *)0);
     if (!netif) {
         dbg_error(DBG_NETIF, "loop init failed!");
@@ -47,7 +153,27 @@ net_err_t loop_init (void) {
     netif_set_addr(netif, &ip, &mask, (ipaddr_t *)0);
 
     netif_set_active(netif);
+    loop_netif = netif;
 
     dbg_info(DBG_NETIF, "loop init done!");
     return NET_ERR_OK;
-}
\ No newline at end of file
+}
+
+void loop_destroy (void) {
+    if (loop_netif) {
+        netif_set_deactive(loop_netif);
+        netif_close(loop_netif);
+        loop_netif = (netif_t *)0;
+    }
+}
+
+/**
+ * 目的地址为本机时返回接收的网卡：127/8为回环网卡，否则为拥有该地址的网卡
+ */
+netif_t * loop_find (const ipaddr_t * ip) {
+    if (ip->a_addr[0] == 127) {
+        return loop_netif;
+    }
+
+    return netif_find_addr(ip);
+}
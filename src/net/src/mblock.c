@@ -1,21 +1,84 @@
 #include "mblock.h"
 #include "dbg.h"
 #include "net_cfg.h"
-net_err_t mblock_init (mblock_t * mblock, void * mem, int blk_size, int cnt, nlocker_type_t type) {
+#include "natomic.h"
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define MBLOCK_PTR_BITS     48
+#else
+#define MBLOCK_PTR_BITS     32
+#endif
+#define MBLOCK_PTR_MASK     ((((uint64_t)1) << MBLOCK_PTR_BITS) - 1)
+
+static inline nlist_node_t * head_node (uint64_t head) {
+    return (nlist_node_t *)(uintptr_t)(head & MBLOCK_PTR_MASK);
+}
+
+static inline uint64_t head_make (nlist_node_t * node, uint64_t pre_head) {
+    uint64_t tag = (pre_head >> MBLOCK_PTR_BITS) + 1;
+    return (tag << MBLOCK_PTR_BITS) | ((uint64_t)(uintptr_t)node & MBLOCK_PTR_MASK);
+}
+
+static void mblock_push (mblock_t * mblock, nlist_node_t * node) {
+    uint64_t head = natomic_load64(&mblock->free_head);
+    do {
+        node->next = head_node(head);
+    } while (!natomic_cas64(&mblock->free_head, &head, head_make(node, head)));
+}
+
+static nlist_node_t * mblock_pop (mblock_t * mblock) {
+    uint64_t head = natomic_load64(&mblock->free_head);
+    nlist_node_t * node;
+    do {
+        node = head_node(head);
+        if (!node) {
+            return (nlist_node_t *)0;
+        }
+    } while (!natomic_cas64(&mblock->free_head, &head, head_make(node->next, head)));
+
+    return node;
+}
+
+static int mblock_reserve (mblock_t * mblock) {
+    int count = natomic_load(&mblock->free_cnt);
+    while (count > 0) {
+        if (natomic_cas(&mblock->free_cnt, &count, count - 1)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void mblock_add_blocks (mblock_t * mblock, void * mem, int cnt) {
     uint8_t * buf = (uint8_t *)mem;
 
-    nlist_init(&mblock->free_list);
-    for (int i = 0; i < cnt; i++, buf += blk_size) {
+    for (int i = 0; i < cnt; i++, buf += mblock->blk_size) {
         nlist_node_t * block = (nlist_node_t *)buf;
         nlist_node_init(block);
-        nlist_insert_last(&mblock->free_list, block);
+        mblock_push(mblock, block);
 
     }
+    mblock->cnt += cnt;
+    natomic_add(&mblock->free_cnt, cnt);
+}
+
+net_err_t mblock_init (mblock_t * mblock, void * mem, int blk_size, int cnt, nlocker_type_t type) {
+    mblock->free_head = 0;
+    mblock->free_cnt = 0;
+    mblock->wait_cnt = 0;
+    mblock->blk_size = blk_size;
+    mblock->cnt = 0;
+    mblock->slab_cnt = 0;
+    mblock->max_cnt = cnt;
+    mblock->mem_flags = 0;
+    mblock->mem = (void *)0;
+    mblock->slab_list = (void *)0;
+    mblock_add_blocks(mblock, mem, cnt);
 
     nlocker_init(&mblock->locker, type);
     if (type != NLOCKER_NONE) {
-        mblock->alloc_sem = sys_sem_create(cnt);
-        if (mblock->alloc_sem == SYS_SEM_INVALID) {
+        if (sys_sem_init(&mblock->alloc_sem, 0) < 0) {
             dbg_error(DBG_MODULE_MBLOCK, "create sem failed.");
             nlocker_destroy(&mblock->locker);
             return NET_ERR_SYS;
@@ -25,54 +88,147 @@ net_err_t mblock_init (mblock_t * mblock, void * mem, int blk_size, int cnt, nlo
     return NET_ERR_OK;
 }
 
+net_err_t mblock_create (mblock_t * mblock, int blk_size, int cnt, nlocker_type_t type, int mem_flags) {
+    blk_size = (blk_size + SYS_CACHE_LINE_SIZE - 1) & ~(SYS_CACHE_LINE_SIZE - 1);
+
+    void * mem = sys_mem_alloc(blk_size * cnt, mem_flags);
+    if (!mem) {
+        dbg_error(DBG_MODULE_MBLOCK, "alloc mem failed, size: %d", blk_size * cnt);
+        return NET_ERR_MEM;
+    }
+    plat_memset(mem, 0, blk_size * cnt);
+
+    net_err_t err = mblock_init(mblock, mem, blk_size, cnt, type);
+    if (err < 0) {
+        sys_mem_free(mem);
+        return err;
+    }
+
+    mblock->mem = mem;
+    mblock->mem_flags = mem_flags;
+    return NET_ERR_OK;
+}
+
+void mblock_set_grow (mblock_t * mblock, int slab_cnt, int max_cnt) {
+    mblock->slab_cnt = slab_cnt;
+    mblock->max_cnt = max_cnt > mblock->cnt ? max_cnt : mblock->cnt;
+}
+
+static void mblock_wakeup (mblock_t * mblock, int cnt) {
+    if (mblock->locker.type == NLOCKER_NONE) {
+        return;
+    }
+
+    int wait_cnt = natomic_load(&mblock->wait_cnt);
+    for (int i = 0; (i < cnt) && (i < wait_cnt); i++) {
+        sys_sem_notify(&mblock->alloc_sem);
+    }
+}
+
+static int mblock_grow (mblock_t * mblock) {
+    nlocker_lock(&mblock->locker);
+    if (natomic_load(&mblock->free_cnt) > 0) {
+        nlocker_unlock(&mblock->locker);
+        return 1;
+    }
+
+    int cnt = mblock->max_cnt - mblock->cnt;
+    if (cnt > mblock->slab_cnt) {
+        cnt = mblock->slab_cnt;
+    }
+
+    if (cnt <= 0) {
+        nlocker_unlock(&mblock->locker);
+        return 0;
+    }
+
+    // 每次扩充的内存前留出一个cache行，串成链表以便销毁时释放
+    int size = mblock->blk_size * cnt + SYS_CACHE_LINE_SIZE;
+    void * mem = sys_mem_alloc(size, mblock->mem_flags);
+    if (!mem) {
+        nlocker_unlock(&mblock->locker);
+        dbg_warning(DBG_MODULE_MBLOCK, "grow failed, size: %d", size);
+        return 0;
+    }
+    plat_memset(mem, 0, size);
+    *(void **)mem = mblock->slab_list;
+    mblock->slab_list = mem;
+
+    mblock_add_blocks(mblock, (uint8_t *)mem + SYS_CACHE_LINE_SIZE, cnt);
+    nlocker_unlock(&mblock->locker);
+
+    mblock_wakeup(mblock, cnt);
+    return 1;
+}
+
 void * mblock_alloc (mblock_t * mblock, int ms) {
-    if ((ms < 0) || (mblock->locker.type == NLOCKER_NONE)) {
-        nlocker_lock(&mblock->locker);
-        int count = nlist_count(&mblock->free_list);
+    // 截止时间只计算一次，每次被唤醒后只等待剩余的时间
+    uint64_t end = (ms > 0) ? sys_time_ns() + (uint64_t)ms * 1000000u : 0;
+
+    while (!mblock_reserve(mblock)) {
+        if (mblock->slab_cnt && mblock_grow(mblock)) {
+            continue;
+        }
 
-        if (count == 0) {
-            nlocker_unlock(&mblock->locker);
+        if ((ms < 0) || (mblock->locker.type == NLOCKER_NONE)) {
             return (void *)0;
-        } else {
-            nlist_node_t * block = nlist_remove_first(&mblock->free_list);
-            nlocker_unlock(&mblock->locker);
-            return block;
         }
-    } else {
-        if(sys_sem_wait(mblock->alloc_sem, ms) < 0) {
+
+        natomic_add(&mblock->wait_cnt, 1);
+        if (mblock_reserve(mblock)) {
+            natomic_add(&mblock->wait_cnt, -1);
+            break;
+        }
+
+        int wait_ms = 0;
+        if (ms > 0) {
+            uint64_t now = sys_time_ns();
+            if (now >= end) {
+                natomic_add(&mblock->wait_cnt, -1);
+                return (void *)0;
+            }
+            wait_ms = (int)((end - now + 999999u) / 1000000u);
+        }
+
+        int err = sys_sem_wait(&mblock->alloc_sem, wait_ms);
+        natomic_add(&mblock->wait_cnt, -1);
+        if (err < 0) {
             return (void *)0;
-        } else {
-            nlocker_lock(&mblock->locker);
-            nlist_node_t * block = nlist_remove_first(&mblock->free_list);
-            nlocker_unlock(&mblock->locker);
-            return block;
         }
     }
+
+    return mblock_pop(mblock);
 }
 
 
 int mblock_free_cnt (mblock_t * mblock) {
-    nlocker_lock(&mblock->locker);
-    int count = nlist_count(&mblock->free_list);
-    nlocker_unlock(&mblock->locker);
+    return natomic_load(&mblock->free_cnt);
+}
 
-    return count;
+int mblock_cnt (mblock_t * mblock) {
+    return mblock->cnt;
 }
 
 void mblock_free (mblock_t * mblock, void * mem) {
-    nlocker_lock(&mblock->locker);
-    nlist_insert_last(&mblock->free_list, (nlist_node_t *)mem);
-    nlocker_unlock(&mblock->locker);
+    mblock_push(mblock, (nlist_node_t *)mem);
+    natomic_add(&mblock->free_cnt, 1);
 
-    if (mblock->locker.type != NLOCKER_NONE) {
-        sys_sem_notify(mblock->alloc_sem);
-    }
+    mblock_wakeup(mblock, 1);
 }
 
 
 void mblock_destroy (mblock_t * mblock) {
     if (mblock->locker.type != NLOCKER_NONE) {
-        sys_sem_free(mblock->alloc_sem);
+        sys_sem_destroy(&mblock->alloc_sem);
         nlocker_destroy(&mblock->locker);
     }
+
+    while (mblock->slab_list) {
+        void * next = *(void **)mblock->slab_list;
+        sys_mem_free(mblock->slab_list);
+        mblock->slab_list = next;
+    }
+
+    sys_mem_free(mblock->mem);
+    mblock->mem = (void *)0;
 }
\ No newline at end of file
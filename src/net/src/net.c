@@ -9,26 +9,101 @@
 #include "tools.h"
 #include "timer.h"
 #include "arp.h"
+#include "vlan.h"
+#include "net_stats.h"
+#include "net_metrics.h"
+
+static const net_pool_cfg_t default_cfg = {
+    .pktbuf_blk_cnt = PKTBUF_BLK_CNT,
+    .pktbuf_buf_cnt = PKTBUF_BUF_CNT,
+    .exmsg_msg_cnt = EXMSG_MSG_CNT,
+    .arp_cache_size = ARP_CACHE_SIZE,
+
+    .pktbuf_slab_cnt = PKTBUF_SLAB_CNT,
+    .pktbuf_blk_max = PKTBUF_BLK_MAX,
+    .pktbuf_buf_max = PKTBUF_BUF_MAX,
+
+    .mem_flags = NET_MEM_FLAGS,
+};
+static net_pool_cfg_t user_cfg;
+static const net_pool_cfg_t * pool_cfg = &default_cfg;
+
+void net_pool_cfg_default (net_pool_cfg_t * cfg) {
+    *cfg = default_cfg;
+}
+
+net_err_t net_pool_cfg_set (const net_pool_cfg_t * cfg) {
+    if ((cfg->pktbuf_blk_cnt <= 0) || (cfg->pktbuf_buf_cnt <= 0) || (cfg->exmsg_msg_cnt <= 0) || (cfg->arp_cache_size <= 0)) {
+        dbg_error(DBG_INIT, "bad pool size");
+        return NET_ERR_PARAM;
+    }
+
+    if (cfg->pktbuf_slab_cnt < 0) {
+        dbg_error(DBG_INIT, "bad pool slab size");
+        return NET_ERR_PARAM;
+    }
+
+    user_cfg = *cfg;
+    pool_cfg = &user_cfg;
+    return NET_ERR_OK;
+}
+
+const net_pool_cfg_t * net_pool_cfg_get (void) {
+    return pool_cfg;
+}
+
 net_err_t net_init (void) {
     dbg_info(DBG_INIT, "net init");
     net_plat_init();
 
-    tools_init();
+    net_err_t err = net_stats_init();
+    if (err < 0) {
+        goto init_failed;
+    }
 
-    exmsg_init();
+    if ((err = tools_init()) < 0) {
+        goto stats_failed;
+    }
 
-    pktbuf_init();
+    if ((err = exmsg_init()) < 0) {
+        goto stats_failed;
+    }
 
-    netif_init();
+    if ((err = pktbuf_init()) < 0) {
+        goto exmsg_failed;
+    }
 
-    net_timer_init();
+    if (((err = netif_init()) < 0) || ((err = net_timer_init()) < 0) || ((err = loop_init()) < 0)) {
+        goto pktbuf_failed;
+    }
 
-    loop_init();
+    if (((err = ether_init()) < 0) || ((err = arp_init()) < 0)) {
+        goto loop_failed;
+    }
 
-    ether_init();
+    if ((err = vlan_init()) < 0) {
+        goto arp_failed;
+    }
 
-    arp_init();
+    // 共享内存不可用时协议栈仍可正常运行
+    if (net_metrics_init() < 0) {
+        dbg_warning(DBG_INIT, "metrics unavailable");
+    }
     return NET_ERR_OK;
+
+arp_failed:
+    arp_destroy();
+loop_failed:
+    loop_destroy();
+pktbuf_failed:
+    pktbuf_destroy();
+exmsg_failed:
+    exmsg_destroy();
+stats_failed:
+    net_stats_destroy();
+init_failed:
+    dbg_error(DBG_INIT, "net init failed: %d", err);
+    return err;
 }
 
 
@@ -0,0 +1,661 @@
+#include "net_bpf.h"
+#include "dbg.h"
+#include "sys.h"
+
+#if NET_BPF_JIT && (defined(__x86_64__) || defined(_M_X64))
+#define BPF_JIT_X64     1
+#else
+#define BPF_JIT_X64     0
+#endif
+
+#define pkt_get32(p)    (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (p)[3])
+#define pkt_get16(p)    (((uint32_t)(p)[0] << 8) | (p)[1])
+
+/**
+ * 检查程序：指令合法、跳转只向前且不越界、暂存区下标有效、除数常数不为0，
+ * 最后一条为返回指令。通过检查的程序一定会结束，执行时不再检查
+ */
+net_err_t net_bpf_check (const net_bpf_insn_t * insn, int cnt) {
+    if ((cnt <= 0) || (cnt > NET_BPF_INSN_MAX)) {
+        dbg_error(DBG_BPF, "invalid insn cnt: %d", cnt);
+        return NET_ERR_SIZE;
+    }
+
+    for (int i = 0; i < cnt; i++) {
+        const net_bpf_insn_t * pc = insn + i;
+        int remain = cnt - i - 1;
+
+        switch (pc->code) {
+            case NET_BPF_LD | NET_BPF_W | NET_BPF_ABS:
+            case NET_BPF_LD | NET_BPF_H | NET_BPF_ABS:
+            case NET_BPF_LD | NET_BPF_B | NET_BPF_ABS:
+            case NET_BPF_LD | NET_BPF_W | NET_BPF_IND:
+            case NET_BPF_LD | NET_BPF_H | NET_BPF_IND:
+            case NET_BPF_LD | NET_BPF_B | NET_BPF_IND:
+            case NET_BPF_LD | NET_BPF_W | NET_BPF_LEN:
+            case NET_BPF_LD | NET_BPF_IMM:
+            case NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM:
+            case NET_BPF_LDX | NET_BPF_W | NET_BPF_LEN:
+            case NET_BPF_LDX | NET_BPF_B | NET_BPF_MSH:
+            case NET_BPF_ALU | NET_BPF_ADD | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_SUB | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_MUL | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_OR | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_AND | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_XOR | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_ADD | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_SUB | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_MUL | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_DIV | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_MOD | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_OR | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_AND | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_XOR | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_LSH | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_RSH | NET_BPF_X:
+            case NET_BPF_ALU | NET_BPF_NEG:
+            case NET_BPF_RET | NET_BPF_K:
+            case NET_BPF_RET | NET_BPF_A:
+            case NET_BPF_MISC | NET_BPF_TAX:
+            case NET_BPF_MISC | NET_BPF_TXA:
+                break;
+            case NET_BPF_LD | NET_BPF_MEM:
+            case NET_BPF_LDX | NET_BPF_MEM:
+            case NET_BPF_ST:
+            case NET_BPF_STX:
+                if (pc->k >= NET_BPF_MEM_CNT) {
+                    dbg_error(DBG_BPF, "insn %d: invalid mem index %u", i, pc->k);
+                    return NET_ERR_PARAM;
+                }
+                break;
+            case NET_BPF_ALU | NET_BPF_DIV | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_MOD | NET_BPF_K:
+                if (pc->k == 0) {
+                    dbg_error(DBG_BPF, "insn %d: divide by zero", i);
+                    return NET_ERR_PARAM;
+                }
+                break;
+            case NET_BPF_ALU | NET_BPF_LSH | NET_BPF_K:
+            case NET_BPF_ALU | NET_BPF_RSH | NET_BPF_K:
+                if (pc->k >= 32) {
+                    dbg_error(DBG_BPF, "insn %d: invalid shift %u", i, pc->k);
+                    return NET_ERR_PARAM;
+                }
+                break;
+            case NET_BPF_JMP | NET_BPF_JA:
+                if (pc->k >= (uint32_t)remain) {
+                    dbg_error(DBG_BPF, "insn %d: jump out of range", i);
+                    return NET_ERR_PARAM;
+                }
+                break;
+            case NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K:
+            case NET_BPF_JMP | NET_BPF_JGT | NET_BPF_K:
+            case NET_BPF_JMP | NET_BPF_JGE | NET_BPF_K:
+            case NET_BPF_JMP | NET_BPF_JSET | NET_BPF_K:
+            case NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_X:
+            case NET_BPF_JMP | NET_BPF_JGT | NET_BPF_X:
+            case NET_BPF_JMP | NET_BPF_JGE | NET_BPF_X:
+            case NET_BPF_JMP | NET_BPF_JSET | NET_BPF_X:
+                if ((pc->jt >= remain) || (pc->jf >= remain)) {
+                    dbg_error(DBG_BPF, "insn %d: jump out of range", i);
+                    return NET_ERR_PARAM;
+                }
+                break;
+            default:
+                dbg_error(DBG_BPF, "insn %d: unknown code 0x%x", i, pc->code);
+                return NET_ERR_PARAM;
+        }
+    }
+
+    if (NET_BPF_CLASS(insn[cnt - 1].code) != NET_BPF_RET) {
+        dbg_error(DBG_BPF, "last insn is not ret");
+        return NET_ERR_PARAM;
+    }
+    return NET_ERR_OK;
+}
+
+/**
+ * 解释执行检查过的程序。读取超出包长时返回0，与除数为0时一样丢弃
+ */
+uint32_t net_bpf_interp (const net_bpf_insn_t * insn, const uint8_t * pkt, uint32_t len) {
+    uint32_t a = 0, x = 0;
+    uint32_t mem[NET_BPF_MEM_CNT] = {0};
+    uint64_t off;
+
+    for (const net_bpf_insn_t * pc = insn; ; pc++) {
+        switch (pc->code) {
+            case NET_BPF_LD | NET_BPF_W | NET_BPF_ABS:
+                off = pc->k;
+                goto load_w;
+            case NET_BPF_LD | NET_BPF_W | NET_BPF_IND:
+                off = (uint64_t)x + pc->k;
+            load_w:
+                if (off + 4 > len) {
+                    return 0;
+                }
+                a = pkt_get32(pkt + off);
+                break;
+            case NET_BPF_LD | NET_BPF_H | NET_BPF_ABS:
+                off = pc->k;
+                goto load_h;
+            case NET_BPF_LD | NET_BPF_H | NET_BPF_IND:
+                off = (uint64_t)x + pc->k;
+            load_h:
+                if (off + 2 > len) {
+                    return 0;
+                }
+                a = pkt_get16(pkt + off);
+                break;
+            case NET_BPF_LD | NET_BPF_B | NET_BPF_ABS:
+                off = pc->k;
+                goto load_b;
+            case NET_BPF_LD | NET_BPF_B | NET_BPF_IND:
+                off = (uint64_t)x + pc->k;
+            load_b:
+                if (off >= len) {
+                    return 0;
+                }
+                a = pkt[off];
+                break;
+            case NET_BPF_LD | NET_BPF_W | NET_BPF_LEN:
+                a = len;
+                break;
+            case NET_BPF_LD | NET_BPF_IMM:
+                a = pc->k;
+                break;
+            case NET_BPF_LD | NET_BPF_MEM:
+                a = mem[pc->k];
+                break;
+            case NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM:
+                x = pc->k;
+                break;
+            case NET_BPF_LDX | NET_BPF_W | NET_BPF_LEN:
+                x = len;
+                break;
+            case NET_BPF_LDX | NET_BPF_MEM:
+                x = mem[pc->k];
+                break;
+            case NET_BPF_LDX | NET_BPF_B | NET_BPF_MSH:
+                if (pc->k >= len) {
+                    return 0;
+                }
+                x = (pkt[pc->k] & 0xF) << 2;
+                break;
+            case NET_BPF_ST:
+                mem[pc->k] = a;
+                break;
+            case NET_BPF_STX:
+                mem[pc->k] = x;
+                break;
+            case NET_BPF_ALU | NET_BPF_ADD | NET_BPF_K: a += pc->k; break;
+            case NET_BPF_ALU | NET_BPF_SUB | NET_BPF_K: a -= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_MUL | NET_BPF_K: a *= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_DIV | NET_BPF_K: a /= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_MOD | NET_BPF_K: a %= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_OR | NET_BPF_K:  a |= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_AND | NET_BPF_K: a &= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_XOR | NET_BPF_K: a ^= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_LSH | NET_BPF_K: a <<= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_RSH | NET_BPF_K: a >>= pc->k; break;
+            case NET_BPF_ALU | NET_BPF_ADD | NET_BPF_X: a += x; break;
+            case NET_BPF_ALU | NET_BPF_SUB | NET_BPF_X: a -= x; break;
+            case NET_BPF_ALU | NET_BPF_MUL | NET_BPF_X: a *= x; break;
+            case NET_BPF_ALU | NET_BPF_OR | NET_BPF_X:  a |= x; break;
+            case NET_BPF_ALU | NET_BPF_AND | NET_BPF_X: a &= x; break;
+            case NET_BPF_ALU | NET_BPF_XOR | NET_BPF_X: a ^= x; break;
+            // 移位数取低5位，与x86的移位指令一致
+            case NET_BPF_ALU | NET_BPF_LSH | NET_BPF_X: a <<= (x & 31); break;
+            case NET_BPF_ALU | NET_BPF_RSH | NET_BPF_X: a >>= (x & 31); break;
+            case NET_BPF_ALU | NET_BPF_DIV | NET_BPF_X:
+                if (x == 0) {
+                    return 0;
+                }
+                a /= x;
+                break;
+            case NET_BPF_ALU | NET_BPF_MOD | NET_BPF_X:
+                if (x == 0) {
+                    return 0;
+                }
+                a %= x;
+                break;
+            case NET_BPF_ALU | NET_BPF_NEG:
+                a = 0 - a;
+                break;
+            case NET_BPF_JMP | NET_BPF_JA:
+                pc += pc->k;
+                break;
+            case NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K:  pc += (a == pc->k) ? pc->jt : pc->jf; break;
+            case NET_BPF_JMP | NET_BPF_JGT | NET_BPF_K:  pc += (a > pc->k) ? pc->jt : pc->jf; break;
+            case NET_BPF_JMP | NET_BPF_JGE | NET_BPF_K:  pc += (a >= pc->k) ? pc->jt : pc->jf; break;
+            case NET_BPF_JMP | NET_BPF_JSET | NET_BPF_K: pc += (a & pc->k) ? pc->jt : pc->jf; break;
+            case NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_X:  pc += (a == x) ? pc->jt : pc->jf; break;
+            case NET_BPF_JMP | NET_BPF_JGT | NET_BPF_X:  pc += (a > x) ? pc->jt : pc->jf; break;
+            case NET_BPF_JMP | NET_BPF_JGE | NET_BPF_X:  pc += (a >= x) ? pc->jt : pc->jf; break;
+            case NET_BPF_JMP | NET_BPF_JSET | NET_BPF_X: pc += (a & x) ? pc->jt : pc->jf; break;
+            case NET_BPF_RET | NET_BPF_K:
+                return pc->k;
+            case NET_BPF_RET | NET_BPF_A:
+                return a;
+            case NET_BPF_MISC | NET_BPF_TAX:
+                x = a;
+                break;
+            case NET_BPF_MISC | NET_BPF_TXA:
+                a = x;
+                break;
+            default:
+                return 0;
+        }
+    }
+}
+
+#if BPF_JIT_X64
+
+/**
+ * x86-64编译：A在eax，X在ecx，包地址在rdi，包长在rsi(零扩展)，edx/r8为临时寄存器，
+ * M[]在栈上。所有跳转都使用32位偏移，每条指令的长度与跳转目标无关，
+ * 第一遍确定各指令的地址，第二遍填入跳转偏移
+ */
+#define JIT_INSN_SIZE       32              // 单条指令生成代码的最大长度
+#define JIT_CODE_SIZE       (NET_BPF_INSN_MAX * JIT_INSN_SIZE + 128)
+
+typedef struct _jit_t {
+    uint8_t * code;
+    int len;
+    int addr[NET_BPF_INSN_MAX];             // 各指令代码的起始位置
+    int exit;                               // 返回A
+    int fail;                               // 返回0
+}jit_t;
+
+static void emit (jit_t * jit, const uint8_t * bytes, int size) {
+    plat_memcpy(jit->code + jit->len, bytes, size);
+    jit->len += size;
+}
+
+#define EMIT(jit, ...)  do { const uint8_t b[] = {__VA_ARGS__}; emit(jit, b, sizeof(b)); } while (0)
+
+static void emit_u32 (jit_t * jit, uint32_t v) {
+    jit->code[jit->len++] = (uint8_t)v;
+    jit->code[jit->len++] = (uint8_t)(v >> 8);
+    jit->code[jit->len++] = (uint8_t)(v >> 16);
+    jit->code[jit->len++] = (uint8_t)(v >> 24);
+}
+
+// op为0xE9(jmp)或条件跳转0x0F 0x8x的第二字节
+static void emit_jmp (jit_t * jit, uint8_t op, int target) {
+    if (op != 0xE9) {
+        jit->code[jit->len++] = 0x0F;
+    }
+    jit->code[jit->len++] = op;
+    emit_u32(jit, (uint32_t)(target - (jit->len + 4)));
+}
+
+#define JCC_JB      0x82
+#define JCC_JAE     0x83
+#define JCC_JE      0x84
+#define JCC_JNE     0x85
+#define JCC_JBE     0x86
+#define JCC_JA      0x87
+#define JMP         0xE9
+
+static int jit_use_mem (const net_bpf_insn_t * insn, int cnt) {
+    for (int i = 0; i < cnt; i++) {
+        uint16_t code = insn[i].code;
+        if ((code == (NET_BPF_LD | NET_BPF_MEM)) || (code == (NET_BPF_LDX | NET_BPF_MEM)) ||
+            (code == NET_BPF_ST) || (code == NET_BPF_STX)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 绝对地址读取：k+size超过包长时返回0
+ */
+static void jit_load_abs (jit_t * jit, uint32_t k, int size) {
+    if ((uint64_t)k + size > 0x7FFFFFFF) {
+        emit_jmp(jit, JMP, jit->fail);
+        return;
+    }
+
+    EMIT(jit, 0x81, 0xFE);                  // cmp esi, k + size
+    emit_u32(jit, k + size);
+    emit_jmp(jit, JCC_JB, jit->fail);
+
+    switch (size) {
+        case 4:
+            EMIT(jit, 0x8B, 0x87);          // mov eax, [rdi + k]
+            emit_u32(jit, k);
+            EMIT(jit, 0x0F, 0xC8);          // bswap eax
+            break;
+        case 2:
+            EMIT(jit, 0x0F, 0xB7, 0x87);    // movzx eax, word [rdi + k]
+            emit_u32(jit, k);
+            EMIT(jit, 0x66, 0xC1, 0xC0, 0x08);  // rol ax, 8
+            break;
+        default:
+            EMIT(jit, 0x0F, 0xB6, 0x87);    // movzx eax, byte [rdi + k]
+            emit_u32(jit, k);
+            break;
+    }
+}
+
+/**
+ * 相对X的读取：在64位中计算X+k+size，不会溢出
+ */
+static void jit_load_ind (jit_t * jit, uint32_t k, int size) {
+    EMIT(jit, 0x89, 0xCA);                  // mov edx, ecx
+    EMIT(jit, 0x41, 0xB8);                  // mov r8d, k
+    emit_u32(jit, k);
+    EMIT(jit, 0x4C, 0x01, 0xC2);            // add rdx, r8
+    EMIT(jit, 0x4C, 0x8D, 0x42, (uint8_t)size); // lea r8, [rdx + size]
+    EMIT(jit, 0x49, 0x39, 0xF0);            // cmp r8, rsi
+    emit_jmp(jit, JCC_JA, jit->fail);
+
+    switch (size) {
+        case 4:
+            EMIT(jit, 0x8B, 0x04, 0x17);    // mov eax, [rdi + rdx]
+            EMIT(jit, 0x0F, 0xC8);          // bswap eax
+            break;
+        case 2:
+            EMIT(jit, 0x0F, 0xB7, 0x04, 0x17);  // movzx eax, word [rdi + rdx]
+            EMIT(jit, 0x66, 0xC1, 0xC0, 0x08);  // rol ax, 8
+            break;
+        default:
+            EMIT(jit, 0x0F, 0xB6, 0x04, 0x17);  // movzx eax, byte [rdi + rdx]
+            break;
+    }
+}
+
+static void jit_cond (jit_t * jit, int i, const net_bpf_insn_t * pc, uint8_t jcc_true, uint8_t jcc_false) {
+    int t = jit->addr[i + 1 + pc->jt], f = jit->addr[i + 1 + pc->jf];
+    if (pc->jt == pc->jf) {
+        if (pc->jt) {
+            emit_jmp(jit, JMP, t);
+        }
+        return;
+    }
+
+    int is_set = NET_BPF_OP(pc->code) == NET_BPF_JSET;
+    if (NET_BPF_SRC(pc->code) == NET_BPF_X) {
+        if (is_set) {
+            EMIT(jit, 0x85, 0xC8);          // test eax, ecx
+        } else {
+            EMIT(jit, 0x39, 0xC8);          // cmp eax, ecx
+        }
+    } else {
+        jit->code[jit->len++] = is_set ? 0xA9 : 0x3D;  // test/cmp eax, k
+        emit_u32(jit, pc->k);
+    }
+
+    if (pc->jt == 0) {
+        emit_jmp(jit, jcc_false, f);
+    } else if (pc->jf == 0) {
+        emit_jmp(jit, jcc_true, t);
+    } else {
+        emit_jmp(jit, jcc_true, t);
+        emit_jmp(jit, JMP, f);
+    }
+}
+
+static int jit_insn (jit_t * jit, const net_bpf_insn_t * insn, int i, int cnt) {
+    const net_bpf_insn_t * pc = insn + i;
+    uint8_t mem_off = (uint8_t)(pc->k * 4);
+
+    switch (pc->code) {
+        case NET_BPF_LD | NET_BPF_W | NET_BPF_ABS: jit_load_abs(jit, pc->k, 4); break;
+        case NET_BPF_LD | NET_BPF_H | NET_BPF_ABS: jit_load_abs(jit, pc->k, 2); break;
+        case NET_BPF_LD | NET_BPF_B | NET_BPF_ABS: jit_load_abs(jit, pc->k, 1); break;
+        case NET_BPF_LD | NET_BPF_W | NET_BPF_IND: jit_load_ind(jit, pc->k, 4); break;
+        case NET_BPF_LD | NET_BPF_H | NET_BPF_IND: jit_load_ind(jit, pc->k, 2); break;
+        case NET_BPF_LD | NET_BPF_B | NET_BPF_IND: jit_load_ind(jit, pc->k, 1); break;
+        case NET_BPF_LD | NET_BPF_W | NET_BPF_LEN:
+            EMIT(jit, 0x89, 0xF0);          // mov eax, esi
+            break;
+        case NET_BPF_LD | NET_BPF_IMM:
+            jit->code[jit->len++] = 0xB8;   // mov eax, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_LD | NET_BPF_MEM:
+            EMIT(jit, 0x8B, 0x44, 0x24);    // mov eax, [rsp + k * 4]
+            jit->code[jit->len++] = mem_off;
+            break;
+        case NET_BPF_LDX | NET_BPF_W | NET_BPF_IMM:
+            jit->code[jit->len++] = 0xB9;   // mov ecx, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_LDX | NET_BPF_W | NET_BPF_LEN:
+            EMIT(jit, 0x89, 0xF1);          // mov ecx, esi
+            break;
+        case NET_BPF_LDX | NET_BPF_MEM:
+            EMIT(jit, 0x8B, 0x4C, 0x24);    // mov ecx, [rsp + k * 4]
+            jit->code[jit->len++] = mem_off;
+            break;
+        case NET_BPF_LDX | NET_BPF_B | NET_BPF_MSH:
+            if (pc->k >= 0x7FFFFFFF) {
+                emit_jmp(jit, JMP, jit->fail);
+                break;
+            }
+            EMIT(jit, 0x81, 0xFE);          // cmp esi, k + 1
+            emit_u32(jit, pc->k + 1);
+            emit_jmp(jit, JCC_JB, jit->fail);
+            EMIT(jit, 0x0F, 0xB6, 0x8F);    // movzx ecx, byte [rdi + k]
+            emit_u32(jit, pc->k);
+            EMIT(jit, 0x83, 0xE1, 0x0F);    // and ecx, 0xf
+            EMIT(jit, 0xC1, 0xE1, 0x02);    // shl ecx, 2
+            break;
+        case NET_BPF_ST:
+            EMIT(jit, 0x89, 0x44, 0x24);    // mov [rsp + k * 4], eax
+            jit->code[jit->len++] = mem_off;
+            break;
+        case NET_BPF_STX:
+            EMIT(jit, 0x89, 0x4C, 0x24);    // mov [rsp + k * 4], ecx
+            jit->code[jit->len++] = mem_off;
+            break;
+        case NET_BPF_ALU | NET_BPF_ADD | NET_BPF_K:
+            jit->code[jit->len++] = 0x05;   // add eax, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_ALU | NET_BPF_SUB | NET_BPF_K:
+            jit->code[jit->len++] = 0x2D;   // sub eax, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_ALU | NET_BPF_MUL | NET_BPF_K:
+            EMIT(jit, 0x69, 0xC0);          // imul eax, eax, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_ALU | NET_BPF_OR | NET_BPF_K:
+            jit->code[jit->len++] = 0x0D;   // or eax, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_ALU | NET_BPF_AND | NET_BPF_K:
+            jit->code[jit->len++] = 0x25;   // and eax, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_ALU | NET_BPF_XOR | NET_BPF_K:
+            jit->code[jit->len++] = 0x35;   // xor eax, k
+            emit_u32(jit, pc->k);
+            break;
+        case NET_BPF_ALU | NET_BPF_LSH | NET_BPF_K:
+            EMIT(jit, 0xC1, 0xE0);          // shl eax, k
+            jit->code[jit->len++] = (uint8_t)pc->k;
+            break;
+        case NET_BPF_ALU | NET_BPF_RSH | NET_BPF_K:
+            EMIT(jit, 0xC1, 0xE8);          // shr eax, k
+            jit->code[jit->len++] = (uint8_t)pc->k;
+            break;
+        case NET_BPF_ALU | NET_BPF_DIV | NET_BPF_K:
+        case NET_BPF_ALU | NET_BPF_MOD | NET_BPF_K:
+            EMIT(jit, 0x41, 0xB8);          // mov r8d, k
+            emit_u32(jit, pc->k);
+            EMIT(jit, 0x31, 0xD2);          // xor edx, edx
+            EMIT(jit, 0x41, 0xF7, 0xF0);    // div r8d
+            if (NET_BPF_OP(pc->code) == NET_BPF_MOD) {
+                EMIT(jit, 0x89, 0xD0);      // mov eax, edx
+            }
+            break;
+        case NET_BPF_ALU | NET_BPF_ADD | NET_BPF_X: EMIT(jit, 0x01, 0xC8); break;          // add eax, ecx
+        case NET_BPF_ALU | NET_BPF_SUB | NET_BPF_X: EMIT(jit, 0x29, 0xC8); break;          // sub eax, ecx
+        case NET_BPF_ALU | NET_BPF_MUL | NET_BPF_X: EMIT(jit, 0x0F, 0xAF, 0xC1); break;    // imul eax, ecx
+        case NET_BPF_ALU | NET_BPF_OR | NET_BPF_X:  EMIT(jit, 0x09, 0xC8); break;          // or eax, ecx
+        case NET_BPF_ALU | NET_BPF_AND | NET_BPF_X: EMIT(jit, 0x21, 0xC8); break;          // and eax, ecx
+        case NET_BPF_ALU | NET_BPF_XOR | NET_BPF_X: EMIT(jit, 0x31, 0xC8); break;          // xor eax, ecx
+        case NET_BPF_ALU | NET_BPF_LSH | NET_BPF_X: EMIT(jit, 0xD3, 0xE0); break;          // shl eax, cl
+        case NET_BPF_ALU | NET_BPF_RSH | NET_BPF_X: EMIT(jit, 0xD3, 0xE8); break;          // shr eax, cl
+        case NET_BPF_ALU | NET_BPF_DIV | NET_BPF_X:
+        case NET_BPF_ALU | NET_BPF_MOD | NET_BPF_X:
+            EMIT(jit, 0x85, 0xC9);          // test ecx, ecx
+            emit_jmp(jit, JCC_JE, jit->fail);
+            EMIT(jit, 0x31, 0xD2);          // xor edx, edx
+            EMIT(jit, 0xF7, 0xF1);          // div ecx
+            if (NET_BPF_OP(pc->code) == NET_BPF_MOD) {
+                EMIT(jit, 0x89, 0xD0);      // mov eax, edx
+            }
+            break;
+        case NET_BPF_ALU | NET_BPF_NEG:
+            EMIT(jit, 0xF7, 0xD8);          // neg eax
+            break;
+        case NET_BPF_JMP | NET_BPF_JA:
+            if (pc->k) {
+                emit_jmp(jit, JMP, jit->addr[i + 1 + pc->k]);
+            }
+            break;
+        case NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K:
+        case NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_X:
+            jit_cond(jit, i, pc, JCC_JE, JCC_JNE);
+            break;
+        case NET_BPF_JMP | NET_BPF_JGT | NET_BPF_K:
+        case NET_BPF_JMP | NET_BPF_JGT | NET_BPF_X:
+            jit_cond(jit, i, pc, JCC_JA, JCC_JBE);
+            break;
+        case NET_BPF_JMP | NET_BPF_JGE | NET_BPF_K:
+        case NET_BPF_JMP | NET_BPF_JGE | NET_BPF_X:
+            jit_cond(jit, i, pc, JCC_JAE, JCC_JB);
+            break;
+        case NET_BPF_JMP | NET_BPF_JSET | NET_BPF_K:
+        case NET_BPF_JMP | NET_BPF_JSET | NET_BPF_X:
+            jit_cond(jit, i, pc, JCC_JNE, JCC_JE);
+            break;
+        case NET_BPF_RET | NET_BPF_K:
+            jit->code[jit->len++] = 0xB8;   // mov eax, k
+            emit_u32(jit, pc->k);
+            // 最后一条指令之后紧接着返回代码
+            if (i != cnt - 1) {
+                emit_jmp(jit, JMP, jit->exit);
+            }
+            break;
+        case NET_BPF_RET | NET_BPF_A:
+            if (i != cnt - 1) {
+                emit_jmp(jit, JMP, jit->exit);
+            }
+            break;
+        case NET_BPF_MISC | NET_BPF_TAX:
+            EMIT(jit, 0x89, 0xC1);          // mov ecx, eax
+            break;
+        case NET_BPF_MISC | NET_BPF_TXA:
+            EMIT(jit, 0x89, 0xC8);          // mov eax, ecx
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+static int jit_pass (jit_t * jit, const net_bpf_insn_t * insn, int cnt, int use_mem) {
+    jit->len = 0;
+
+#if defined(_WIN64)
+    // Windows调用约定：参数在rcx/rdx，rdi/rsi须由被调用者保存
+    EMIT(jit, 0x57, 0x56);                  // push rdi; push rsi
+    EMIT(jit, 0x48, 0x89, 0xCF);            // mov rdi, rcx
+    EMIT(jit, 0x89, 0xD6);                  // mov esi, edx
+#else
+    EMIT(jit, 0x89, 0xF6);                  // mov esi, esi，零扩展包长
+#endif
+    EMIT(jit, 0x31, 0xC0);                  // xor eax, eax
+    EMIT(jit, 0x31, 0xC9);                  // xor ecx, ecx
+    if (use_mem) {
+        EMIT(jit, 0x48, 0x83, 0xEC, NET_BPF_MEM_CNT * 4);  // sub rsp, 64
+        for (int i = 0; i < NET_BPF_MEM_CNT * 4; i += 8) {
+            EMIT(jit, 0x48, 0x89, 0x44, 0x24);  // mov [rsp + i], rax
+            jit->code[jit->len++] = (uint8_t)i;
+        }
+    }
+
+    for (int i = 0; i < cnt; i++) {
+        jit->addr[i] = jit->len;
+        if (jit_insn(jit, insn, i, cnt) < 0) {
+            return -1;
+        }
+    }
+
+    jit->exit = jit->len;
+    if (use_mem) {
+        EMIT(jit, 0x48, 0x83, 0xC4, NET_BPF_MEM_CNT * 4);  // add rsp, 64
+    }
+#if defined(_WIN64)
+    EMIT(jit, 0x5E, 0x5F);                  // pop rsi; pop rdi
+#endif
+    EMIT(jit, 0xC3);                        // ret
+
+    jit->fail = jit->len;
+    EMIT(jit, 0x31, 0xC0);                  // xor eax, eax
+    emit_jmp(jit, JMP, jit->exit);
+    return 0;
+}
+
+static void jit_compile (net_bpf_t * prog) {
+    uint8_t code[JIT_CODE_SIZE];
+    jit_t jit;
+
+    jit.code = code;
+    jit.exit = jit.fail = 0;
+    int use_mem = jit_use_mem(prog->insn, prog->cnt);
+
+    // 第一遍时跳转目标未知，偏移无效；第二遍使用第一遍得到的地址
+    if ((jit_pass(&jit, prog->insn, prog->cnt, use_mem) < 0) ||
+        (jit_pass(&jit, prog->insn, prog->cnt, use_mem) < 0)) {
+        dbg_warning(DBG_BPF, "jit failed, use interpreter");
+        return;
+    }
+
+    void * mem = sys_code_alloc(code, jit.len);
+    if (!mem) {
+        dbg_warning(DBG_BPF, "alloc code failed, use interpreter");
+        return;
+    }
+
+    prog->jit = (net_bpf_func_t)mem;
+    prog->jit_size = jit.len;
+    dbg_info(DBG_BPF, "jit %d insn to %d bytes", prog->cnt, jit.len);
+}
+
+#endif
+
+/**
+ * 检查并装入程序，允许时编译为本机代码，编译失败时解释执行。
+ * prog中原有的程序被替换，调用者须保证已没有线程在执行它
+ */
+net_err_t net_bpf_load (net_bpf_t * prog, const net_bpf_insn_t * insn, int cnt) {
+    net_err_t err = net_bpf_check(insn, cnt);
+    if (err < 0) {
+        return err;
+    }
+
+    net_bpf_unload(prog);
+    plat_memcpy(prog->insn, insn, cnt * sizeof(net_bpf_insn_t));
+    prog->cnt = cnt;
+
+#if BPF_JIT_X64
+    jit_compile(prog);
+#endif
+    return NET_ERR_OK;
+}
+
+void net_bpf_unload (net_bpf_t * prog) {
+    if (prog->jit) {
+        sys_code_free((void *)prog->jit, prog->jit_size);
+        prog->jit = (net_bpf_func_t)0;
+        prog->jit_size = 0;
+    }
+    prog->cnt = 0;
+}
@@ -0,0 +1,532 @@
+#include "net_gso.h"
+#include "netif.h"
+#include "protocol.h"
+#include "tools.h"
+#include "dbg.h"
+#include "sys.h"
+
+#define IP_HDR_MIN          20
+#define IP_HDR_MAX          60
+#define TCP_HDR_MIN         20
+#define TCP_HDR_MAX         60
+
+#define IP_FLAG_DF          0x4000
+#define IP_FLAG_MF          0x2000
+#define IP_FRAG_MASK        0x1FFF
+
+#define TCP_FLAG_FIN        0x01
+#define TCP_FLAG_SYN        0x02
+#define TCP_FLAG_RST        0x04
+#define TCP_FLAG_PSH        0x08
+#define TCP_FLAG_ACK        0x10
+#define TCP_FLAG_CWR        0x80
+
+#define pkt_get16(p)        (((uint32_t)(p)[0] << 8) | (p)[1])
+#define pkt_get32(p)        (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (p)[3])
+
+static inline void pkt_put16 (uint8_t * p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void pkt_put32 (uint8_t * p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void ip_set_checksum (uint8_t * ip, int ihl) {
+    pkt_put16(ip + 10, 0);
+    pkt_put16(ip + 10, (uint16_t)~checksum16(ip, ihl, 0));
+}
+
+/**
+ * TCP伪首部的和，len为TCP包头及数据的长度
+ */
+static uint32_t pseudo_sum (const uint8_t * ip, int len) {
+    uint8_t hdr[12];
+    plat_memcpy(hdr, ip + 12, 8);
+    hdr[8] = 0;
+    hdr[9] = ip[9];
+    pkt_put16(hdr + 10, len);
+    return checksum16(hdr, sizeof(hdr), 0);
+}
+
+/**
+ * 填入上层留下的TCP/UDP校验和，包头位置取自meta
+ */
+net_err_t net_gso_csum (pktbuf_t * buf) {
+    pktbuf_meta_t * meta = &buf->meta;
+    if (!(meta->flags & PKTBUF_CSUM_NEED)) {
+        return NET_ERR_OK;
+    }
+
+    uint8_t ip[IP_HDR_MIN];
+    if ((meta->l3 < 0) || (meta->l4 < meta->l3 + IP_HDR_MIN)
+            || (pktbuf_seek(buf, meta->l3) < 0) || (pktbuf_read(buf, ip, IP_HDR_MIN) < 0)) {
+        dbg_error(DBG_GSO, "checksum needed but no header offset");
+        return NET_ERR_PARAM;
+    }
+
+    int csum_off;
+    switch (ip[9]) {
+        case NET_PROTOCOL_TCP:
+            csum_off = 16;
+            break;
+        case NET_PROTOCOL_UDP:
+            csum_off = 6;
+            break;
+        default:
+            meta->flags &= ~PKTBUF_CSUM_NEED;
+            return NET_ERR_OK;
+    }
+
+    int len = meta->l3 + (int)pkt_get16(ip + 2) - meta->l4;
+    if ((len < csum_off + 2) || (meta->l4 + len > pktbuf_total(buf))) {
+        dbg_error(DBG_GSO, "bad l4 length: %d", len);
+        return NET_ERR_PARAM;
+    }
+
+    uint8_t csum[2] = {0, 0};
+    pktbuf_seek(buf, meta->l4 + csum_off);
+    net_err_t err = pktbuf_write(buf, csum, sizeof(csum));
+    if (err < 0) {
+        return err;
+    }
+
+    pktbuf_seek(buf, meta->l4);
+    uint16_t sum = (uint16_t)~pktbuf_checksum16(buf, len, pseudo_sum(ip, len));
+    if (!sum && (ip[9] == NET_PROTOCOL_UDP)) {
+        sum = 0xFFFF;
+    }
+    pkt_put16(csum, sum);
+    pktbuf_seek(buf, meta->l4 + csum_off);
+    err = pktbuf_write(buf, csum, sizeof(csum));
+    if (err < 0) {
+        return err;
+    }
+
+    meta->flags &= ~PKTBUF_CSUM_NEED;
+    return NET_ERR_OK;
+}
+
+/**
+ * 用hdr作为包头，共享buf中从offset起的size字节作为数据，生成一个包加到list尾部。
+ * 新包继承buf的元数据，传输层包头位于l4，-1表示没有
+ */
+static net_err_t gso_add (nlist_t * list, uint8_t * hdr, int hlen, int l4, pktbuf_t * buf, int offset, int size) {
+    pktbuf_t * seg = pktbuf_alloc(hlen);
+    if (!seg) {
+        dbg_error(DBG_GSO, "no buffer for segment");
+        return NET_ERR_MEM;
+    }
+    nlist_insert_last(list, &seg->node);
+
+    seg->meta = buf->meta;
+    seg->meta.flags &= ~(PKTBUF_META_PARSED | PKTBUF_CSUM_NEED);
+    seg->meta.l2 = -1;
+    seg->meta.l3 = 0;
+    seg->meta.l4 = (int16_t)l4;
+
+    pktbuf_reset_acc(seg);
+    net_err_t err = pktbuf_write(seg, hdr, hlen);
+    if (err < 0) {
+        return err;
+    }
+    return pktbuf_share(seg, buf, offset, size);
+}
+
+/**
+ * 按MSS分段：各段复制包头，修改长度、标识、序号及校验和，数据引用原包
+ */
+static net_err_t gso_tcp (pktbuf_t * buf, const uint8_t * hdr, int ihl, int thl, int mtu, nlist_t * list) {
+    int hlen = ihl + thl;
+    int payload = pktbuf_total(buf) - hlen;
+    int mss = mtu - hlen;
+    if (mss <= 0) {
+        dbg_error(DBG_GSO, "mtu %d too small for header %d", mtu, hlen);
+        return NET_ERR_SIZE;
+    }
+
+    uint32_t id = pkt_get16(hdr + 4);
+    uint32_t seq = pkt_get32(hdr + ihl + 4);
+    uint8_t flags = hdr[ihl + 13];
+
+    uint8_t seg_hdr[IP_HDR_MAX + TCP_HDR_MAX];
+    uint8_t * ip = seg_hdr;
+    uint8_t * tcp = seg_hdr + ihl;
+    for (int off = 0, i = 0; off < payload; i++) {
+        int len = payload - off > mss ? mss : payload - off;
+
+        plat_memcpy(seg_hdr, hdr, hlen);
+        pkt_put16(ip + 2, hlen + len);
+        pkt_put16(ip + 4, id + i);
+        ip_set_checksum(ip, ihl);
+
+        // FIN、PSH只留在最后一段，CWR只留在第一段
+        pkt_put32(tcp + 4, seq + off);
+        uint8_t f = flags;
+        if (off + len < payload) {
+            f &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+        }
+        if (off) {
+            f &= ~TCP_FLAG_CWR;
+        }
+        tcp[13] = f;
+
+        pkt_put16(tcp + 16, 0);
+        uint32_t sum = checksum16(tcp, thl, pseudo_sum(ip, thl + len));
+        pktbuf_seek(buf, hlen + off);
+        sum = pktbuf_checksum16(buf, len, sum);
+        pkt_put16(tcp + 16, (uint16_t)~sum);
+
+        net_err_t err = gso_add(list, seg_hdr, hlen, ihl, buf, hlen + off, len);
+        if (err < 0) {
+            return err;
+        }
+        off += len;
+    }
+
+    return NET_ERR_OK;
+}
+
+/**
+ * IP分片：第一片保留全部选项，之后各片只带复制标志置位的选项。分片前先填入校验和
+ */
+static net_err_t gso_frag (pktbuf_t * buf, const uint8_t * hdr, int ihl, int mtu, nlist_t * list) {
+    uint32_t frag = pkt_get16(hdr + 6);
+    if (frag & IP_FLAG_DF) {
+        dbg_warning(DBG_GSO, "packet %d > mtu %d with DF set", pktbuf_total(buf), mtu);
+        return NET_ERR_SIZE;
+    }
+
+    net_err_t err = net_gso_csum(buf);
+    if (err < 0) {
+        return err;
+    }
+
+    uint8_t next_hdr[IP_HDR_MAX];
+    int next_ihl = IP_HDR_MIN;
+    plat_memcpy(next_hdr, hdr, IP_HDR_MIN);
+    for (int i = IP_HDR_MIN; i < ihl; ) {
+        uint8_t type = hdr[i];
+        if (type == 0) {
+            break;
+        } else if (type == 1) {
+            i++;
+            continue;
+        }
+
+        int len = (i + 1 < ihl) ? hdr[i + 1] : 0;
+        if ((len < 2) || (i + len > ihl)) {
+            break;
+        }
+
+        if (type & 0x80) {
+            plat_memcpy(next_hdr + next_ihl, hdr + i, len);
+            next_ihl += len;
+        }
+        i += len;
+    }
+    while (next_ihl & 3) {
+        next_hdr[next_ihl++] = 0;
+    }
+    next_hdr[0] = (uint8_t)(0x40 | (next_ihl >> 2));
+
+    int base = (frag & IP_FRAG_MASK) << 3;
+    int payload = pktbuf_total(buf) - ihl;
+
+    uint8_t frag_hdr[IP_HDR_MAX];
+    for (int off = 0; off < payload; ) {
+        const uint8_t * src = off ? next_hdr : hdr;
+        int hlen = off ? next_ihl : ihl;
+        int unit = (mtu - hlen) & ~7;
+        if (unit <= 0) {
+            dbg_error(DBG_GSO, "mtu %d too small for header %d", mtu, hlen);
+            return NET_ERR_SIZE;
+        }
+
+        int len = payload - off > unit ? unit : payload - off;
+        int more = (off + len < payload) ? IP_FLAG_MF : (frag & IP_FLAG_MF);
+
+        plat_memcpy(frag_hdr, src, hlen);
+        pkt_put16(frag_hdr + 2, hlen + len);
+        pkt_put16(frag_hdr + 6, (frag & ~(IP_FLAG_MF | IP_FRAG_MASK)) | more | ((base + off) >> 3));
+        ip_set_checksum(frag_hdr, hlen);
+
+        err = gso_add(list, frag_hdr, hlen, off ? -1 : ihl, buf, ihl + off, len);
+        if (err < 0) {
+            return err;
+        }
+        off += len;
+    }
+
+    return NET_ERR_OK;
+}
+
+/**
+ * 将超过mtu的IPv4包分成多个包放入list，未分片的TCP包按MSS分段，其它包分片。
+ * 各包的数据引用buf，buf仍由调用者释放；失败时list为空
+ */
+net_err_t net_gso_segment (pktbuf_t * buf, int mtu, nlist_t * list) {
+    nlist_init(list);
+
+    uint8_t hdr[IP_HDR_MAX + TCP_HDR_MAX];
+    int total = pktbuf_total(buf);
+    int size = total > (int)sizeof(hdr) ? (int)sizeof(hdr) : total;
+    if (size < IP_HDR_MIN) {
+        dbg_warning(DBG_GSO, "packet too small: %d", total);
+        return NET_ERR_SIZE;
+    }
+
+    pktbuf_reset_acc(buf);
+    pktbuf_read(buf, hdr, size);
+
+    int ihl = (hdr[0] & 0xF) << 2;
+    if (((hdr[0] >> 4) != 4) || (ihl < IP_HDR_MIN) || (ihl > size) || (pkt_get16(hdr + 2) != total)) {
+        dbg_warning(DBG_GSO, "not a valid ipv4 packet");
+        return NET_ERR_PARAM;
+    }
+
+    net_err_t err;
+    int thl = (size >= ihl + TCP_HDR_MIN) ? (hdr[ihl + 12] >> 4) << 2 : 0;
+    if ((hdr[9] == NET_PROTOCOL_TCP) && !(pkt_get16(hdr + 6) & (IP_FLAG_MF | IP_FRAG_MASK))
+            && (thl >= TCP_HDR_MIN) && (ihl + thl <= size)) {
+        err = gso_tcp(buf, hdr, ihl, thl, mtu, list);
+    } else {
+        err = gso_frag(buf, hdr, ihl, mtu, list);
+    }
+
+    if (err < 0) {
+        nlist_node_t * node;
+        while ((node = nlist_remove_first(list))) {
+            pktbuf_free(nlist_entry(node, pktbuf_t, node));
+        }
+        return err;
+    }
+
+    dbg_info(DBG_GSO, "packet %d split into %d", total, nlist_count(list));
+    return NET_ERR_OK;
+}
+
+void net_gro_init (net_gro_t * gro, netif_t * netif) {
+    plat_memset(gro, 0, sizeof(net_gro_t));
+    gro->netif = netif;
+}
+
+/**
+ * 可以合并的包：以太网上未分片、无IP选项的TCP包，只带ACK及PSH，有数据且校验和正确。
+ * 读出包头，返回IP包头的位置，sum为数据部分的和；不能合并时返回-1
+ */
+static int gro_check (net_gro_t * gro, pktbuf_t * buf, uint8_t * hdr, uint32_t * sum) {
+    if (gro->netif->type != NETIF_TYPE_ETHER) {
+        return -1;
+    }
+
+    // 先按收包时解析的结果筛选，其它包不必读取包头
+    pktbuf_meta_t * meta = &buf->meta;
+    if (!(meta->flags & PKTBUF_META_PARSED)) {
+        netif_parse_meta(gro->netif, buf);
+    }
+
+    int l3 = meta->l3;
+    if ((meta->l3_proto != NET_PROTOCOL_IPv4) || (meta->l4_proto != NET_PROTOCOL_TCP)
+            || (l3 < 0) || (meta->l4 != l3 + IP_HDR_MIN)
+            || (meta->l4_flags & ~(TCP_FLAG_ACK | TCP_FLAG_PSH)) || !(meta->l4_flags & TCP_FLAG_ACK)) {
+        return -1;
+    }
+
+    int total = pktbuf_total(buf);
+    int size = total > NET_GRO_HDR_MAX ? NET_GRO_HDR_MAX : total;
+    if (size < l3 + IP_HDR_MIN + TCP_HDR_MIN) {
+        return -1;
+    }
+
+    pktbuf_reset_acc(buf);
+    pktbuf_read(buf, hdr, size);
+
+    uint8_t * ip = hdr + l3;
+    if ((ip[0] != 0x45) || (pkt_get16(ip + 6) & (IP_FLAG_MF | IP_FRAG_MASK))
+            || (pkt_get16(ip + 2) != total - l3)) {
+        return -1;
+    }
+
+    uint8_t * tcp = ip + IP_HDR_MIN;
+    int thl = (tcp[12] >> 4) << 2;
+    int hlen = l3 + IP_HDR_MIN + thl;
+    if ((thl < TCP_HDR_MIN) || (hlen >= total) || (tcp[13] & ~(TCP_FLAG_ACK | TCP_FLAG_PSH))
+            || !(tcp[13] & TCP_FLAG_ACK)) {
+        return -1;
+    }
+
+    // 数据部分的和在合并后计算校验和时使用，已由网卡验证过的包不再检查
+    pktbuf_seek(buf, hlen);
+    *sum = pktbuf_checksum16(buf, total - hlen, 0);
+    if (!(meta->flags & PKTBUF_CSUM_OK)) {
+        if ((checksum16(ip, IP_HDR_MIN, 0) != 0xFFFF)
+                || (checksum16(tcp, thl, pseudo_sum(ip, total - l3 - IP_HDR_MIN) + *sum) != 0xFFFF)) {
+            return -1;
+        }
+        meta->flags |= PKTBUF_CSUM_OK;
+    }
+    return l3;
+}
+
+/**
+ * 同一条流：链路层包头、IP地址及服务类型、TTL、端口、确认号、TCP包头长度及选项都相同
+ */
+static net_gro_flow_t * gro_find (net_gro_t * gro, const uint8_t * hdr, int l3, int hlen, uint32_t hash) {
+    const uint8_t * ip = hdr + l3;
+    const uint8_t * tcp = ip + IP_HDR_MIN;
+
+    for (int i = 0; i < NET_GRO_FLOW_MAX; i++) {
+        net_gro_flow_t * flow = gro->flow + i;
+        if (!flow->buf || (flow->hash != hash) || (flow->l3 != l3) || (flow->hlen != hlen)) {
+            continue;
+        }
+
+        const uint8_t * fip = flow->hdr + l3;
+        const uint8_t * ftcp = fip + IP_HDR_MIN;
+        if (!plat_memcmp(hdr, flow->hdr, l3)
+                && !plat_memcmp(ip, fip, 2)
+                && !plat_memcmp(ip + 6, fip + 6, 4)
+                && !plat_memcmp(ip + 12, fip + 12, 8)
+                && !plat_memcmp(tcp, ftcp, 4)
+                && !plat_memcmp(tcp + 8, ftcp + 8, 5)
+                && !plat_memcmp(tcp + TCP_HDR_MIN, ftcp + TCP_HDR_MIN, hlen - l3 - IP_HDR_MIN - TCP_HDR_MIN)) {
+            return flow;
+        }
+    }
+    return (net_gro_flow_t *)0;
+}
+
+/**
+ * 交出流中合并的包：修改IP长度，PSH及窗口取自后续的包，重新计算校验和
+ */
+static void gro_flush_flow (net_gro_t * gro, net_gro_flow_t * flow) {
+    pktbuf_t * buf = flow->buf;
+    flow->buf = (pktbuf_t *)0;
+
+    if (flow->cnt > 1) {
+        uint8_t * ip = flow->hdr + flow->l3;
+        uint8_t * tcp = ip + IP_HDR_MIN;
+        int thl = flow->hlen - flow->l3 - IP_HDR_MIN;
+        int ip_len = pktbuf_total(buf) - flow->l3;
+
+        pkt_put16(ip + 2, ip_len);
+        ip_set_checksum(ip, IP_HDR_MIN);
+
+        pkt_put16(tcp + 14, flow->window);
+        pkt_put16(tcp + 16, 0);
+        uint16_t sum = checksum16(tcp, thl, pseudo_sum(ip, ip_len - IP_HDR_MIN) + flow->sum);
+        pkt_put16(tcp + 16, (uint16_t)~sum);
+
+        pktbuf_seek(buf, flow->l3);
+        net_err_t err = pktbuf_write(buf, ip, flow->hlen - flow->l3);
+        if (err < 0) {
+            dbg_error(DBG_GSO, "write header failed");
+            net_stats_netif_add(gro->netif, NET_STAT_RX_DROP_LINK, 1);
+            pktbuf_free(buf);
+            return;
+        }
+        buf->meta.l4_flags = tcp[13];
+        buf->meta.flags |= PKTBUF_GRO;
+
+        dbg_info(DBG_GSO, "%d segments merged, %d bytes", flow->cnt, pktbuf_total(buf));
+    }
+
+    netif_link_in(gro->netif, buf);
+}
+
+/**
+ * 取一个空闲的流，没有时按顺序交出一个
+ */
+static net_gro_flow_t * gro_alloc (net_gro_t * gro) {
+    for (int i = 0; i < NET_GRO_FLOW_MAX; i++) {
+        if (!gro->flow[i].buf) {
+            return gro->flow + i;
+        }
+    }
+
+    net_gro_flow_t * flow = gro->flow + gro->next;
+    gro->next = (gro->next + 1) % NET_GRO_FLOW_MAX;
+    gro_flush_flow(gro, flow);
+    return flow;
+}
+
+/**
+ * 处理一个收到的帧：同一流中连续的包合并后再交给链路层，其它包先交出所有合并中的包，再直接交出
+ */
+net_err_t net_gro_receive (net_gro_t * gro, pktbuf_t * buf) {
+    uint8_t hdr[NET_GRO_HDR_MAX];
+    uint32_t sum;
+
+    int l3 = gro_check(gro, buf, hdr, &sum);
+    if (l3 < 0) {
+        net_gro_flush(gro);
+        return netif_link_in(gro->netif, buf);
+    }
+
+    uint8_t * tcp = hdr + l3 + IP_HDR_MIN;
+    int hlen = l3 + IP_HDR_MIN + ((tcp[12] >> 4) << 2);
+    int len = pktbuf_total(buf) - hlen;
+    uint32_t seq = pkt_get32(tcp + 4);
+
+    net_gro_flow_t * flow = gro_find(gro, hdr, l3, hlen, buf->meta.hash);
+    if (flow) {
+        if ((seq == flow->next_seq) && (len <= flow->mss)
+                && (pktbuf_total(flow->buf) - l3 + len <= NET_GRO_SIZE_MAX)) {
+            pktbuf_remove_header(buf, hlen);
+            pktbuf_join(flow->buf, buf);
+
+            // 数据接在奇数位置时，其和需交换字节
+            sum = flow->sum + ((flow->size & 1) ? swap_u16((uint16_t)sum) : sum);
+            flow->sum = (sum & 0xFFFF) + (sum >> 16);
+            flow->size += len;
+            flow->next_seq += len;
+            flow->window = (uint16_t)pkt_get16(tcp + 14);
+            flow->hdr[l3 + IP_HDR_MIN + 13] |= tcp[13];
+            flow->cnt++;
+
+            if ((tcp[13] & TCP_FLAG_PSH) || (len < flow->mss)) {
+                gro_flush_flow(gro, flow);
+            }
+            return NET_ERR_OK;
+        }
+
+        gro_flush_flow(gro, flow);
+    }
+
+    if (tcp[13] & TCP_FLAG_PSH) {
+        return netif_link_in(gro->netif, buf);
+    }
+
+    if (!flow) {
+        flow = gro_alloc(gro);
+    }
+
+    flow->buf = buf;
+    flow->hash = buf->meta.hash;
+    plat_memcpy(flow->hdr, hdr, hlen);
+    flow->hlen = hlen;
+    flow->l3 = l3;
+    flow->mss = len;
+    flow->size = len;
+    flow->next_seq = seq + len;
+    flow->sum = sum;
+    flow->window = (uint16_t)pkt_get16(tcp + 14);
+    flow->cnt = 1;
+    return NET_ERR_OK;
+}
+
+/**
+ * 交出所有合并中的包，每批收取结束时调用
+ */
+void net_gro_flush (net_gro_t * gro) {
+    for (int i = 0; i < NET_GRO_FLOW_MAX; i++) {
+        if (gro->flow[i].buf) {
+            gro_flush_flow(gro, gro->flow + i);
+        }
+    }
+}
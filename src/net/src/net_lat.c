@@ -0,0 +1,118 @@
+#include "net_lat.h"
+#include "natomic.h"
+#include "dbg.h"
+
+static net_lat_stats_t lat_stats;
+
+#ifdef SYS_THREAD_LOCAL
+static SYS_THREAD_LOCAL unsigned sample_cnt;
+#else
+static unsigned sample_cnt;
+#endif
+
+int net_lat_sample (void) {
+    return (sample_cnt++ & (NET_LAT_SAMPLE - 1)) == 0;
+}
+
+static int bit_msb (uint64_t v) {
+    int n = 0;
+    for (int shift = 32; shift > 0; shift >>= 1) {
+        if (v >> shift) {
+            v >>= shift;
+            n += shift;
+        }
+    }
+    return n;
+}
+
+static int bucket_idx (uint64_t ns) {
+    if (ns < NET_LAT_SUB_CNT) {
+        return (int)ns;
+    }
+
+    if (ns >= ((uint64_t)1 << NET_LAT_MAX_BITS)) {
+        ns = ((uint64_t)1 << NET_LAT_MAX_BITS) - 1;
+    }
+
+    int msb = bit_msb(ns);
+    int sub = (int)(ns >> (msb - NET_LAT_SUB_BITS)) & (NET_LAT_SUB_CNT - 1);
+    return (msb - NET_LAT_SUB_BITS + 1) * NET_LAT_SUB_CNT + sub;
+}
+
+// 桶中能表示的最大值
+static uint64_t bucket_high (int idx) {
+    if (idx < NET_LAT_SUB_CNT) {
+        return idx;
+    }
+
+    int msb = idx / NET_LAT_SUB_CNT + NET_LAT_SUB_BITS - 1;
+    uint64_t sub = idx % NET_LAT_SUB_CNT;
+    uint64_t low = ((uint64_t)1 << msb) | (sub << (msb - NET_LAT_SUB_BITS));
+    return low + ((uint64_t)1 << (msb - NET_LAT_SUB_BITS)) - 1;
+}
+
+/**
+ * 只对采样到的包调用，多个线程可同时写同一阶段
+ */
+void net_lat_record (net_lat_stage_t stage, uint64_t ns) {
+    net_lat_hist_t * hist = lat_stats.stage + stage;
+
+    natomic_add64(&hist->bucket[bucket_idx(ns)], 1);
+    natomic_add64(&hist->sum, ns);
+    natomic_add64(&hist->count, 1);
+
+    uint64_t max = natomic_load64(&hist->max);
+    while ((ns > max) && !natomic_cas64(&hist->max, &max, ns)) {
+    }
+}
+
+void net_lat_snapshot (net_lat_stats_t * stats) {
+    uint64_t * dest = (uint64_t *)stats;
+    volatile uint64_t * src = (volatile uint64_t *)&lat_stats;
+
+    for (int i = 0; i < sizeof(net_lat_stats_t) / sizeof(uint64_t); i++) {
+        dest[i] = natomic_load64(src + i);
+    }
+}
+
+/**
+ * 计算百分位延时，如99.9，结果偏大但误差不超过所在桶的宽度
+ */
+uint64_t net_lat_percentile (const net_lat_hist_t * hist, double percent) {
+    uint64_t total = 0;
+    for (int i = 0; i < NET_LAT_BUCKET_CNT; i++) {
+        total += hist->bucket[i];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(total * percent / 100.0 + 0.5);
+    target = target ? target : 1;
+
+    uint64_t count = 0;
+    for (int i = 0; i < NET_LAT_BUCKET_CNT; i++) {
+        count += hist->bucket[i];
+        if (count >= target) {
+            uint64_t high = bucket_high(i);
+            return high < hist->max ? high : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+const char * net_lat_stage_name (net_lat_stage_t stage) {
+    static const char * name[] = {
+        [NET_LAT_RX] = "rx",
+        [NET_LAT_INQ] = "in_q",
+        [NET_LAT_MSGQ] = "msg_q",
+        [NET_LAT_PROC] = "proc",
+        [NET_LAT_OUTQ] = "out_q",
+        [NET_LAT_XMIT] = "xmit",
+        [NET_LAT_TOTAL] = "total",
+    };
+
+    return ((stage >= 0) && (stage < NET_LAT_STAGE_CNT)) ? name[stage] : "unknown";
+}
@@ -0,0 +1,142 @@
+#include "net_metrics.h"
+#include "netif.h"
+#include "timer.h"
+#include "sys.h"
+#include "dbg.h"
+#include "natomic.h"
+#include <stddef.h>
+
+static struct {
+    const char * name;
+    mblock_t * mblock;
+}pool_tbl[NET_METRICS_POOL_MAX];
+static int pool_cnt;
+
+static struct {
+    const char * name;
+    fixq_t * q;
+}queue_tbl[NET_METRICS_QUEUE_MAX];
+static int queue_cnt;
+
+static net_metrics_t * metrics;
+static net_timer_t metrics_timer;
+
+void net_metrics_add_pool (const char * name, mblock_t * mblock) {
+    if (pool_cnt >= NET_METRICS_POOL_MAX) {
+        dbg_warning(DBG_INIT, "metrics pool table full");
+        return;
+    }
+
+    pool_tbl[pool_cnt].name = name;
+    pool_tbl[pool_cnt++].mblock = mblock;
+}
+
+void net_metrics_add_queue (const char * name, fixq_t * q) {
+    if (queue_cnt >= NET_METRICS_QUEUE_MAX) {
+        dbg_warning(DBG_INIT, "metrics queue table full");
+        return;
+    }
+
+    queue_tbl[queue_cnt].name = name;
+    queue_tbl[queue_cnt++].q = q;
+}
+
+/**
+ * 在工作线程中定期运行，先在本地生成完整的快照，再在seq保护下一次性拷贝到共享内存
+ * 各项数据均以无锁的方式读取，不影响收发处理
+ */
+static void metrics_update (net_timer_t * timer, void * arg) {
+    static net_metrics_t local;
+    static net_stats_t stats;
+
+    net_stats_snapshot(&stats);
+
+    local.netif_cnt = 0;
+    for (int i = 0; i < NETIF_DEV_CNT; i++) {
+        net_metrics_netif_t * m = local.netif + i;
+        netif_t * netif = netif_get(i);
+
+        plat_memset(m, 0, sizeof(net_metrics_netif_t));
+        plat_memcpy(m->stats, stats.netif[i], sizeof(m->stats));
+        if (!netif) {
+            continue;
+        }
+
+        plat_strncpy(m->name, netif->name, NET_METRICS_NAME_SIZE - 1);
+        m->state = netif->state + 1;
+        m->type = netif->type;
+        m->in_q_cnt = qdisc_cnt(&netif->in_q);
+        m->in_q_size = netif->in_q.cfg.limit;
+        m->out_q_cnt = qdisc_cnt(&netif->out_q);
+        m->out_q_size = netif->out_q.cfg.limit;
+        local.netif_cnt = i + 1;
+    }
+
+    plat_memcpy(local.proto, stats.proto, sizeof(local.proto));
+    plat_memcpy(local.pool_stats, stats.pool, sizeof(local.pool_stats));
+
+    local.pool_cnt = pool_cnt;
+    for (int i = 0; i < pool_cnt; i++) {
+        net_metrics_pool_t * m = local.pool + i;
+        plat_strncpy(m->name, pool_tbl[i].name, NET_METRICS_NAME_SIZE - 1);
+        m->free_cnt = mblock_free_cnt(pool_tbl[i].mblock);
+        m->total_cnt = mblock_cnt(pool_tbl[i].mblock);
+    }
+
+    local.queue_cnt = queue_cnt;
+    for (int i = 0; i < queue_cnt; i++) {
+        net_metrics_queue_t * m = local.queue + i;
+        plat_strncpy(m->name, queue_tbl[i].name, NET_METRICS_NAME_SIZE - 1);
+        m->cnt = fixq_cnt(queue_tbl[i].q);
+        m->size = queue_tbl[i].q->size;
+    }
+
+    static net_lat_stats_t lat;
+    net_lat_snapshot(&lat);
+    for (int i = 0; i < NET_LAT_STAGE_CNT; i++) {
+        net_lat_hist_t * hist = lat.stage + i;
+        net_metrics_lat_t * m = local.lat + i;
+
+        m->count = hist->count;
+        m->p50 = net_lat_percentile(hist, 50);
+        m->p99 = net_lat_percentile(hist, 99);
+        m->p999 = net_lat_percentile(hist, 99.9);
+        m->max = hist->max;
+    }
+
+    local.timer_cnt = net_timer_cnt();
+    local.update_time = sys_time_ns();
+
+    // 写入期间seq为奇数
+    int start = offsetof(net_metrics_t, update_time);
+    natomic_add(&metrics->seq, 1);
+    plat_memcpy((uint8_t *)metrics + start, (uint8_t *)&local + start, sizeof(net_metrics_t) - start);
+    natomic_add(&metrics->seq, 1);
+}
+
+net_err_t net_metrics_init (void) {
+#if NET_METRICS_ENABLE
+    dbg_info(DBG_INIT, "metrics init");
+
+    metrics = (net_metrics_t *)sys_shm_create(NET_METRICS_NAME, sizeof(net_metrics_t));
+    if (!metrics) {
+        // 平台不支持或没有权限，协议栈仍可正常运行
+        dbg_warning(DBG_INIT, "create metrics shm failed");
+        return NET_ERR_SYS;
+    }
+
+    plat_memset(metrics, 0, sizeof(net_metrics_t));
+    metrics->magic = NET_METRICS_MAGIC;
+    metrics->version = NET_METRICS_VERSION;
+    metrics->size = sizeof(net_metrics_t);
+
+    net_err_t err = net_timer_add(&metrics_timer, "metrics", metrics_update, (void *)0, NET_METRICS_PERIOD, NET_TIMER_RELOAD);
+    if (err < 0) {
+        dbg_error(DBG_INIT, "add metrics timer failed");
+        return err;
+    }
+
+    dbg_info(DBG_INIT, "metrics init ok");
+#endif
+    return NET_ERR_OK;
+}
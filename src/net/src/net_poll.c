@@ -0,0 +1,39 @@
+#include "net_poll.h"
+#include "natomic.h"
+#include "sys.h"
+
+void net_poll_init (net_poll_t * poll, int max_us, int min_us) {
+    poll->idle_start = 0;
+    poll->max_budget = max_us * 1000;
+    poll->min_budget = min_us * 1000;
+    poll->budget = poll->max_budget;
+}
+
+/**
+ * 本次未取到数据时调用，返回1表示继续自旋，返回0表示预算已用完，应转入阻塞等待
+ */
+int net_poll_idle (net_poll_t * poll) {
+    uint64_t now = sys_time_ns();
+    if (poll->idle_start == 0) {
+        poll->idle_start = now;
+    }
+
+    if (now - poll->idle_start < (uint64_t)poll->budget) {
+        natomic_pause();
+        return 1;
+    }
+
+    poll->idle_start = 0;
+    poll->budget = poll->budget / 2 < poll->min_budget ? poll->min_budget : poll->budget / 2;
+    return 0;
+}
+
+/**
+ * 取到数据时调用
+ */
+void net_poll_busy (net_poll_t * poll) {
+    if (poll->idle_start) {
+        poll->budget = poll->budget * 2 > poll->max_budget ? poll->max_budget : poll->budget * 2;
+        poll->idle_start = 0;
+    }
+}
@@ -0,0 +1,153 @@
+#include "net_stats.h"
+#include "netif.h"
+#include "sys.h"
+#include "dbg.h"
+#include "net.h"
+#include "natomic.h"
+
+// net_stats_t中全部为uint64_t，按下标访问
+#define STATS_COUNTER_CNT   (sizeof(net_stats_t) / sizeof(uint64_t))
+#define STATS_NETIF_IDX(id, stat)       ((id) * NET_STAT_CNT + (stat))
+#define STATS_PROTO_IDX(proto, stat)    ((NETIF_DEV_CNT + (proto)) * NET_STAT_CNT + (stat))
+#define STATS_POOL_IDX(stat)            ((NETIF_DEV_CNT + NET_STATS_PROTO_CNT) * NET_STAT_CNT + (stat))
+
+// 每个线程写自己的一份计数，不需要原子操作；第0份由其余线程共用，原子累加
+static uint8_t * slot_tbl;
+static int slot_size;
+static volatile int slot_cnt;
+
+#ifdef SYS_THREAD_LOCAL
+static SYS_THREAD_LOCAL volatile uint64_t * curr_slot;
+#endif
+
+net_err_t net_stats_init (void) {
+    dbg_info(DBG_INIT, "stats init");
+
+    slot_size = (sizeof(net_stats_t) + SYS_CACHE_LINE_SIZE - 1) & ~(SYS_CACHE_LINE_SIZE - 1);
+    uint8_t * mem = (uint8_t *)sys_mem_alloc(slot_size * NET_STATS_THREAD_MAX, net_pool_cfg_get()->mem_flags);
+    if (!mem) {
+        dbg_error(DBG_INIT, "alloc stats failed");
+        return NET_ERR_MEM;
+    }
+    plat_memset(mem, 0, slot_size * NET_STATS_THREAD_MAX);
+
+    slot_cnt = 1;
+    slot_tbl = mem;
+    return NET_ERR_OK;
+}
+
+void net_stats_destroy (void) {
+    sys_mem_free(slot_tbl);
+    slot_tbl = (uint8_t *)0;
+#ifdef SYS_THREAD_LOCAL
+    curr_slot = (volatile uint64_t *)0;
+#endif
+}
+
+static void stats_add (int idx, uint64_t value) {
+    if (!slot_tbl) {
+        return;
+    }
+
+#ifdef SYS_THREAD_LOCAL
+    volatile uint64_t * slot = curr_slot;
+    if (!slot) {
+        int id = natomic_add(&slot_cnt, 1) - 1;
+        if (id >= NET_STATS_THREAD_MAX) {
+            id = 0;
+        }
+        slot = curr_slot = (volatile uint64_t *)(slot_tbl + id * slot_size);
+    }
+
+    if (slot != (volatile uint64_t *)slot_tbl) {
+        natomic_add64_local(slot + idx, value);
+        return;
+    }
+#endif
+
+    natomic_add64((volatile uint64_t *)slot_tbl + idx, value);
+}
+
+void net_stats_netif_add (netif_t * netif, net_stat_t stat, int value) {
+    stats_add(STATS_NETIF_IDX(netif->id, stat), value);
+}
+
+/**
+ * 网卡打开时清零其计数，不继承之前使用同一序号的网卡的计数
+ */
+void net_stats_netif_clear (netif_t * netif) {
+    if (!slot_tbl) {
+        return;
+    }
+
+    int cnt = natomic_load(&slot_cnt);
+    cnt = cnt > NET_STATS_THREAD_MAX ? NET_STATS_THREAD_MAX : cnt;
+
+    for (int i = 0; i < cnt; i++) {
+        volatile uint64_t * slot = (volatile uint64_t *)(slot_tbl + i * slot_size);
+        for (int j = 0; j < NET_STAT_CNT; j++) {
+            volatile uint64_t * v = slot + STATS_NETIF_IDX(netif->id, j);
+            natomic_add64(v, (uint64_t)0 - natomic_load64(v));
+        }
+    }
+}
+
+void net_stats_proto_add (net_stats_proto_t proto, net_stat_t stat, int value) {
+    stats_add(STATS_PROTO_IDX(proto, stat), value);
+}
+
+void net_stats_pool_inc (net_stats_pool_t stat) {
+    stats_add(STATS_POOL_IDX(stat), 1);
+}
+
+/**
+ * 累加所有线程的计数，可在任意线程中调用，期间各线程的计数仍在增加
+ */
+void net_stats_snapshot (net_stats_t * stats) {
+    plat_memset(stats, 0, sizeof(net_stats_t));
+    if (!slot_tbl) {
+        return;
+    }
+
+    int cnt = natomic_load(&slot_cnt);
+    cnt = cnt > NET_STATS_THREAD_MAX ? NET_STATS_THREAD_MAX : cnt;
+
+    uint64_t * total = (uint64_t *)stats;
+    for (int i = 0; i < cnt; i++) {
+        volatile uint64_t * slot = (volatile uint64_t *)(slot_tbl + i * slot_size);
+        for (int j = 0; j < STATS_COUNTER_CNT; j++) {
+            total[j] += natomic_load64(slot + j);
+        }
+    }
+}
+
+const char * net_stats_name (net_stat_t stat) {
+    static const char * name[] = {
+        [NET_STAT_RX_PKTS] = "rx_pkts",
+        [NET_STAT_RX_BYTES] = "rx_bytes",
+        [NET_STAT_TX_PKTS] = "tx_pkts",
+        [NET_STAT_TX_BYTES] = "tx_bytes",
+        [NET_STAT_RX_DROP_NOBUF] = "rx_drop_nobuf",
+        [NET_STAT_RX_DROP_QFULL] = "rx_drop_qfull",
+        [NET_STAT_RX_DROP_AQM] = "rx_drop_aqm",
+        [NET_STAT_RX_DROP_BAD] = "rx_drop_bad",
+        [NET_STAT_RX_DROP_LINK] = "rx_drop_link",
+        [NET_STAT_RX_DROP_FILTER] = "rx_drop_filter",
+        [NET_STAT_TX_DROP_QFULL] = "tx_drop_qfull",
+        [NET_STAT_TX_DROP_AQM] = "tx_drop_aqm",
+        [NET_STAT_TX_ERR] = "tx_err",
+    };
+
+    return ((stat >= 0) && (stat < NET_STAT_CNT)) ? name[stat] : "unknown";
+}
+
+const char * net_stats_pool_name (net_stats_pool_t stat) {
+    static const char * name[] = {
+        [NET_STAT_PKTBUF_EMPTY] = "pktbuf_empty",
+        [NET_STAT_PKTBLK_EMPTY] = "pktblk_empty",
+        [NET_STAT_EXMSG_EMPTY] = "exmsg_empty",
+        [NET_STAT_EXMSG_QFULL] = "exmsg_qfull",
+    };
+
+    return ((stat >= 0) && (stat < NET_STATS_POOL_CNT)) ? name[stat] : "unknown";
+}
@@ -4,6 +4,11 @@
 #include "exmsg.h"
 #include "protocol.h"
 #include "ether.h"
+#include "net_stats.h"
+#include "net_metrics.h"
+#include "net_lat.h"
+#include "loop.h"
+#include "net_gso.h"
 
 static netif_t netif_buffer[NETIF_DEV_CNT];
 static mblock_t netif_mblock;
@@ -11,6 +16,9 @@ static nlist_t netif_list;
 static netif_t * netif_default;
 
 static const link_layer_t * link_layers[NETIF_TYPE_SIZE];
+static uint32_t hash_seed;                  // 流哈希的随机初值，使外部难以构造冲突的流
+
+#define NETIF_PEEK_HDR      64              // 解析包头时读取的长度，含VLAN标签、IP包头及TCP标志
 
 #if DBG_DISP_ENABLE(DBG_NETIF)
 
@@ -43,6 +51,9 @@ void display_netif_list (void) {
             case NETIF_TYPE_LOOP:
                 plat_printf(" %s ", "loop");
                 break;
+            case NETIF_TYPE_VLAN:
+                plat_printf(" %s ", "vlan");
+                break;
             default:
                 plat_printf(" %s ", "unknown type");
                 break;
@@ -59,7 +70,7 @@ void display_netif_list (void) {
 
 #else
 
-#define display_netif_list () 
+#define display_netif_list()
 
 #endif
 
@@ -68,8 +79,10 @@ net_err_t netif_init (void) {
 
     nlist_init(&netif_list);
     mblock_init(&netif_mblock, netif_buffer, sizeof(netif_t), NETIF_DEV_CNT, NLOCKER_NONE);
+    net_metrics_add_pool("netif", &netif_mblock);
 
     netif_default = (netif_t *)0;
+    hash_seed = (uint32_t)sys_time_ns() * 0x9E3779B1u;
 
     plat_memset((void *)link_layers, 0, sizeof(link_layers));
 
@@ -108,6 +121,9 @@ netif_t * netif_open (const char * dev_name, const netif_ops_t * ops, void * ops
         return (netif_t *)0;
     }
 
+    netif->id = (int)(netif - netif_buffer);
+    net_stats_netif_clear(netif);
+    netif->state = NETIF_CLOSED;
     ipaddr_set_any(&netif->ipaddr);
     ipaddr_set_any(&netif->netmask);
     ipaddr_set_any(&netif->gateway);
@@ -118,20 +134,28 @@ netif_t * netif_open (const char * dev_name, const netif_ops_t * ops, void * ops
     plat_memset(&netif->hwaddr, 0, NETIF_HWADDR_SIZE);
     netif->type = NETIF_TYPE_NONE;
     netif->mtu = 0;
+    netif->rx_filter = (net_bpf_t *)0;
+    netif->rx_filter_idx = 0;
+    netif->rx_filter_seq = 0;
+    netif->tx_timer_on = 0;
     nlist_node_init(&netif->node);
 
-    net_err_t err = fixq_init(&netif->in_q, netif->in_q_buf, NET_INQ_SIZE, NLOCKER_THREAD);
+    qdisc_cfg_t cfg;
+    qdisc_cfg_init(&cfg, NET_INQ_QDISC, NET_INQ_SIZE, NET_INQ_BYTES);
+    net_err_t err = qdisc_init(&netif->in_q, netif, 0, &cfg);
     if (err < 0) {
-        dbg_error(DBG_NETIF, "fixq_init failed, err = %d", err);
+        dbg_error(DBG_NETIF, "qdisc_init failed, err = %d", err);
         mblock_free(&netif_mblock, netif);
         return (netif_t *)0;
     }
 
-
-    err = fixq_init(&netif->out_q, netif->out_q_buf, NET_OUTQ_SIZE, NLOCKER_THREAD);
+    qdisc_cfg_init(&cfg, NET_OUTQ_QDISC, NET_OUTQ_SIZE, NET_OUTQ_BYTES);
+    cfg.rate = NET_OUTQ_RATE;
+    cfg.burst = NET_OUTQ_BURST;
+    err = qdisc_init(&netif->out_q, netif, 1, &cfg);
     if (err < 0) {
-        dbg_error(DBG_NETIF, "fixq_init failed, err = %d", err);
-        fixq_destroy(&netif->in_q);
+        dbg_error(DBG_NETIF, "qdisc_init failed, err = %d", err);
+        qdisc_destroy(&netif->in_q);
         mblock_free(&netif_mblock, netif);
         return (netif_t *)0;
     }
@@ -167,9 +191,10 @@ netif_t * netif_open (const char * dev_name, const netif_ops_t * ops, void * ops
 free_return:
     if (netif->state == NETIF_OPENED) {
         netif->ops->close(netif);
+        netif->state = NETIF_CLOSED;
     }
-    fixq_destroy(&netif->in_q);
-    fixq_destroy(&netif->out_q);
+    qdisc_destroy(&netif->in_q);
+    qdisc_destroy(&netif->out_q);
     mblock_free(&netif_mblock, netif);
     return (netif_t *)0;
 }
@@ -222,14 +247,8 @@ net_err_t netif_set_deactive (netif_t * netif) {
         netif->link_layer->close(netif);
     }
 
-    pktbuf_t * buf;
-    while ((buf = fixq_recv(&netif->in_q, -1)) != (pktbuf_t *)0) {
-        pktbuf_free(buf);
-    }
-
-    while ((buf = fixq_recv(&netif->out_q, -1)) != (pktbuf_t *)0) {
-        pktbuf_free(buf);
-    }
+    qdisc_flush(&netif->in_q);
+    qdisc_flush(&netif->out_q);
     if (netif_default == netif) {
         netif_default = (netif_t *)0;
     }
@@ -239,14 +258,40 @@ net_err_t netif_set_deactive (netif_t * netif) {
     return NET_ERR_OK;
 }
 
+/**
+ * 切换过滤程序后调用，等待收包线程执行完切换前取得的程序，之后可以覆盖或释放它
+ */
+static void filter_sync (netif_t * netif) {
+    // 读-改-写操作，保证在切换指针之后读取
+    int seq = natomic_add(&netif->rx_filter_seq, 0);
+    if (!(seq & 1)) {
+        return;
+    }
+
+    while (natomic_load(&netif->rx_filter_seq) == seq) {
+        sys_sleep(1);
+    }
+}
+
 net_err_t netif_close (netif_t * netif) {
     if (netif->state == NETIF_ACTIVE) {
         dbg_error(DBG_NETIF, "netif is active, can't close");
         return NET_ERR_STATE;
     }
 
+    natomic_store_ptr((void * volatile *)&netif->rx_filter, (void *)0);
+    filter_sync(netif);
+    net_bpf_unload(netif->rx_filter_buf);
+    net_bpf_unload(netif->rx_filter_buf + 1);
+
     netif->ops->close(netif);
     netif->state = NETIF_CLOSED;
+    if (netif->tx_timer_on) {
+        net_timer_remove(&netif->tx_timer);
+        netif->tx_timer_on = 0;
+    }
+    qdisc_destroy(&netif->in_q);
+    qdisc_destroy(&netif->out_q);
 
     nlist_remove(&netif_list, &netif->node);
 
@@ -255,24 +300,167 @@ net_err_t netif_close (netif_t * netif) {
     return NET_ERR_OK;
 }
 
+/**
+ * 设置收包过滤程序，insn为0时取消过滤。新程序写入另一份后再切换，并等待收包线程
+ * 不再执行被替换的程序，下一次设置时可以覆盖它。不能在多个线程中同时设置
+ */
+net_err_t netif_set_filter (netif_t * netif, const net_bpf_insn_t * insn, int cnt) {
+    if (!insn) {
+        natomic_store_ptr((void * volatile *)&netif->rx_filter, (void *)0);
+        filter_sync(netif);
+        dbg_info(DBG_NETIF, "%s filter removed", netif->name);
+        return NET_ERR_OK;
+    }
+
+    net_bpf_t * filter = netif->rx_filter_buf + netif->rx_filter_idx;
+    net_err_t err = net_bpf_load(filter, insn, cnt);
+    if (err < 0) {
+        dbg_error(DBG_NETIF, "%s load filter failed", netif->name);
+        return err;
+    }
+
+    netif->rx_filter_idx ^= 1;
+    natomic_store_ptr((void * volatile *)&netif->rx_filter, filter);
+    filter_sync(netif);
+    dbg_info(DBG_NETIF, "%s filter set, %d insn", netif->name, cnt);
+    return NET_ERR_OK;
+}
+
 void netif_set_default (netif_t * netif) {
     netif_default = netif;
 }
 
-net_err_t netif_put_in (netif_t * netif, pktbuf_t * pktbuf, int ms) {
-    net_err_t err = fixq_send(&netif->in_q, pktbuf, ms);
+netif_t * netif_get (int id) {
+    if ((id < 0) || (id >= NETIF_DEV_CNT)) {
+        return (netif_t *)0;
+    }
+
+    netif_t * netif = netif_buffer + id;
+    return netif->state == NETIF_CLOSED ? (netif_t *)0 : netif;
+}
+
+/**
+ * 取以太网包头起的一段数据，跨越多个数据块时复制到hdr中
+ */
+static const uint8_t * netif_peek (pktbuf_t * buf, uint8_t * hdr, int * size) {
+    pktblk_t * blk = pktbuf_first_blk(buf);
+    if (!blk) {
+        *size = 0;
+        return hdr;
+    }
+
+    *size = blk->size;
+    if ((blk->size >= NETIF_PEEK_HDR) || (blk->size >= buf->total_size)) {
+        return blk->data;
+    }
+
+    *size = buf->total_size < NETIF_PEEK_HDR ? buf->total_size : NETIF_PEEK_HDR;
+    pktbuf_reset_acc(buf);
+    pktbuf_read(buf, hdr, *size);
+    pktbuf_reset_acc(buf);
+    return hdr;
+}
+
+/**
+ * 解析以太网帧的包头，填写各层的位置、协议及流哈希，支持一层VLAN标签。
+ * 流哈希：IPv4按地址、协议及TCP/UDP端口，其它按目的地址和协议类型
+ */
+void netif_parse_meta (netif_t * netif, pktbuf_t * buf) {
+    if ((netif->type != NETIF_TYPE_ETHER) && (netif->type != NETIF_TYPE_VLAN)) {
+        return;
+    }
+
+    uint8_t hdr[NETIF_PEEK_HDR];
+    int size;
+    const uint8_t * p = netif_peek(buf, hdr, &size);
+    if (size < 14) {
+        return;
+    }
+
+    pktbuf_meta_t * meta = &buf->meta;
+    meta->l2 = 0;
+    meta->l3 = 14;
+    meta->l4 = -1;
+    meta->l3_proto = (p[12] << 8) | p[13];
+    meta->l4_proto = 0;
+    meta->l4_flags = 0;
+    if ((meta->l3_proto == NET_PROTOCOL_VLAN) && (size >= 18)) {
+        meta->l3_proto = (p[16] << 8) | p[17];
+        meta->l3 = 18;
+    }
+
+    uint32_t h = hash_seed ^ meta->l3_proto;
+    if ((meta->l3_proto == NET_PROTOCOL_IPv4) && (size >= meta->l3 + 20)) {
+        const uint8_t * ip = p + meta->l3;
+        int ihl = (ip[0] & 0xF) * 4;
+        meta->l4_proto = ip[9];
+
+        h ^= ((uint32_t)ip[12] << 24) | (ip[13] << 16) | (ip[14] << 8) | ip[15];
+        h *= 0x9E3779B1u;
+        h ^= ((uint32_t)ip[16] << 24) | (ip[17] << 16) | (ip[18] << 8) | ip[19];
+        h *= 0x9E3779B1u;
+        h ^= ip[9];
+
+        // 非首个分片中没有传输层包头
+        int frag = ((ip[6] & 0x1F) << 8) | ip[7];
+        if (!frag && (ihl >= 20)) {
+            int l4 = meta->l3 + ihl;
+            meta->l4 = (int16_t)l4;
+            if (((ip[9] == NET_PROTOCOL_TCP) || (ip[9] == NET_PROTOCOL_UDP)) && (size >= l4 + 4)) {
+                h ^= ((uint32_t)p[l4] << 24) | (p[l4 + 1] << 16) | (p[l4 + 2] << 8) | p[l4 + 3];
+            }
+            if ((ip[9] == NET_PROTOCOL_TCP) && (size >= l4 + 14)) {
+                meta->l4_flags = p[l4 + 13];
+            }
+        }
+    } else {
+        h ^= ((uint32_t)p[2] << 24) | (p[3] << 16) | (p[4] << 8) | p[5];
+    }
+
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    meta->hash = h;
+    meta->flags |= PKTBUF_META_PARSED | PKTBUF_META_HASH;
+}
+
+/**
+ * 记录收包的网卡及时间，并解析包头，之后各层直接使用
+ */
+static void netif_rx_meta (netif_t * netif, pktbuf_t * buf) {
+    buf->meta.netif = netif;
+    if (!buf->meta.time) {
+        buf->meta.time = sys_time_ns();
+    }
+    if (!(buf->meta.flags & PKTBUF_META_PARSED)) {
+        netif_parse_meta(netif, buf);
+    }
+}
+
+/**
+ * 放入输入队列，不阻塞。失败时已计入丢弃统计，由调用者释放包
+ */
+net_err_t netif_put_in (netif_t * netif, pktbuf_t * pktbuf) {
+    int size = pktbuf_total(pktbuf);
+    netif_rx_meta(netif, pktbuf);
+    net_lat_hop(pktbuf, NET_LAT_RX);
+    net_err_t err = qdisc_enqueue(&netif->in_q, pktbuf);
     if (err < 0) {
         dbg_warning(DBG_NETIF, "netif_put_in failed");
-        return NET_ERR_FULL;
+        return err;
     }
 
+    net_stats_netif_add(netif, NET_STAT_RX_PKTS, 1);
+    net_stats_netif_add(netif, NET_STAT_RX_BYTES, size);
+
     exmsg_netif_in(netif);
     return NET_ERR_OK;
 }
 
 pktbuf_t * netif_get_in (netif_t * netif, int ms) {
-    pktbuf_t * pktbuf = fixq_recv(&netif->in_q, ms);
+    pktbuf_t * pktbuf = qdisc_dequeue(&netif->in_q, ms);
     if (pktbuf) {
+        net_lat_hop(pktbuf, NET_LAT_INQ);
         pktbuf_reset_acc(pktbuf);
         return pktbuf;
     }
@@ -281,19 +469,59 @@ pktbuf_t * netif_get_in (netif_t * netif, int ms) {
     return (pktbuf_t *)0;
 }
 
-net_err_t netif_put_out (netif_t * netif, pktbuf_t * pktbuf, int ms) {
-    net_err_t err = fixq_send(&netif->out_q, pktbuf, ms);
+/**
+ * 交给链路层处理，失败时释放包
+ */
+net_err_t netif_link_in (netif_t * netif, pktbuf_t * buf) {
+    if (!netif->link_layer) {
+        pktbuf_free(buf);
+        return NET_ERR_OK;
+    }
+
+    net_err_t err = netif->link_layer->in(netif, buf);
+    if (err < 0) {
+        net_stats_netif_add(netif, NET_STAT_RX_DROP_LINK, 1);
+        dbg_warning(DBG_NETIF, "link layer in failed");
+        pktbuf_free(buf);
+        return err;
+    }
+
+    return NET_ERR_OK;
+}
+
+/**
+ * 轮询模式的驱动在工作线程中调用，不经过输入队列和消息，直接交给链路层
+ */
+net_err_t netif_recv (netif_t * netif, pktbuf_t * buf) {
+    net_stats_netif_add(netif, NET_STAT_RX_PKTS, 1);
+    net_stats_netif_add(netif, NET_STAT_RX_BYTES, pktbuf_total(buf));
+    net_lat_hop(buf, NET_LAT_RX);
+    netif_rx_meta(netif, buf);
+    return netif_link_in(netif, buf);
+}
+
+/**
+ * 放入输出队列，不阻塞，发送慢的网卡不会使工作线程停顿。失败时已计入丢弃统计，由调用者释放包
+ */
+net_err_t netif_put_out (netif_t * netif, pktbuf_t * pktbuf) {
+    int size = pktbuf_total(pktbuf);
+    net_lat_out(pktbuf);
+    net_err_t err = qdisc_enqueue(&netif->out_q, pktbuf);
     if (err < 0) {
         dbg_warning(DBG_NETIF, "netif_put_out failed");
-        return NET_ERR_FULL;
+        return err;
     }
 
+    net_stats_netif_add(netif, NET_STAT_TX_PKTS, 1);
+    net_stats_netif_add(netif, NET_STAT_TX_BYTES, size);
+
     return NET_ERR_OK;
 }
 
 pktbuf_t * netif_get_out (netif_t * netif, int ms) {
-    pktbuf_t * pktbuf = fixq_recv(&netif->out_q, ms);
+    pktbuf_t * pktbuf = qdisc_dequeue(&netif->out_q, ms);
     if (pktbuf) {
+        net_lat_hop(pktbuf, NET_LAT_OUTQ);
         pktbuf_reset_acc(pktbuf);
         return pktbuf;
     }
@@ -302,7 +530,49 @@ pktbuf_t * netif_get_out (netif_t * netif, int ms) {
     return (pktbuf_t *)0;
 }
 
-net_err_t netif_out(netif_t * netif, ipaddr_t * ipaddr, pktbuf_t * buf) {
+static void tx_timer_proc (net_timer_t * timer, void * arg) {
+    netif_t * netif = (netif_t *)arg;
+    netif->tx_timer_on = 0;
+    if (netif->state == NETIF_ACTIVE) {
+        netif_xmit(netif);
+    }
+}
+
+/**
+ * 通知驱动发送输出队列中的包，在工作线程中调用。输出队列被限速、有包留在队列中时，
+ * 用定时器在可以发送时再次通知；有发送线程的驱动自己等待，定时器只是多通知一次
+ */
+net_err_t netif_xmit (netif_t * netif) {
+    net_err_t err = netif->ops->xmit(netif);
+
+    int ms = qdisc_next_ms(&netif->out_q);
+    if (ms && !netif->tx_timer_on) {
+        netif->tx_timer_on = 1;
+        net_timer_add(&netif->tx_timer, netif->name, tx_timer_proc, netif, ms, 0);
+    }
+    return err;
+}
+
+/**
+ * 查找配置了该地址的已激活网卡
+ */
+netif_t * netif_find_addr (const ipaddr_t * ip) {
+    if (ip->q_addr == 0) {
+        return (netif_t *)0;
+    }
+
+    nlist_node_t * node;
+    nlist_for_each(node, &netif_list) {
+        netif_t * netif = nlist_entry(node, netif_t, node);
+        if ((netif->state == NETIF_ACTIVE) && ipaddr_is_equal(&netif->ipaddr, ip)) {
+            return netif;
+        }
+    }
+
+    return (netif_t *)0;
+}
+
+static net_err_t netif_out_frame (netif_t * netif, ipaddr_t * ipaddr, pktbuf_t * buf) {
     if (netif->link_layer) {
         net_err_t err = netif->link_layer->out(netif, ipaddr, buf);
         
@@ -313,12 +583,57 @@ net_err_t netif_out(netif_t * netif, ipaddr_t * ipaddr, pktbuf_t * buf) {
 
         return NET_ERR_OK;
     } else {
-        net_err_t err = netif_put_out(netif, buf, -1);
+        net_err_t err = netif_put_out(netif, buf);
         if (err < 0) {
             dbg_info(DBG_NETIF, "send failed");
             return err;
         }
     }
 
-    return netif->ops->xmit(netif);
+    return netif_xmit(netif);
+}
+
+#if NET_GSO_ENABLE
+/**
+ * 分段后逐个发送，原包在分段后释放；发送失败的段直接丢弃
+ */
+static net_err_t netif_gso_out (netif_t * netif, ipaddr_t * ipaddr, pktbuf_t * buf) {
+    nlist_t list;
+    net_err_t err = net_gso_segment(buf, netif->mtu, &list);
+    if (err < 0) {
+        return err;
+    }
+    pktbuf_free(buf);
+
+    nlist_node_t * node;
+    while ((node = nlist_remove_first(&list))) {
+        pktbuf_t * seg = nlist_entry(node, pktbuf_t, node);
+        if (netif_out_frame(netif, ipaddr, seg) < 0) {
+            dbg_warning(DBG_NETIF, "segment send failed");
+            pktbuf_free(seg);
+        }
+    }
+    return NET_ERR_OK;
+}
+#endif
+
+net_err_t netif_out(netif_t * netif, ipaddr_t * ipaddr, pktbuf_t * buf) {
+    // 发往本机的包直接交给接收网卡的协议输入
+    netif_t * local = loop_find(ipaddr);
+    if (local) {
+        return loop_deliver(netif, local, NET_PROTOCOL_IPv4, buf);
+    }
+
+#if NET_GSO_ENABLE
+    if (netif->mtu && (pktbuf_total(buf) > netif->mtu)) {
+        return netif_gso_out(netif, ipaddr, buf);
+    }
+#endif
+
+    // 上层未计算的校验和在交给链路层前填入，分段时各段单独计算
+    net_err_t err = net_gso_csum(buf);
+    if (err < 0) {
+        return err;
+    }
+    return netif_out_frame(netif, ipaddr, buf);
 }
\ No newline at end of file
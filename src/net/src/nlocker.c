@@ -2,12 +2,9 @@
 
 net_err_t nlocker_init (nlocker_t * locker, nlocker_type_t type) {
     if (type == NLOCKER_THREAD) {
-        sys_mutex_t mutex = sys_mutex_create();
-        if (mutex == SYS_MUTEx_INVALID) {
+        if (sys_mutex_init(&locker->mutex) < 0) {
             return NET_ERR_SYS;
         }
-
-        locker->mutex = mutex;
     }
     locker->type = type;
     return NET_ERR_OK;
@@ -16,20 +13,20 @@ net_err_t nlocker_init (nlocker_t * locker, nlocker_type_t type) {
 
 void nlocker_destroy (nlocker_t * locker) {
     if (locker->type == NLOCKER_THREAD) {
-        sys_mutex_free(locker->mutex);
+        sys_mutex_destroy(&locker->mutex);
     }
 }
 
 
 void nlocker_lock (nlocker_t * locker) {
     if (locker->type == NLOCKER_THREAD) {
-        sys_mutex_lock(locker->mutex);
+        sys_mutex_lock(&locker->mutex);
     }
 }
 
 
 void nlocker_unlock (nlocker_t * locker) {
     if (locker->type == NLOCKER_THREAD) {
-        sys_mutex_unlock(locker->mutex);
+        sys_mutex_unlock(&locker->mutex);
     }
 }
\ No newline at end of file
@@ -1,13 +1,20 @@
 #include "pktbuf.h"
 #include "dbg.h"
 #include "mblock.h"
-#include "nlocker.h"
-
-static nlocker_t locker;
-static pktblk_t block_buffer[PKTBUF_BLK_CNT];
-static mblock_t block_list;
-static pktbuf_t pktbuf_buffer[PKTBUF_BUF_CNT];
-static mblock_t pktbuf_list;
+#include "natomic.h"
+#include "net.h"
+#include "net_stats.h"
+#include "net_metrics.h"
+#include "sys.h"
+#include "tools.h"
+
+static mblock_t block_list[NET_NUMA_NODE_MAX];      // 每个NUMA节点一组内存池
+static mblock_t pktbuf_list[NET_NUMA_NODE_MAX];
+static int pool_cnt;
+
+#ifdef SYS_THREAD_LOCAL
+static SYS_THREAD_LOCAL int local_node;             // 当前线程优先使用的节点序号+1，0-尚未确定
+#endif
 
 static inline int total_blk_remain (pktbuf_t * buf) {
     return buf->total_size - buf->pos;
@@ -22,8 +29,33 @@ static inline int curr_blk_remain (pktbuf_t * buf) {
     return (int)(blk->data + blk->size - buf->blk_offset);
 }
 
+static inline uint8_t * pktblk_payload (pktblk_t * blk) {
+    return blk->owner ? blk->owner->base : blk->base;
+}
+
+static inline int pktblk_is_shared (pktblk_t * blk) {
+    return blk->owner || (natomic_load(&blk->ref) > 1) || (blk->base != blk->payload);
+}
+
+// 引用外部数据的数据块不使用payload，在其中保存释放函数
+typedef struct _pktblk_ext_t {
+    pktbuf_free_fn_t free_fn;
+    void * ctx;
+}pktblk_ext_t;
+
+// 数据在外部内存中，大小不受数据块的限制
+static inline int pktblk_is_ref (pktblk_t * blk) {
+    pktblk_t * owner = blk->owner ? blk->owner : blk;
+    return owner->base != owner->payload;
+}
+
 static inline int curr_blk_tail_free (pktblk_t * blk) {
-    return (int)(blk->payload + PKTBUF_BLK_SIZE - (blk->data + blk->size));
+    return (int)(pktblk_payload(blk) + PKTBUF_BLK_SIZE - (blk->data + blk->size));
+}
+
+static inline void pktbuf_layout_changed (pktbuf_t * buf) {
+    buf->idx_cnt = 0;
+    pktbuf_reset_acc(buf);
 }
 
 #if DBG_DISP_ENABLE(DBG_BUF)
@@ -38,12 +70,19 @@ static void display_check_buf (pktbuf_t * buf) {
     int index = 0, total_size = 0;
     for (curr = pktbuf_first_blk(buf); curr; curr = pktblk_blk_next(curr)) {
         plat_printf("%d: ", index++);
+        total_size += curr->size;
+
+        if (pktblk_is_ref(curr)) {
+            plat_printf("ref: %d b\n", curr->size);
+            continue;
+        }
 
-        if (curr->data < curr->payload || (curr->data >= curr->payload + PKTBUF_BLK_SIZE)) {
+        uint8_t * payload = pktblk_payload(curr);
+        if (curr->data < payload || (curr->data >= payload + PKTBUF_BLK_SIZE)) {
             dbg_error(DBG_BUF, "pktblk %p data is out of range", curr);
         }
 
-        int pre_size = (int)(curr->data - curr->payload);
+        int pre_size = (int)(curr->data - payload);
         plat_printf("pre: %d b, ", pre_size);
 
         int used_size = curr->size;
@@ -56,8 +95,6 @@ static void display_check_buf (pktbuf_t * buf) {
         if (blk_total != PKTBUF_BLK_SIZE) {
             dbg_error(DBG_BUF, "bad blk size! < blk_total: %d != PKTBUF_BLK_SIZE: %d >\n", blk_total, PKTBUF_BLK_SIZE);
         }
-
-        total_size += used_size;
     }
     
     if (total_size != buf->total_size) {
@@ -68,34 +105,146 @@ static void display_check_buf (pktbuf_t * buf) {
 #define display_check_buf(buf)
 #endif
 
+/**
+ * 当前线程优先使用的内存池。首次分配时按所在的CPU确定，线程应绑定到节点内的CPU上
+ */
+static int pool_local (void) {
+#ifdef SYS_THREAD_LOCAL
+    if (pool_cnt == 1) {
+        return 0;
+    }
+
+    if (local_node == 0) {
+        int node = sys_numa_node_curr();
+        local_node = ((node >= 0) && (node < pool_cnt) ? node : 0) + 1;
+    }
+    return local_node - 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * 优先从本地节点分配，用完后再依次尝试其它节点
+ */
+static void * pool_alloc (mblock_t * list, int * pool) {
+    int local = pool_local();
+    for (int i = 0; i < pool_cnt; i++) {
+        int node = (local + i) % pool_cnt;
+        void * blk = mblock_alloc(list + node, -1);
+        if (blk) {
+            *pool = node;
+            return blk;
+        }
+    }
+
+    return (void *)0;
+}
+
+/**
+ * 指定当前线程分配包缓存时优先使用的NUMA节点，小于0时按所在的CPU重新确定
+ */
+void pktbuf_set_node (int node) {
+#ifdef SYS_THREAD_LOCAL
+    local_node = (node >= 0) && (node < pool_cnt) ? node + 1 : 0;
+#endif
+}
+
 net_err_t pktbuf_init(void) {
+    static char pool_name[NET_NUMA_NODE_MAX][2][16];
+
     dbg_info(DBG_BUF, "pktbuf init");
-    nlocker_init(&locker, NLOCKER_THREAD);
 
-    mblock_init(&block_list, block_buffer, sizeof(pktblk_t), PKTBUF_BLK_CNT, NLOCKER_NONE);
-    mblock_init(&pktbuf_list, pktbuf_buffer, sizeof(pktbuf_t), PKTBUF_BUF_CNT, NLOCKER_NONE);
+    const net_pool_cfg_t * cfg = net_pool_cfg_get();
+    pool_cnt = sys_numa_node_cnt();
+    if (pool_cnt > NET_NUMA_NODE_MAX) {
+        pool_cnt = NET_NUMA_NODE_MAX;
+    }
+
+    for (int i = 0; i < pool_cnt; i++) {
+        // 只有一个节点时不指定，保持原有的分配方式
+        int mem_flags = cfg->mem_flags | (pool_cnt > 1 ? SYS_MEM_NODE(i) : 0);
+
+        net_err_t err = mblock_create(block_list + i, sizeof(pktblk_t), cfg->pktbuf_blk_cnt, NLOCKER_THREAD, mem_flags);
+        if (err < 0) {
+            dbg_error(DBG_BUF, "create block list failed");
+            pool_cnt = i;
+            pktbuf_destroy();
+            return err;
+        }
+        mblock_set_grow(block_list + i, cfg->pktbuf_slab_cnt, cfg->pktbuf_blk_max);
+
+        err = mblock_create(pktbuf_list + i, sizeof(pktbuf_t), cfg->pktbuf_buf_cnt, NLOCKER_THREAD, mem_flags);
+        if (err < 0) {
+            dbg_error(DBG_BUF, "create pktbuf list failed");
+            mblock_destroy(block_list + i);
+            pool_cnt = i;
+            pktbuf_destroy();
+            return err;
+        }
+        mblock_set_grow(pktbuf_list + i, cfg->pktbuf_slab_cnt, cfg->pktbuf_buf_max);
 
-    dbg_info(DBG_BUF, "pktbuf init ok");
+        if (pool_cnt > 1) {
+            plat_sprintf(pool_name[i][0], "pktblk%d", i);
+            plat_sprintf(pool_name[i][1], "pktbuf%d", i);
+            net_metrics_add_pool(pool_name[i][0], block_list + i);
+            net_metrics_add_pool(pool_name[i][1], pktbuf_list + i);
+        } else {
+            net_metrics_add_pool("pktblk", block_list);
+            net_metrics_add_pool("pktbuf", pktbuf_list);
+        }
+    }
+
+    dbg_info(DBG_BUF, "pktbuf init ok, %d numa pool(s)", pool_cnt);
     return NET_ERR_OK;
 }
 
+void pktbuf_destroy (void) {
+    for (int i = 0; i < pool_cnt; i++) {
+        mblock_destroy(block_list + i);
+        mblock_destroy(pktbuf_list + i);
+    }
+    pool_cnt = 0;
+}
+
 static pktblk_t * pktblock_alloc(void) { 
-    nlocker_lock(&locker);
-    pktblk_t * block = (pktblk_t *)mblock_alloc(&block_list, -1);
-    nlocker_unlock(&locker);
+    int pool = 0;
+    pktblk_t * block = (pktblk_t *)pool_alloc(block_list, &pool);
     if (block) {
+        block->pool = pool;
         block->size = 0;
         block->data = (uint8_t *)0;
+        block->ref = 1;
+        block->owner = (pktblk_t *)0;
+        block->base = block->payload;
         nlist_node_init(&block->node);
+    } else {
+        net_stats_pool_inc(NET_STAT_PKTBLK_EMPTY);
     }
 
     return block;
 }
 
+static void pktblock_put(pktblk_t * block) {
+    if (natomic_add(&block->ref, -1)) {
+        return;
+    }
+
+    if (block->base != block->payload) {
+        pktblk_ext_t * ext = (pktblk_ext_t *)block->payload;
+        ext->free_fn(ext->ctx, block->base);
+    }
+
+    mblock_free(block_list + block->pool, block);
+}
+
 static void pktblock_free(pktblk_t * block) { 
-    nlocker_lock(&locker);
-    mblock_free(&block_list, block);
-    nlocker_unlock(&locker);
+    pktblk_t * owner = block->owner;
+
+    pktblock_put(block);
+    if (owner) {
+        pktblock_put(owner);
+    }
 }
 
 static void pktblk_free_list (pktblk_t * first) {
@@ -185,31 +334,33 @@ static void pktbuf_insert_blk_list (pktbuf_t * buf, pktblk_t * first_blk, int ad
 }
 
 void pktbuf_inc_ref(pktbuf_t * buf) {
-    nlocker_lock(&locker);
-    buf->ref++;
-    nlocker_unlock(&locker);
+    natomic_add(&buf->ref, 1);
 }
 
 pktbuf_t * pktbuf_alloc(int size) {
-    nlocker_lock(&locker);
-    pktbuf_t * buf = mblock_alloc(&pktbuf_list, -1);
-    nlocker_unlock(&locker);
+    int pool = 0;
+    pktbuf_t * buf = pool_alloc(pktbuf_list, &pool);
     if (!buf) {
+        net_stats_pool_inc(NET_STAT_PKTBUF_EMPTY);
         dbg_error(DBG_BUF, "pktbuf_alloc: no memory");
         return (pktbuf_t *)0;
     }
 
     buf->total_size = 0;
     buf->ref = 1;
+    buf->pool = pool;
+    buf->idx_cnt = 0;
+#if NET_LAT_ENABLE
+    buf->lat_hop = 0;
+#endif
+    pktbuf_meta_init(buf);
     nlist_init(&buf->blk_list);
     nlist_node_init(&buf->node);
 
     if (size > 0) {
         pktblk_t * block = pktblock_alloc_list(size, 1);
         if (!block) {
-            nlocker_lock(&locker);
-            mblock_free(&pktbuf_list, buf);
-            nlocker_unlock(&locker);
+            mblock_free(pktbuf_list + buf->pool, buf);
             return (pktbuf_t *)0;
         }
 
@@ -223,24 +374,164 @@ pktbuf_t * pktbuf_alloc(int size) {
 }
 
 void pktbuf_free(pktbuf_t * pktbuf) {
-    nlocker_lock(&locker);
-    if (--pktbuf->ref == 0) {
+    if (natomic_add(&pktbuf->ref, -1) == 0) {
         pktblk_free_list(pktbuf_first_blk(pktbuf));
-        mblock_free(&pktbuf_list, pktbuf);
+        mblock_free(pktbuf_list + pktbuf->pool, pktbuf);
+    }
+}
+
+void pktbuf_meta_init (pktbuf_t * buf) {
+    plat_memset(&buf->meta, 0, sizeof(pktbuf_meta_t));
+    buf->meta.l2 = buf->meta.l3 = buf->meta.l4 = -1;
+}
+
+/**
+ * 在头部加入或去掉size字节后调整各层包头的位置，被去掉的包头置为-1
+ */
+static void pktbuf_meta_shift (pktbuf_t * buf, int size) {
+    int16_t * off[] = {&buf->meta.l2, &buf->meta.l3, &buf->meta.l4};
+    for (int i = 0; i < (int)(sizeof(off) / sizeof(off[0])); i++) {
+        if (*off[i] >= 0) {
+            *off[i] = (*off[i] + size >= 0) ? (int16_t)(*off[i] + size) : -1;
+        }
+    }
+}
+
+pktbuf_t * pktbuf_clone(pktbuf_t * src) {
+    dbg_assert(src->ref != 0, "buf->ref = 0");
+    pktbuf_t * buf = pktbuf_alloc(0);
+    if (!buf) {
+        dbg_error(DBG_BUF, "pktbuf_clone: no memory");
+        return (pktbuf_t *)0;
+    }
+
+    for (pktblk_t * curr = pktbuf_first_blk(src); curr; curr = pktblk_blk_next(curr)) {
+        int pool = 0;
+        pktblk_t * block = (pktblk_t *)pool_alloc(block_list, &pool);
+        if (!block) {
+            net_stats_pool_inc(NET_STAT_PKTBLK_EMPTY);
+            dbg_error(DBG_BUF, "pktbuf_clone: no memory");
+            pktbuf_free(buf);
+            return (pktbuf_t *)0;
+        }
+
+        block->pool = pool;
+        block->owner = curr->owner ? curr->owner : curr;
+        natomic_add(&block->owner->ref, 1);
+        block->ref = 1;
+        block->base = block->payload;
+        block->size = curr->size;
+        block->data = curr->data;
+        nlist_node_init(&block->node);
+
+        nlist_insert_last(&buf->blk_list, &block->node);
+        buf->total_size += block->size;
+    }
+
+    buf->meta = src->meta;
+    pktbuf_reset_acc(buf);
+    pktbuf_seek(buf, src->pos);
+    display_check_buf(buf);
+    return buf;
+}
+
+/**
+ * 超过一个数据块大小的共享数据复制到新分配的多个数据块中，替换原数据块
+ */
+static net_err_t pktbuf_unshare_split (pktbuf_t * buf, pktblk_t * blk) {
+    pktblk_t * list = pktblock_alloc_list(blk->size, 0);
+    if (!list) {
+        dbg_error(DBG_BUF, "pktbuf_unshare_split: no memory");
+        return NET_ERR_MEM;
+    }
+
+    int curr_offset = (buf->curr_blk == blk) ? (int)(buf->blk_offset - blk->data) : -1;
+    uint8_t * data = blk->data;
+    nlist_node_t * pre = &blk->node;
+    while (list) {
+        pktblk_t * next = pktblk_blk_next(list);
+        plat_memcpy(list->data, data, list->size);
+        nlist_insert_after(&buf->blk_list, pre, &list->node);
+
+        if ((curr_offset >= 0) && (curr_offset < list->size)) {
+            buf->curr_blk = list;
+            buf->blk_offset = list->data + curr_offset;
+        } else if (curr_offset >= 0) {
+            buf->blk_pos += list->size;
+        }
+        curr_offset -= list->size;
+
+        data += list->size;
+        pre = &list->node;
+        list = next;
+    }
+
+    nlist_remove(&buf->blk_list, &blk->node);
+    pktblock_free(blk);
+    buf->idx_cnt = 0;
+    return NET_ERR_OK;
+}
+
+static net_err_t pktbuf_unshare_blk (pktbuf_t * buf, pktblk_t * blk) {
+    if (!pktblk_is_shared(blk)) {
+        return NET_ERR_OK;
+    }
+
+    if (blk->size > PKTBUF_BLK_SIZE) {
+        return pktbuf_unshare_split(buf, blk);
+    }
+
+    // 被其它数据块共享或引用外部数据时复制到新的数据块中，原数据块由最后的引用者释放
+    pktblk_t * owner = blk->owner;
+    pktblk_t * dest = blk;
+    if (!owner && ((natomic_load(&blk->ref) > 1) || pktblk_is_ref(blk))) {
+        dest = pktblock_alloc();
+        if (!dest) {
+            dbg_error(DBG_BUF, "pktbuf_unshare_blk: no memory");
+            return NET_ERR_MEM;
+        }
+
+        owner = blk;
+        nlist_insert_after(&buf->blk_list, &blk->node, &dest->node);
+        nlist_remove(&buf->blk_list, &blk->node);
+        buf->idx_cnt = 0;
+    }
+
+    // 引用外部内存的数据块中，数据的位置可能超出一个数据块
+    int offset = (int)(blk->data - pktblk_payload(blk));
+    if (offset + blk->size > PKTBUF_BLK_SIZE) {
+        offset = PKTBUF_BLK_SIZE - blk->size;
+    }
+    uint8_t * data = dest->payload + offset;
+    plat_memcpy(data, blk->data, blk->size);
+    if (buf->curr_blk == blk) {
+        buf->curr_blk = dest;
+        buf->blk_offset = data + (buf->blk_offset - blk->data);
     }
-    nlocker_unlock(&locker);
+
+    dest->data = data;
+    dest->size = blk->size;
+    dest->base = dest->payload;
+    dest->owner = (pktblk_t *)0;
+    if (owner) {
+        pktblock_put(owner);
+    }
+    return NET_ERR_OK;
 }
 
 net_err_t pktbuf_add_header(pktbuf_t * buf, int size, int cont) {
     dbg_assert(buf->ref != 0, "buf->ref = 0");
     pktblk_t * block = pktbuf_first_blk(buf);
+    int hdr_size = size;
 
-    int resv_size = (int)(block->data - block->payload);
+    int resv_size = pktblk_is_shared(block) ? 0 : (int)(block->data - block->payload);
     if (size <= resv_size) {
         block->size += size;
         block->data -= size;
         buf->total_size += size;
 
+        pktbuf_meta_shift(buf, hdr_size);
+        pktbuf_layout_changed(buf);
         display_check_buf(buf);
         return NET_ERR_OK;
     }
@@ -258,7 +549,7 @@ net_err_t pktbuf_add_header(pktbuf_t * buf, int size, int cont) {
         }
 
     } else {
-        block->data = block->payload;
+        block->data -= resv_size;
         block->size += resv_size;
         buf->total_size += resv_size;
         size -= resv_size;
@@ -272,6 +563,8 @@ net_err_t pktbuf_add_header(pktbuf_t * buf, int size, int cont) {
     }
 
     pktbuf_insert_blk_list(buf, block, 0);
+    pktbuf_meta_shift(buf, hdr_size);
+    pktbuf_layout_changed(buf);
     display_check_buf(buf);
     return NET_ERR_OK;
 }
@@ -279,6 +572,7 @@ net_err_t pktbuf_add_header(pktbuf_t * buf, int size, int cont) {
 net_err_t pktbuf_remove_header(pktbuf_t * buf, int size) {
     dbg_assert(buf->ref != 0, "buf->ref = 0");
     pktblk_t * block = pktbuf_first_blk(buf);
+    pktbuf_meta_shift(buf, -size);
     while (size) {
         pktblk_t * next_block = pktblk_blk_next(block);
 
@@ -300,6 +594,7 @@ net_err_t pktbuf_remove_header(pktbuf_t * buf, int size) {
         block = next_block;
     }
 
+    pktbuf_layout_changed(buf);
     display_check_buf(buf);
     return NET_ERR_OK;
 }
@@ -326,7 +621,7 @@ net_err_t pktbuf_resize (pktbuf_t * buf, int to_size) {
         pktblk_t * tail_block = pktbuf_last_blk(buf);
 
         int inc_size = to_size - buf->total_size;
-        int remain_size = curr_blk_tail_free(tail_block);
+        int remain_size = pktblk_is_shared(tail_block) ? 0 : curr_blk_tail_free(tail_block);
 
         if (remain_size >= inc_size) {
             tail_block->size += inc_size;
@@ -373,6 +668,7 @@ net_err_t pktbuf_resize (pktbuf_t * buf, int to_size) {
 
     }
 
+    pktbuf_layout_changed(buf);
     display_check_buf(buf);
     return NET_ERR_OK;
 }
@@ -388,10 +684,68 @@ net_err_t pktbuf_join (pktbuf_t * dest, pktbuf_t * src) {
     }
 
     pktbuf_free(src);
+    pktbuf_layout_changed(dest);
     display_check_buf(dest);
     return NET_ERR_OK;
 }
 
+/**
+ * 将src中从offset起的size字节以共享数据块的方式加到dest尾部，不复制数据。
+ * 失败时dest中可能已加入部分数据块，由调用者释放dest
+ */
+net_err_t pktbuf_share (pktbuf_t * dest, pktbuf_t * src, int offset, int size) {
+    dbg_assert(dest->ref != 0, "buf->ref = 0");
+    dbg_assert(src->ref != 0, "buf->ref = 0");
+    if ((offset < 0) || (size < 0) || (offset + size > src->total_size)) {
+        dbg_error(DBG_BUF, "pktbuf_share: bad range, offset: %d, size: %d", offset, size);
+        return NET_ERR_SIZE;
+    }
+
+    if (size == 0) {
+        return NET_ERR_OK;
+    }
+
+    pktbuf_seek(src, offset);
+    pktblk_t * curr = src->curr_blk;
+    uint8_t * data = src->blk_offset;
+
+    net_err_t err = NET_ERR_OK;
+    while (size) {
+        int curr_size = (int)(curr->data + curr->size - data);
+        curr_size = size > curr_size ? curr_size : size;
+        if (curr_size) {
+            int pool = 0;
+            pktblk_t * block = (pktblk_t *)pool_alloc(block_list, &pool);
+            if (!block) {
+                net_stats_pool_inc(NET_STAT_PKTBLK_EMPTY);
+                dbg_error(DBG_BUF, "pktbuf_share: no memory");
+                err = NET_ERR_MEM;
+                break;
+            }
+
+            block->pool = pool;
+            block->owner = curr->owner ? curr->owner : curr;
+            natomic_add(&block->owner->ref, 1);
+            block->ref = 1;
+            block->base = block->payload;
+            block->size = curr_size;
+            block->data = data;
+            nlist_node_init(&block->node);
+
+            nlist_insert_last(&dest->blk_list, &block->node);
+            dest->total_size += curr_size;
+            size -= curr_size;
+        }
+
+        curr = pktblk_blk_next(curr);
+        data = curr ? curr->data : (uint8_t *)0;
+    }
+
+    pktbuf_layout_changed(dest);
+    display_check_buf(dest);
+    return err;
+}
+
 net_err_t pktbuf_set_cont(pktbuf_t * buf, int size) {
     dbg_assert(buf->ref != 0, "buf->ref = 0");
     if (size > buf->total_size) {
@@ -410,6 +764,12 @@ net_err_t pktbuf_set_cont(pktbuf_t * buf, int size) {
         return NET_ERR_OK;
     }
 
+    net_err_t err = pktbuf_unshare_blk(buf, first_blk);
+    if (err < 0) {
+        return err;
+    }
+    first_blk = pktbuf_first_blk(buf);
+
     uint8_t * dest = first_blk->payload;
     for (int i = 0; i < first_blk->size; i++ ) {
         *dest++ = first_blk->data[i];
@@ -438,6 +798,7 @@ net_err_t pktbuf_set_cont(pktbuf_t * buf, int size) {
 
     }
 
+    pktbuf_layout_changed(buf);
     display_check_buf(buf);
     return NET_ERR_OK;
 }
@@ -446,6 +807,7 @@ void pktbuf_reset_acc(pktbuf_t * buf) {
     dbg_assert(buf->ref != 0, "buf->ref = 0");
     if (buf) {
         buf->pos = 0;
+        buf->blk_pos = 0;
         buf->curr_blk = pktbuf_first_blk(buf);
         buf->blk_offset = buf->curr_blk ? buf->curr_blk->data : (uint8_t *)0;
     }
@@ -458,6 +820,7 @@ static void move_forward(pktbuf_t * buf, int size) {
 
     pktblk_t * curr_blk = buf->curr_blk;
     if (buf->blk_offset >= curr_blk->data + curr_blk->size) {
+        buf->blk_pos += curr_blk->size;
         buf->curr_blk = pktblk_blk_next(curr_blk);
         if (buf->curr_blk) {
             buf->blk_offset = buf->curr_blk->data;
@@ -480,6 +843,11 @@ net_err_t pktbuf_write(pktbuf_t * buf, uint8_t * src, int size) {
     }
 
     while (size) {
+        net_err_t err = pktbuf_unshare_blk(buf, buf->curr_blk);
+        if (err < 0) {
+            return err;
+        }
+
         int blk_size = curr_blk_remain(buf);
 
         int curr_copy = size > blk_size ? blk_size : size;
@@ -507,6 +875,11 @@ net_err_t pktbuf_fill(pktbuf_t * buf, uint8_t value, int size) {
     }
 
     while (size) {
+        net_err_t err = pktbuf_unshare_blk(buf, buf->curr_blk);
+        if (err < 0) {
+            return err;
+        }
+
         int blk_size = curr_blk_remain(buf);
 
         int curr_fill = size > blk_size ? blk_size : size;
@@ -547,6 +920,41 @@ net_err_t pktbuf_read (pktbuf_t * buf, uint8_t * dest, int size) {
     return NET_ERR_OK;
 }
 
+static void pktbuf_build_idx (pktbuf_t * buf) {
+    int blk_cnt = nlist_count(&buf->blk_list);
+    int stride = (blk_cnt + PKTBUF_IDX_SIZE - 1) / PKTBUF_IDX_SIZE;
+
+    int index = 0, offset = 0;
+    buf->idx_cnt = 0;
+    for (pktblk_t * curr = pktbuf_first_blk(buf); curr; curr = pktblk_blk_next(curr), index++) {
+        if ((index % stride) == 0) {
+            pktbuf_idx_t * idx = buf->idx + buf->idx_cnt++;
+            idx->blk = curr;
+            idx->offset = offset;
+        }
+
+        offset += curr->size;
+    }
+}
+
+static pktbuf_idx_t * pktbuf_find_idx (pktbuf_t * buf, int offset) {
+    if (buf->idx_cnt == 0) {
+        pktbuf_build_idx(buf);
+    }
+
+    int low = 0, high = buf->idx_cnt - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (buf->idx[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return buf->idx + low;
+}
+
 net_err_t pktbuf_seek(pktbuf_t * buf, int offset) {
     dbg_assert(buf->ref != 0, "buf->ref = 0");
     if (buf->pos == offset) {
@@ -557,25 +965,44 @@ net_err_t pktbuf_seek(pktbuf_t * buf, int offset) {
         return NET_ERR_SIZE;
     }
 
-    int move_bytes;
-    if (offset < buf->pos) {
-        buf->curr_blk = pktbuf_first_blk(buf);
-        buf->blk_offset = buf->curr_blk->data;
-        buf->pos = 0;
-
-        move_bytes = offset;
-    } else {
-        move_bytes = offset - buf->pos;
+    if (offset == buf->total_size) {
+        buf->pos = offset;
+        buf->blk_pos = offset;
+        buf->curr_blk = (pktblk_t *)0;
+        buf->blk_offset = (uint8_t *)0;
+        return NET_ERR_OK;
     }
 
-    while (move_bytes) {
-        int remain_size = curr_blk_remain(buf);
-        int curr_move = move_bytes > remain_size ? remain_size : move_bytes;
-        
-        move_forward(buf, curr_move);
-        move_bytes -= curr_move;
+    pktblk_t * blk = buf->curr_blk;
+    int blk_pos = buf->blk_pos;
+    if (!blk || (offset < blk_pos) || (offset >= blk_pos + blk->size)) {
+        pktbuf_idx_t * idx = pktbuf_find_idx(buf, offset);
+
+        int cursor_dist = blk ? offset - blk_pos : buf->total_size;
+        if (cursor_dist < 0) {
+            cursor_dist = -cursor_dist;
+        }
+
+        if (offset - idx->offset < cursor_dist) {
+            blk = idx->blk;
+            blk_pos = idx->offset;
+        }
+
+        while (offset < blk_pos) {
+            blk = nlist_entry(nlist_node_pre(&blk->node), pktblk_t, node);
+            blk_pos -= blk->size;
+        }
+
+        while (offset >= blk_pos + blk->size) {
+            blk_pos += blk->size;
+            blk = pktblk_blk_next(blk);
+        }
     }
 
+    buf->pos = offset;
+    buf->blk_pos = blk_pos;
+    buf->curr_blk = blk;
+    buf->blk_offset = blk->data + (offset - blk_pos);
     return NET_ERR_OK;
 }
 
@@ -587,6 +1014,11 @@ net_err_t pktbuf_copy(pktbuf_t * dest, pktbuf_t * src, int size) {
     }
 
     while (size) {
+        net_err_t err = pktbuf_unshare_blk(dest, dest->curr_blk);
+        if (err < 0) {
+            return err;
+        }
+
         int dest_remain = curr_blk_remain(dest);
         int src_remain = curr_blk_remain(src);
         int copy_size = dest_remain > src_remain ? src_remain : dest_remain;
@@ -603,4 +1035,139 @@ net_err_t pktbuf_copy(pktbuf_t * dest, pktbuf_t * src, int size) {
     return NET_ERR_OK;
 }
 
+/**
+ * 从当前位置起size字节的16位反码和，未取反，位置随之后移。各数据块的起始位置可以为奇数
+ */
+uint16_t pktbuf_checksum16 (pktbuf_t * buf, int size, uint32_t sum) {
+    dbg_assert(buf->ref != 0, "buf->ref = 0");
+    if (total_blk_remain(buf) < size) {
+        size = total_blk_remain(buf);
+    }
+
+    int odd = 0;
+    while (size) {
+        int curr_size = curr_blk_remain(buf);
+        curr_size = size > curr_size ? curr_size : size;
+
+        // 从奇数位置开始的一段，按偶数位置计算后交换字节
+        uint16_t part = checksum16(buf->blk_offset, curr_size, 0);
+        sum += odd ? swap_u16(part) : part;
+        odd ^= curr_size & 1;
+
+        move_forward(buf, curr_size);
+        size -= curr_size;
+    }
+
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)sum;
+}
+
+int pktbuf_to_iovec(pktbuf_t * buf, int offset, int size, pktbuf_iovec_t * iov, int iov_cnt) {
+    dbg_assert(buf->ref != 0, "buf->ref = 0");
+    if ((offset < 0) || (size < 0) || (offset + size > buf->total_size)) {
+        dbg_error(DBG_BUF, "pktbuf_to_iovec: bad range, offset: %d, size: %d", offset, size);
+        return NET_ERR_SIZE;
+    }
+
+    pktbuf_seek(buf, offset);
+
+    int cnt = 0;
+    pktblk_t * curr_blk = buf->curr_blk;
+    uint8_t * data = buf->blk_offset;
+    while (size) {
+        int curr_size = (int)(curr_blk->data + curr_blk->size - data);
+        curr_size = size > curr_size ? curr_size : size;
+        if (curr_size) {
+            if (cnt >= iov_cnt) {
+                dbg_error(DBG_BUF, "pktbuf_to_iovec: iov too small, iov_cnt: %d", iov_cnt);
+                return NET_ERR_FULL;
+            }
+
+            iov[cnt].data = data;
+            iov[cnt].size = curr_size;
+            cnt++;
+            size -= curr_size;
+        }
+
+        curr_blk = pktblk_blk_next(curr_blk);
+        data = curr_blk ? curr_blk->data : (uint8_t *)0;
+    }
+
+    return cnt;
+}
+
+static net_err_t pktbuf_ref_iovec (pktbuf_t * buf, const pktbuf_iovec_t * iov, int iov_cnt, pktbuf_free_fn_t free_fn, void * ctx) {
+    for (int i = 0; i < iov_cnt; i++) {
+        uint8_t * data = iov[i].data;
+        int size = iov[i].size;
+
+        if (!size) {
+            continue;
+        }
+
+        // 一个数据块引用整段数据，写入时才按数据块大小复制
+        pktblk_t * block = pktblock_alloc();
+        if (!block) {
+            // 已加入的数据块释放时不通知调用者
+            for (pktblk_t * curr = pktbuf_first_blk(buf); curr; curr = pktblk_blk_next(curr)) {
+                curr->base = curr->payload;
+            }
+            dbg_error(DBG_BUF, "pktbuf_from_iovec: no memory");
+            return NET_ERR_MEM;
+        }
+
+        pktblk_ext_t * ext = (pktblk_ext_t *)block->payload;
+        ext->free_fn = free_fn;
+        ext->ctx = ctx;
+        block->base = data;
+        block->data = data;
+        block->size = size;
+
+        nlist_insert_last(&buf->blk_list, &block->node);
+        buf->total_size += size;
+    }
+
+    return NET_ERR_OK;
+}
+
+static net_err_t pktbuf_copy_iovec (pktbuf_t * buf, const pktbuf_iovec_t * iov, int iov_cnt) {
+    for (int i = 0; i < iov_cnt; i++) {
+        if (iov[i].size) {
+            net_err_t err = pktbuf_write(buf, iov[i].data, iov[i].size);
+            if (err < 0) {
+                return err;
+            }
+        }
+    }
+
+    return NET_ERR_OK;
+}
+
+pktbuf_t * pktbuf_from_iovec(const pktbuf_iovec_t * iov, int iov_cnt, pktbuf_free_fn_t free_fn, void * ctx) {
+    int total_size = 0;
+    for (int i = 0; i < iov_cnt; i++) {
+        if (iov[i].size < 0) {
+            dbg_error(DBG_BUF, "pktbuf_from_iovec: bad size: %d", iov[i].size);
+            return (pktbuf_t *)0;
+        }
+        total_size += iov[i].size;
+    }
+
+    pktbuf_t * buf = pktbuf_alloc(free_fn ? 0 : total_size);
+    if (!buf) {
+        dbg_error(DBG_BUF, "pktbuf_from_iovec: no memory");
+        return (pktbuf_t *)0;
+    }
 
+    net_err_t err = free_fn ? pktbuf_ref_iovec(buf, iov, iov_cnt, free_fn, ctx) : pktbuf_copy_iovec(buf, iov, iov_cnt);
+    if (err < 0) {
+        pktbuf_free(buf);
+        return (pktbuf_t *)0;
+    }
+
+    pktbuf_reset_acc(buf);
+    display_check_buf(buf);
+    return buf;
+}
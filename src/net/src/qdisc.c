@@ -0,0 +1,671 @@
+#include "qdisc.h"
+#include "dbg.h"
+#include "netif.h"
+#include "net_stats.h"
+#include "protocol.h"
+
+#define QDISC_MTU           1514        // CoDel：剩余不足一个包时不丢弃
+
+/**
+ * 缺省配置：RED的阈值按字节上限，未设置时按每包1500字节估算
+ */
+void qdisc_cfg_init (qdisc_cfg_t * cfg, qdisc_type_t type, int limit, int limit_bytes) {
+    int bytes = limit_bytes ? limit_bytes : limit * 1500;
+
+    plat_memset(cfg, 0, sizeof(qdisc_cfg_t));
+    cfg->type = type;
+    cfg->limit = limit;
+    cfg->limit_bytes = limit_bytes;
+    cfg->red_min = bytes / 4;
+    cfg->red_max = bytes * 3 / 4;
+    cfg->red_prob = 26;
+    cfg->red_wlog = 6;
+    cfg->codel_target_us = 5000;
+    cfg->codel_interval_us = 100000;
+    cfg->fq_flows = NET_QDISC_FLOW_MAX;
+    cfg->fq_quantum = QDISC_MTU;
+    cfg->ctrl_limit = NET_QDISC_CTRL_SIZE;
+    cfg->ctrl_weight = NET_QDISC_CTRL_WEIGHT;
+}
+
+static net_err_t cfg_check (const qdisc_cfg_t * cfg) {
+    if ((cfg->type < 0) || (cfg->type >= QDISC_TYPE_CNT) || (cfg->limit <= 0) || (cfg->limit_bytes < 0) ||
+        (cfg->ctrl_limit < 0) || (cfg->ctrl_weight < 0) || (cfg->burst < 0) || (cfg->flow_burst < 0)) {
+        return NET_ERR_PARAM;
+    }
+
+    switch (cfg->type) {
+        case QDISC_RED:
+            if ((cfg->red_min < 0) || (cfg->red_max <= cfg->red_min) || (cfg->red_prob <= 0) ||
+                (cfg->red_prob > 256) || (cfg->red_wlog < 0) || (cfg->red_wlog > 16)) {
+                return NET_ERR_PARAM;
+            }
+            break;
+        case QDISC_FQ_CODEL:
+            if ((cfg->fq_flows <= 0) || (cfg->fq_flows > NET_QDISC_FLOW_MAX) || (cfg->fq_quantum <= 0)) {
+                return NET_ERR_PARAM;
+            }
+            /* fallthrough */     // 继续检查CoDel的参数
+        case QDISC_CODEL:
+            if ((cfg->codel_target_us <= 0) || (cfg->codel_interval_us <= 0)) {
+                return NET_ERR_PARAM;
+            }
+            break;
+        default:
+            break;
+    }
+    return NET_ERR_OK;
+}
+
+static uint32_t qdisc_rand (qdisc_t * q) {
+    uint32_t x = q->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    q->seed = x;
+    return x;
+}
+
+/**
+ * 未设置桶深时按2ms的流量，不少于两个包。定时器以毫秒为单位，桶深小于1ms的流量时达不到设置的速率
+ */
+static int shaper_burst (uint64_t rate, int burst) {
+    if (burst || !rate) {
+        return burst;
+    }
+
+    uint64_t bytes = rate / 500;
+    if (bytes < 2 * QDISC_MTU) {
+        return 2 * QDISC_MTU;
+    }
+    return bytes > 0x7FFFFFFF ? 0x7FFFFFFF : (int)bytes;
+}
+
+static void shaper_init (qdisc_t * q, uint64_t now) {
+    const qdisc_cfg_t * cfg = &q->cfg;
+
+    tbucket_init(&q->shaper, cfg->rate, shaper_burst(cfg->rate, cfg->burst), now);
+    for (int i = 0; i < NET_QDISC_FLOW_MAX; i++) {
+        tbucket_init(&q->flow[i].tb, cfg->flow_rate, shaper_burst(cfg->flow_rate, cfg->flow_burst), now);
+    }
+
+    // 被限速的流回到旧流列表，按新的速率重新判断
+    nlist_node_t * node;
+    while ((node = nlist_remove_first(&q->throttled))) {
+        nlist_insert_last(&q->old_flows, node);
+    }
+    q->next_ns = 0;
+}
+
+/**
+ * 清空各流及调度状态，须在锁定时调用。丢弃的包链接到list中，由调用者在解锁后释放
+ */
+static void qdisc_reset (qdisc_t * q, nlist_t * list) {
+    for (int i = 0; i < NET_QDISC_FLOW_MAX; i++) {
+        qdisc_flow_t * flow = q->flow + i;
+
+        nlist_node_t * node;
+        while ((node = nlist_remove_first(&flow->q))) {
+            nlist_insert_last(list, node);
+        }
+
+        plat_memset(flow, 0, sizeof(qdisc_flow_t));
+        nlist_init(&flow->q);
+        nlist_node_init(&flow->node);
+    }
+
+    nlist_node_t * node;
+    while ((node = nlist_remove_first(&q->ctrl_q))) {
+        nlist_insert_last(list, node);
+    }
+
+    nlist_init(&q->ctrl_q);
+    nlist_init(&q->new_flows);
+    nlist_init(&q->old_flows);
+    nlist_init(&q->throttled);
+    shaper_init(q, sys_time_ns());
+    q->ctrl_cnt = 0;
+    q->ctrl_run = 0;
+    q->cnt = 0;
+    q->bytes = 0;
+    q->red_avg = 0;
+    q->red_count = -1;
+}
+
+static void free_list (nlist_t * list) {
+    nlist_node_t * node;
+    while ((node = nlist_remove_first(list))) {
+        pktbuf_free(nlist_entry(node, pktbuf_t, node));
+    }
+}
+
+net_err_t qdisc_init (qdisc_t * q, struct _netif_t * netif, int is_out, const qdisc_cfg_t * cfg) {
+    if (cfg_check(cfg) < 0) {
+        dbg_error(DBG_QUEUE, "invalid qdisc cfg");
+        return NET_ERR_PARAM;
+    }
+
+    plat_memset(q, 0, sizeof(qdisc_t));
+    net_err_t err = nlocker_init(&q->locker, NLOCKER_THREAD);
+    if (err < 0) {
+        dbg_error(DBG_QUEUE, "nlocker_init failed");
+        return err;
+    }
+
+    if (sys_sem_init(&q->sem, 0) < 0) {
+        dbg_error(DBG_QUEUE, "sys_sem_init failed");
+        nlocker_destroy(&q->locker);
+        return NET_ERR_SYS;
+    }
+
+    nlist_t list;
+    nlist_init(&list);
+    q->cfg = *cfg;
+    q->netif = netif;
+    q->drop_full = is_out ? NET_STAT_TX_DROP_QFULL : NET_STAT_RX_DROP_QFULL;
+    q->drop_aqm = is_out ? NET_STAT_TX_DROP_AQM : NET_STAT_RX_DROP_AQM;
+    q->waiters = 0;
+    q->seed = 0x9E3779B9u ^ (uint32_t)(uintptr_t)q;
+    q->perturb = (uint32_t)sys_time_ns() * 0x9E3779B1u;
+    qdisc_reset(q, &list);
+    return NET_ERR_OK;
+}
+
+void qdisc_destroy (qdisc_t * q) {
+    qdisc_flush(q);
+    sys_sem_destroy(&q->sem);
+    nlocker_destroy(&q->locker);
+}
+
+/**
+ * 更换排队规则，已排队的包被丢弃
+ */
+net_err_t qdisc_set (qdisc_t * q, const qdisc_cfg_t * cfg) {
+    if (cfg_check(cfg) < 0) {
+        dbg_error(DBG_QUEUE, "invalid qdisc cfg");
+        return NET_ERR_PARAM;
+    }
+
+    nlist_t list;
+    nlist_init(&list);
+
+    nlocker_lock(&q->locker);
+    q->cfg = *cfg;
+    qdisc_reset(q, &list);
+    nlocker_unlock(&q->locker);
+
+    free_list(&list);
+    return NET_ERR_OK;
+}
+
+/**
+ * 修改限速，不影响已排队的包。rate为0时不限速，burst为0时按速率自动设置
+ */
+net_err_t qdisc_set_rate (qdisc_t * q, uint64_t rate, int burst, uint64_t flow_rate, int flow_burst) {
+    if ((burst < 0) || (flow_burst < 0)) {
+        dbg_error(DBG_QUEUE, "invalid burst");
+        return NET_ERR_PARAM;
+    }
+
+    nlocker_lock(&q->locker);
+    q->cfg.rate = rate;
+    q->cfg.burst = burst;
+    q->cfg.flow_rate = flow_rate;
+    q->cfg.flow_burst = flow_burst;
+    shaper_init(q, sys_time_ns());
+    int wake = q->waiters;
+    nlocker_unlock(&q->locker);
+
+    // 等待中的线程按新的速率重新计算等待时间
+    if (wake) {
+        sys_sem_notify(&q->sem);
+    }
+    return NET_ERR_OK;
+}
+
+/**
+ * 因限速有包未能取出时，距离可以再取的毫秒数，向上取整；否则返回0
+ */
+int qdisc_next_ms (qdisc_t * q) {
+    nlocker_lock(&q->locker);
+    uint64_t next = q->cnt ? q->next_ns : 0;
+    nlocker_unlock(&q->locker);
+
+    if (!next) {
+        return 0;
+    }
+
+    uint64_t now = sys_time_ns();
+    return next > now ? (int)((next - now + 999999) / 1000000) : 1;
+}
+
+void qdisc_flush (qdisc_t * q) {
+    nlist_t list;
+    nlist_init(&list);
+
+    nlocker_lock(&q->locker);
+    qdisc_reset(q, &list);
+    nlocker_unlock(&q->locker);
+
+    free_list(&list);
+}
+
+static void flow_push (qdisc_t * q, qdisc_flow_t * flow, pktbuf_t * buf, int size) {
+    nlist_insert_last(&flow->q, &buf->node);
+    flow->backlog += size;
+    q->bytes += size;
+    q->cnt++;
+}
+
+static pktbuf_t * flow_pop (qdisc_t * q, qdisc_flow_t * flow) {
+    nlist_node_t * node = nlist_remove_first(&flow->q);
+    if (!node) {
+        return (pktbuf_t *)0;
+    }
+
+    pktbuf_t * buf = nlist_entry(node, pktbuf_t, node);
+    int size = pktbuf_total(buf);
+    flow->backlog -= size;
+    q->bytes -= size;
+    q->cnt--;
+    return buf;
+}
+
+static void qdisc_drop (qdisc_t * q, pktbuf_t * buf, int stat) {
+    net_stats_netif_add(q->netif, (net_stat_t)stat, 1);
+    pktbuf_free(buf);
+}
+
+/**
+ * RED：平均排队字节数在red_min和red_max之间时，丢弃概率随平均值线性增加，
+ * 并随上次丢弃后进入的包数增加，使丢弃的间隔比较均匀
+ */
+static int red_drop (qdisc_t * q) {
+    const qdisc_cfg_t * cfg = &q->cfg;
+
+    q->red_avg += (int64_t)q->bytes - (int64_t)(q->red_avg >> cfg->red_wlog);
+    uint64_t avg = q->red_avg >> cfg->red_wlog;
+    if (avg < (uint64_t)cfg->red_min) {
+        q->red_count = -1;
+        return 0;
+    }
+
+    if (avg >= (uint64_t)cfg->red_max) {
+        q->red_count = 0;
+        return 1;
+    }
+
+    // 以1/65536为单位：pb随平均值增加，pa = pb / (1 - count * pb)
+    q->red_count++;
+    uint64_t pb = (uint64_t)cfg->red_prob * 256 * (avg - cfg->red_min) / (cfg->red_max - cfg->red_min);
+    uint64_t used = (uint64_t)q->red_count * pb;
+    if ((used >= 65536) || ((qdisc_rand(q) & 0xFFFF) < (pb << 16) / (65536 - used))) {
+        q->red_count = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 控制包：ARP、ICMP、IGMP，及带SYN、FIN或RST的TCP包
+ */
+static int is_ctrl (const pktbuf_meta_t * meta) {
+    if (meta->l3_proto == NET_PROTOCOL_ARP) {
+        return 1;
+    }
+
+    if (meta->l3_proto != NET_PROTOCOL_IPv4) {
+        return 0;
+    }
+
+    switch (meta->l4_proto) {
+        case NET_PROTOCOL_ICMPv4:
+        case NET_PROTOCOL_IGMP:
+            return 1;
+        case NET_PROTOCOL_TCP:
+            return (meta->l4 >= 0) && (meta->l4_flags & 0x07);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * 在包头解析时得到的流哈希上混入本队列的扰动值
+ */
+static uint32_t flow_hash (qdisc_t * q, const pktbuf_meta_t * meta) {
+    if (!(meta->flags & PKTBUF_META_HASH)) {
+        return 0;
+    }
+
+    uint32_t h = meta->hash ^ q->perturb;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
+
+/**
+ * fq_codel：包进入所属的流，新出现的流排在新流列表中优先发送。
+ * 超过上限时从排队字节数最多的流头部丢弃，而不是丢弃新到的包
+ */
+static void fq_enqueue (qdisc_t * q, pktbuf_t * buf, int size, uint32_t hash) {
+    qdisc_flow_t * flow = q->flow + hash % q->cfg.fq_flows;
+    flow_push(q, flow, buf, size);
+    if (!flow->active) {
+        flow->active = 1;
+        flow->deficit = q->cfg.fq_quantum;
+        nlist_insert_last(&q->new_flows, &flow->node);
+    }
+
+    while ((q->cnt - q->ctrl_cnt > q->cfg.limit) || (q->cfg.limit_bytes && (q->bytes > q->cfg.limit_bytes))) {
+        qdisc_flow_t * fat = q->flow;
+        for (int i = 1; i < q->cfg.fq_flows; i++) {
+            if (q->flow[i].backlog > fat->backlog) {
+                fat = q->flow + i;
+            }
+        }
+
+        qdisc_drop(q, flow_pop(q, fat), q->drop_full);
+    }
+}
+
+static uint64_t codel_control_law (uint64_t t, uint64_t interval, uint32_t count) {
+    // interval / sqrt(count)，count较小，逐位求整数平方根
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 15; bit; bit >>= 1) {
+        uint32_t trial = root | bit;
+        if ((uint64_t)trial * trial <= count) {
+            root = trial;
+        }
+    }
+    return t + interval / (root ? root : 1);
+}
+
+/**
+ * 取出一个包，判断停留时间是否已持续超过target一个interval
+ */
+static pktbuf_t * codel_pop (qdisc_t * q, qdisc_flow_t * flow, uint64_t now, int * ok_to_drop) {
+    qdisc_codel_t * codel = &flow->codel;
+    uint64_t target = (uint64_t)q->cfg.codel_target_us * 1000;
+    uint64_t interval = (uint64_t)q->cfg.codel_interval_us * 1000;
+
+    *ok_to_drop = 0;
+    pktbuf_t * buf = flow_pop(q, flow);
+    if (!buf) {
+        codel->first_above = 0;
+        return (pktbuf_t *)0;
+    }
+
+    if ((now - buf->meta.time < target) || (flow->backlog <= QDISC_MTU)) {
+        codel->first_above = 0;
+    } else if (codel->first_above == 0) {
+        codel->first_above = now + interval;
+    } else if (now >= codel->first_above) {
+        *ok_to_drop = 1;
+    }
+    return buf;
+}
+
+/**
+ * CoDel (RFC 8289)：进入丢弃状态后，丢弃间隔按interval/sqrt(count)缩短，
+ * 直到停留时间回到target以下
+ */
+static pktbuf_t * codel_dequeue (qdisc_t * q, qdisc_flow_t * flow, uint64_t now) {
+    qdisc_codel_t * codel = &flow->codel;
+    uint64_t interval = (uint64_t)q->cfg.codel_interval_us * 1000;
+
+    int ok_to_drop;
+    pktbuf_t * buf = codel_pop(q, flow, now, &ok_to_drop);
+    if (codel->dropping) {
+        if (!ok_to_drop) {
+            codel->dropping = 0;
+        }
+
+        while (codel->dropping && (now >= codel->drop_next)) {
+            qdisc_drop(q, buf, q->drop_aqm);
+            codel->count++;
+            buf = codel_pop(q, flow, now, &ok_to_drop);
+            if (!ok_to_drop) {
+                codel->dropping = 0;
+            } else {
+                codel->drop_next = codel_control_law(codel->drop_next, interval, codel->count);
+            }
+        }
+    } else if (ok_to_drop) {
+        qdisc_drop(q, buf, q->drop_aqm);
+        buf = codel_pop(q, flow, now, &ok_to_drop);
+        codel->dropping = 1;
+
+        // 距上次丢弃状态不久时，从上次的丢弃频率继续
+        uint32_t delta = codel->count - codel->lastcount;
+        codel->count = ((delta > 1) && (now - codel->drop_next < 16 * interval)) ? delta : 1;
+        codel->drop_next = codel_control_law(now, interval, codel->count);
+        codel->lastcount = codel->count;
+    }
+    return buf;
+}
+
+/**
+ * 到了可发送时间的流移回旧流列表尾部，返回其余被限速的流中最早可发送的时间
+ */
+static uint64_t fq_unthrottle (qdisc_t * q, uint64_t now) {
+    uint64_t next = 0;
+
+    nlist_node_t * node = nlist_first(&q->throttled);
+    while (node) {
+        nlist_node_t * next_node = nlist_node_next(node);
+        qdisc_flow_t * flow = nlist_entry(node, qdisc_flow_t, node);
+        if (flow->ready <= now) {
+            nlist_remove(&q->throttled, node);
+            nlist_insert_last(&q->old_flows, node);
+        } else if (!next || (flow->ready < next)) {
+            next = flow->ready;
+        }
+        node = next_node;
+    }
+    return next;
+}
+
+/**
+ * 按字节数的轮转：新流优先，额度用完的流移到旧流列表尾部。
+ * 新流取空后若有旧流在等待，也移到旧流列表，避免流反复以新流身份抢先。
+ * 每个流限速时，超过速率的流移到限速列表，到时间后再参与轮转
+ */
+static pktbuf_t * fq_dequeue (qdisc_t * q, uint64_t now) {
+    if (q->cfg.flow_rate && !nlist_is_empty(&q->throttled)) {
+        fq_unthrottle(q, now);
+    }
+
+    for (;;) {
+        nlist_t * head = nlist_is_empty(&q->new_flows) ? &q->old_flows : &q->new_flows;
+        qdisc_flow_t * flow = nlist_entry(nlist_first(head), qdisc_flow_t, node);
+        if (!flow) {
+            if (!nlist_is_empty(&q->throttled)) {
+                q->next_ns = fq_unthrottle(q, now);
+            }
+            return (pktbuf_t *)0;
+        }
+
+        uint64_t wait = tbucket_wait(&flow->tb, now);
+        if (wait) {
+            flow->ready = now + wait;
+            nlist_remove(head, &flow->node);
+            nlist_insert_last(&q->throttled, &flow->node);
+            continue;
+        }
+
+        if (flow->deficit <= 0) {
+            flow->deficit += q->cfg.fq_quantum;
+            nlist_remove(head, &flow->node);
+            nlist_insert_last(&q->old_flows, &flow->node);
+            continue;
+        }
+
+        pktbuf_t * buf = codel_dequeue(q, flow, now);
+        if (!buf) {
+            nlist_remove(head, &flow->node);
+            if ((head == &q->new_flows) && !nlist_is_empty(&q->old_flows)) {
+                nlist_insert_last(&q->old_flows, &flow->node);
+            } else {
+                flow->active = 0;
+            }
+            continue;
+        }
+
+        int size = pktbuf_total(buf);
+        flow->deficit -= size;
+        tbucket_take(&flow->tb, size);
+        return buf;
+    }
+}
+
+/**
+ * 包入队，不阻塞。失败时已计入丢弃统计，由调用者释放包
+ */
+net_err_t qdisc_enqueue (qdisc_t * q, pktbuf_t * buf) {
+    int size = pktbuf_total(buf);
+    // 收到的包从收到时算起，本机发出的包从入队时算起
+    if (((q->cfg.type == QDISC_CODEL) || (q->cfg.type == QDISC_FQ_CODEL)) && !buf->meta.time) {
+        buf->meta.time = sys_time_ns();
+    }
+
+    // 只有以太网帧可以分类，在加锁前完成
+    int ctrl = 0;
+    uint32_t hash = 0;
+    int eth = (q->netif->type == NETIF_TYPE_ETHER) || (q->netif->type == NETIF_TYPE_VLAN);
+    if ((eth && q->cfg.ctrl_limit) || (q->cfg.type == QDISC_FQ_CODEL)) {
+        // 收到的包已在入队前解析，发出的包在这里解析
+        if (!(buf->meta.flags & PKTBUF_META_PARSED)) {
+            netif_parse_meta(q->netif, buf);
+        }
+        ctrl = eth && q->cfg.ctrl_limit && is_ctrl(&buf->meta);
+        hash = q->cfg.type == QDISC_FQ_CODEL ? flow_hash(q, &buf->meta) : 0;
+    }
+
+    nlocker_lock(&q->locker);
+    if (ctrl) {
+        if (q->ctrl_cnt >= q->cfg.ctrl_limit) {
+            nlocker_unlock(&q->locker);
+            net_stats_netif_add(q->netif, (net_stat_t)q->drop_full, 1);
+            return NET_ERR_FULL;
+        }
+
+        nlist_insert_last(&q->ctrl_q, &buf->node);
+        q->ctrl_cnt++;
+        q->cnt++;
+    } else if (q->cfg.type == QDISC_FQ_CODEL) {
+        fq_enqueue(q, buf, size, hash);
+    } else {
+        if ((q->cnt - q->ctrl_cnt >= q->cfg.limit) || (q->cfg.limit_bytes && (q->bytes + size > q->cfg.limit_bytes))) {
+            nlocker_unlock(&q->locker);
+            net_stats_netif_add(q->netif, (net_stat_t)q->drop_full, 1);
+            return NET_ERR_FULL;
+        }
+
+        if ((q->cfg.type == QDISC_RED) && red_drop(q)) {
+            nlocker_unlock(&q->locker);
+            net_stats_netif_add(q->netif, (net_stat_t)q->drop_aqm, 1);
+            return NET_ERR_FULL;
+        }
+
+        flow_push(q, q->flow, buf, size);
+    }
+    int wake = q->waiters;
+    nlocker_unlock(&q->locker);
+
+    if (wake) {
+        sys_sem_notify(&q->sem);
+    }
+    return NET_ERR_OK;
+}
+
+static pktbuf_t * ctrl_pop (qdisc_t * q) {
+    nlist_node_t * node = nlist_remove_first(&q->ctrl_q);
+    pktbuf_t * buf = nlist_entry(node, pktbuf_t, node);
+    q->ctrl_cnt--;
+    q->cnt--;
+    q->ctrl_run++;
+    return buf;
+}
+
+static pktbuf_t * bulk_dequeue (qdisc_t * q, uint64_t now) {
+    uint64_t wait = tbucket_wait(&q->shaper, now);
+    if (wait) {
+        q->next_ns = now + wait;
+        return (pktbuf_t *)0;
+    }
+
+    pktbuf_t * buf;
+    switch (q->cfg.type) {
+        case QDISC_CODEL:
+            buf = codel_dequeue(q, q->flow, now);
+            break;
+        case QDISC_FQ_CODEL:
+            buf = fq_dequeue(q, now);
+            break;
+        default:
+            buf = flow_pop(q, q->flow);
+            break;
+    }
+
+    if (buf) {
+        tbucket_take(&q->shaper, pktbuf_total(buf));
+    }
+    return buf;
+}
+
+/**
+ * 取出一个包。ms<0时不等待，为0时一直等待，否则最多等待ms毫秒。
+ * 控制包优先，ctrl_weight不为0时，连续取出该数量的控制包后取一个普通包。
+ * 因限速取不到包时，等待到可以发送的时间
+ */
+pktbuf_t * qdisc_dequeue (qdisc_t * q, int ms) {
+    for (;;) {
+        pktbuf_t * buf = (pktbuf_t *)0;
+        uint64_t now = sys_time_ns();
+
+        nlocker_lock(&q->locker);
+        q->next_ns = 0;
+        if (q->ctrl_cnt && ((q->cnt == q->ctrl_cnt) || !q->cfg.ctrl_weight || (q->ctrl_run < q->cfg.ctrl_weight))) {
+            buf = ctrl_pop(q);
+            tbucket_take(&q->shaper, pktbuf_total(buf));
+        } else if (q->cnt) {
+            // 普通包可能全部被AQM丢弃或正被限速，此时仍取控制包
+            q->ctrl_run = 0;
+            buf = bulk_dequeue(q, now);
+            if (!buf && q->ctrl_cnt) {
+                buf = ctrl_pop(q);
+                tbucket_take(&q->shaper, pktbuf_total(buf));
+            }
+        }
+
+        if (buf || (ms < 0)) {
+            nlocker_unlock(&q->locker);
+            return buf;
+        }
+
+        uint32_t tmo = (uint32_t)ms;
+        if (q->next_ns) {
+            uint32_t wait = q->next_ns > now ? (uint32_t)((q->next_ns - now + 999999) / 1000000) : 1;
+            if (!ms || (wait < tmo)) {
+                tmo = wait;
+            }
+        }
+        natomic_add(&q->waiters, 1);
+        nlocker_unlock(&q->locker);
+
+        // 入队时只要有等待者就通知，可能留下多余的计数，醒来后队列为空时重新等待
+        int err = sys_sem_wait(&q->sem, tmo);
+        natomic_add(&q->waiters, -1);
+        if (err < 0) {
+            if (tmo == (uint32_t)ms) {
+                return (pktbuf_t *)0;
+            }
+
+            // 限速的等待到期，剩余的时间继续等待
+            if (ms && ((ms -= tmo) <= 0)) {
+                return (pktbuf_t *)0;
+            }
+        }
+    }
+}
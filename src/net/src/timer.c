@@ -144,4 +144,8 @@ int net_timer_first_tmo (void) {
     }
 
     return 0;
+}
+
+int net_timer_cnt (void) {
+    return nlist_count(&timer_list);
 }
\ No newline at end of file
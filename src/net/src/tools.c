@@ -1,5 +1,6 @@
 #include "tools.h"
 #include "dbg.h"
+#include "sys.h"
 
 static int is_little_endian (void) { 
     uint16_t v = 0x1234;
@@ -15,4 +16,43 @@ net_err_t tools_init (void) {
 
     dbg_info(DBG_TOOLS, "tools init done");  
     return NET_ERR_OK;
-}
\ No newline at end of file
+}
+
+/**
+ * 按网络字节序计算16位反码和，未取反。sum为之前各段的和，奇数长度的段只能是最后一段
+ */
+uint16_t checksum16 (const void * data, int size, uint32_t sum) {
+    const uint8_t * p = (const uint8_t *)data;
+    uint64_t acc = 0;
+
+    // 按本机字节序每次累加4字节，小端机器上的结果为字节交换后的值
+    while (size >= 4) {
+        uint32_t v;
+        plat_memcpy(&v, p, 4);
+        acc += v;
+        p += 4;
+        size -= 4;
+    }
+    if (size >= 2) {
+        uint16_t v;
+        plat_memcpy(&v, p, 2);
+        acc += v;
+        p += 2;
+        size -= 2;
+    }
+    if (size) {
+        uint16_t v = 0;
+        plat_memcpy(&v, p, 1);
+        acc += v;
+    }
+
+    while (acc >> 16) {
+        acc = (acc & 0xFFFF) + (acc >> 16);
+    }
+
+    uint32_t r = x_ntohs((uint16_t)acc) + sum;
+    while (r >> 16) {
+        r = (r & 0xFFFF) + (r >> 16);
+    }
+    return (uint16_t)r;
+}
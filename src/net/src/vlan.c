@@ -0,0 +1,250 @@
+#include "vlan.h"
+#include "dbg.h"
+#include "mblock.h"
+#include "protocol.h"
+#include "tools.h"
+#include "net_stats.h"
+#include "sys.h"
+#include "loop.h"
+
+typedef struct _vlan_t {
+    netif_t * parent;
+    int vid;
+}vlan_t;
+
+static vlan_t vlan_buffer[NETIF_DEV_CNT];
+static mblock_t vlan_mblock;
+
+// 按父网卡的id索引，每个父网卡一张VID表，首次创建子接口时分配；未分配时指向空表，查找时无需判断
+static netif_t * vid_none[VLAN_VID_CNT];
+static netif_t ** vid_tbl[NETIF_DEV_CNT];
+
+static net_err_t vlan_netif_open (netif_t * netif, void * data) {
+    const vlan_t * cfg = (const vlan_t *)data;
+    netif_t * parent = cfg->parent;
+
+    netif_t ** tbl = vid_tbl[parent->id];
+    if (tbl == vid_none) {
+        tbl = (netif_t **)sys_mem_alloc(VLAN_VID_CNT * sizeof(netif_t *), 0);
+        if (!tbl) {
+            dbg_error(DBG_VLAN, "alloc vid table failed");
+            return NET_ERR_MEM;
+        }
+        plat_memset(tbl, 0, VLAN_VID_CNT * sizeof(netif_t *));
+        vid_tbl[parent->id] = tbl;
+    }
+
+    if (tbl[cfg->vid]) {
+        dbg_error(DBG_VLAN, "vlan %d exist on %s", cfg->vid, parent->name);
+        return NET_ERR_EXIST;
+    }
+
+    vlan_t * vlan = (vlan_t *)mblock_alloc(&vlan_mblock, -1);
+    if (!vlan) {
+        dbg_error(DBG_VLAN, "alloc vlan failed");
+        return NET_ERR_MEM;
+    }
+    *vlan = *cfg;
+
+    netif->type = NETIF_TYPE_VLAN;
+    netif->mtu = parent->mtu;
+    netif->ops_data = vlan;
+    netif_set_hwaddr(netif, parent->hwaddr.addr, parent->hwaddr.len);
+    tbl[vlan->vid] = netif;
+    return NET_ERR_OK;
+}
+
+static void vlan_netif_close (netif_t * netif) {
+    vlan_t * vlan = (vlan_t *)netif->ops_data;
+    vid_tbl[vlan->parent->id][vlan->vid] = (netif_t *)0;
+    mblock_free(&vlan_mblock, vlan);
+}
+
+/**
+ * 子接口输出队列中的包已带标签，转交父网卡发送
+ */
+static net_err_t vlan_netif_xmit (netif_t * netif) {
+    netif_t * parent = ((vlan_t *)netif->ops_data)->parent;
+
+    pktbuf_t * buf;
+    while ((buf = netif_get_out(netif, -1))) {
+        net_err_t err = netif_put_out(parent, buf);
+        if (err < 0) {
+            pktbuf_free(buf);
+            return err;
+        }
+    }
+    return netif_xmit(parent);
+}
+
+static const netif_ops_t vlan_ops = {
+    .open = vlan_netif_open,
+    .close = vlan_netif_close,
+    .xmit = vlan_netif_xmit,
+};
+
+/**
+ * 在以太网卡上创建VLAN子接口，子接口有独立的地址和统计，使用netif_close删除
+ */
+netif_t * vlan_open (const char * name, netif_t * parent, int vid) {
+    if ((vid <= 0) || (vid >= VLAN_VID_MASK) || (parent->type != NETIF_TYPE_ETHER)) {
+        dbg_error(DBG_VLAN, "invalid vlan %d on %s", vid, parent->name);
+        return (netif_t *)0;
+    }
+
+    vlan_t cfg = {.parent = parent, .vid = vid};
+    return netif_open(name, &vlan_ops, &cfg);
+}
+
+/**
+ * 以太网层交来的带标签的包，buf以标签开始，按VID直接找到子接口
+ */
+static net_err_t vlan_in (netif_t * netif, pktbuf_t * buf) {
+    net_err_t err = pktbuf_set_cont(buf, sizeof(vlan_hdr_t));
+    if (err < 0) {
+        net_stats_proto_add(NET_STATS_PROTO_VLAN, NET_STAT_RX_DROP_BAD, 1);
+        return err;
+    }
+
+    vlan_hdr_t * hdr = (vlan_hdr_t *)pktbuf_data(buf);
+    netif_t * sub = vid_tbl[netif->id][x_ntohs(hdr->tci) & VLAN_VID_MASK];
+    if (!sub || (sub->state != NETIF_ACTIVE)) {
+        dbg_info(DBG_VLAN, "no vlan %d on %s", x_ntohs(hdr->tci) & VLAN_VID_MASK, netif->name);
+        return NET_ERR_NONE;
+    }
+
+    uint16_t type = x_ntohs(hdr->protocol);
+    int size = pktbuf_total(buf);
+    net_stats_netif_add(sub, NET_STAT_RX_PKTS, 1);
+    net_stats_netif_add(sub, NET_STAT_RX_BYTES, size);
+
+    pktbuf_remove_header(buf, sizeof(vlan_hdr_t));
+    buf->meta.netif = sub;
+    err = ether_proto_in(sub, type, buf);
+    if (err < 0) {
+        net_stats_netif_add(sub, NET_STAT_RX_DROP_LINK, 1);
+        pktbuf_free(buf);
+    }
+    return NET_ERR_OK;
+}
+
+static net_err_t vlan_link_open (netif_t * netif) {
+    return NET_ERR_OK;
+}
+
+static void vlan_link_close (netif_t * netif) {
+}
+
+/**
+ * 子接口输入队列中的完整帧
+ */
+static net_err_t vlan_link_in (netif_t * netif, pktbuf_t * buf) {
+    net_err_t err = pktbuf_set_cont(buf, sizeof(vlan_ether_hdr_t));
+    if (err < 0) {
+        net_stats_proto_add(NET_STATS_PROTO_VLAN, NET_STAT_RX_DROP_BAD, 1);
+        return err;
+    }
+
+    vlan_ether_hdr_t * hdr = (vlan_ether_hdr_t *)pktbuf_data(buf);
+    uint16_t type = x_ntohs(hdr->protocol);
+    net_stats_proto_add(NET_STATS_PROTO_VLAN, NET_STAT_RX_PKTS, 1);
+    net_stats_proto_add(NET_STATS_PROTO_VLAN, NET_STAT_RX_BYTES, pktbuf_total(buf) - sizeof(ether_hdr_t));
+
+    pktbuf_remove_header(buf, sizeof(vlan_ether_hdr_t));
+    return ether_proto_in(netif, type, buf);
+}
+
+static net_err_t vlan_link_out (netif_t * netif, ipaddr_t * dest, pktbuf_t * buf) {
+    if (ipaddr_is_equal(&netif->ipaddr, dest)) {
+        return vlan_raw_out(netif, NET_PROTOCOL_IPv4, netif->hwaddr.addr, buf);
+    }
+
+    return NET_ERR_OK;
+}
+
+/**
+ * 加上带标签的以太网包头后，直接放入父网卡的输出队列。包头和标签一次加入，
+ * 首个数据块前部有空间时不分配新的数据块
+ */
+net_err_t vlan_raw_out (netif_t * netif, uint16_t protocol, const uint8_t * dest, pktbuf_t * buf) {
+    vlan_t * vlan = (vlan_t *)netif->ops_data;
+    if (plat_memcmp(dest, netif->hwaddr.addr, ETHER_HWA_SIZE) == 0) {
+        return loop_deliver(netif, netif, protocol, buf);
+    }
+
+    int size = pktbuf_total(buf);
+    if (size < VLAN_DATA_MIN) {
+        net_err_t err = pktbuf_resize(buf, VLAN_DATA_MIN);
+        if (err < 0) {
+            dbg_error(DBG_VLAN, "resize packet failed!");
+            return err;
+        }
+
+        pktbuf_reset_acc(buf);
+        pktbuf_seek(buf, size);
+        pktbuf_fill(buf, 0, VLAN_DATA_MIN - size);
+        size = VLAN_DATA_MIN;
+    }
+    ether_proto_stats_add(protocol, NET_STAT_TX_PKTS, size);
+
+    net_err_t err = pktbuf_add_header(buf, sizeof(vlan_ether_hdr_t), 1);
+    if (err < 0) {
+        dbg_error(DBG_VLAN, "add header failed!");
+        return err;
+    }
+
+    vlan_ether_hdr_t * hdr = (vlan_ether_hdr_t *)pktbuf_data(buf);
+    plat_memcpy(hdr->dest, dest, ETHER_HWA_SIZE);
+    plat_memcpy(hdr->src, netif->hwaddr.addr, ETHER_HWA_SIZE);
+    hdr->tpid = x_htons(NET_PROTOCOL_VLAN);
+    hdr->tci = x_htons(vlan->vid);
+    hdr->protocol = x_htons(protocol);
+
+    int total = pktbuf_total(buf);
+    net_stats_proto_add(NET_STATS_PROTO_ETHER, NET_STAT_TX_PKTS, 1);
+    net_stats_proto_add(NET_STATS_PROTO_ETHER, NET_STAT_TX_BYTES, total);
+    net_stats_proto_add(NET_STATS_PROTO_VLAN, NET_STAT_TX_PKTS, 1);
+    net_stats_proto_add(NET_STATS_PROTO_VLAN, NET_STAT_TX_BYTES, total - sizeof(ether_hdr_t));
+
+    err = netif_put_out(vlan->parent, buf);
+    if (err < 0) {
+        dbg_error(DBG_VLAN, "put out failed!");
+        return err;
+    }
+
+    net_stats_netif_add(netif, NET_STAT_TX_PKTS, 1);
+    net_stats_netif_add(netif, NET_STAT_TX_BYTES, total);
+    return netif_xmit(vlan->parent);
+}
+
+net_err_t vlan_init (void) {
+    static const link_layer_t vlan_layer = {
+        .type = NETIF_TYPE_VLAN,
+        .open = vlan_link_open,
+        .close = vlan_link_close,
+        .in = vlan_link_in,
+        .out = vlan_link_out,
+    };
+
+    dbg_info(DBG_VLAN, "init vlan");
+
+    mblock_init(&vlan_mblock, vlan_buffer, sizeof(vlan_t), NETIF_DEV_CNT, NLOCKER_NONE);
+    for (int i = 0; i < NETIF_DEV_CNT; i++) {
+        vid_tbl[i] = vid_none;
+    }
+
+    net_err_t err = netif_register_layer(NETIF_TYPE_VLAN, &vlan_layer);
+    if (err < 0) {
+        dbg_error(DBG_VLAN, "register vlan layer failed!");
+        return err;
+    }
+
+    err = ether_register_proto(NET_PROTOCOL_VLAN, vlan_in);
+    if (err < 0) {
+        dbg_error(DBG_VLAN, "register vlan protocol failed!");
+        return err;
+    }
+
+    dbg_info(DBG_VLAN, "init vlan done!");
+    return NET_ERR_OK;
+}
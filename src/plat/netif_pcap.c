@@ -4,28 +4,380 @@
 #include "pcap.h"
 #include "dbg.h"
 #include "ether.h"
+#include "net_stats.h"
+#include "net_lat.h"
+#include "net_poll.h"
 
-void recv_thread (void * arg) {
-    plat_printf("recv thread is running....\n");
+#if defined(SYS_PLAT_WINDOWS)
+#include <tchar.h>
+
+/**
+ * 调整npcap的搜索路径：默认安装在系统的dll路径\npcap目录下
+ * 设置该路径，以避免使用其它已经安装的winbcap版本的dll
+ * 注意：要先安装npcap软件包
+ */
+static int load_pcap_lib (void) {
+    static int dll_loaded = 0;
+    _TCHAR  npcap_dir[512];
+    int size;
+
+    if (dll_loaded) {
+        return 0;
+    }
+
+    size = GetSystemDirectory(npcap_dir, 480);
+    if (!size) {
+        fprintf(stderr, "Error in GetSystemDirectory: %x", GetLastError());
+        return -1;
+    }
+
+    _tcscat_s(npcap_dir, 512, _T("\\Npcap"));
+    if (SetDllDirectory(npcap_dir) == 0) {
+        fprintf(stderr, "Error in SetDllDirectory: %x", GetLastError());
+        return -1;
+    }
+
+    dll_loaded = 1;
+    return 0;
+}
+
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int load_pcap_lib (void) {
+    return 0;
+}
+#endif
+
+/**
+ * 根据ip地址查找本地网络接口列表，找到相应的名称
+ */
+int pcap_find_device(const char* ip, char* name_buf) {
+    struct in_addr dest_ip;
+
+    inet_pton(AF_INET, ip, &dest_ip);
+
+    // 获取所有的接口列表
+    char err_buf[PCAP_ERRBUF_SIZE];
+    pcap_if_t* pcap_if_list = NULL;
+    int err = pcap_findalldevs(&pcap_if_list, err_buf);
+    if (err < 0) {
+        pcap_freealldevs(pcap_if_list);
+        return -1;
+    }
+
+    // 遍历列表
+    pcap_if_t* item;
+    for (item = pcap_if_list; item != NULL; item = item->next) {
+        if (item->addresses == NULL) {
+            continue;
+        }
+
+        // 查找地址
+        for (struct pcap_addr* pcap_addr = item->addresses; pcap_addr != NULL; pcap_addr = pcap_addr->next) {
+            // 检查ipv4地址类型
+            struct sockaddr* sock_addr = pcap_addr->addr;
+            if (sock_addr->sa_family != AF_INET) {
+                continue;
+            }
+
+            // 地址相同则返回
+            struct sockaddr_in* curr_addr = ((struct sockaddr_in*)sock_addr);
+            if (curr_addr->sin_addr.s_addr == dest_ip.s_addr) {
+                strcpy(name_buf, item->name);
+                pcap_freealldevs(pcap_if_list);
+                return 0;
+            }
+        }
+    }
+
+    pcap_freealldevs(pcap_if_list);
+    return -1;
+}
+
+/*
+ * 显示所有的网络接口列表，在出错时被调用
+ */
+int pcap_show_list(void) {
+    char err_buf[PCAP_ERRBUF_SIZE];
+    pcap_if_t* pcapif_list = NULL;
+    int count = 0;
+
+    // 查找所有的网络接口
+    int err = pcap_findalldevs(&pcapif_list, err_buf);
+    if (err < 0) {
+        fprintf(stderr, "scan net card failed: %s\n", err_buf);
+        pcap_freealldevs(pcapif_list);
+        return -1;
+    }
+
+    printf("net card list: \n");
+
+    // 遍历所有的可用接口，输出其信息
+    for (pcap_if_t* item = pcapif_list; item != NULL; item = item->next) {
+        if (item->addresses == NULL) {
+            continue;
+        }
+
+        // 显示ipv4地址
+        for (struct pcap_addr* pcap_addr = item->addresses; pcap_addr != NULL; pcap_addr = pcap_addr->next) {
+            char str[INET_ADDRSTRLEN];
+            struct sockaddr_in* ip_addr;
+
+            struct sockaddr* sockaddr = pcap_addr->addr;
+            if (sockaddr->sa_family != AF_INET) {
+                continue;
+            }
+
+            ip_addr = (struct sockaddr_in*)sockaddr;
+            char * name = item->description;
+            if (name == NULL) {
+                name = item->name;
+            }
+            printf("%d: IP:%s name: %s, \n",
+                count++,
+                name ? name : "unknown",
+                inet_ntop(AF_INET, &ip_addr->sin_addr, str, sizeof(str))
+            );
+            break;
+        }
+    }
+
+    pcap_freealldevs(pcapif_list);
+
+    if ((pcapif_list == NULL) || (count == 0)) {
+        fprintf(stderr, "error: no net card!\n");
+        return -1;
+    }
+
+    printf("no net card found, check system configuration\n");
+    return 0;
+}
+
+/**
+ * 打开pcap设备接口
+ */
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
+    // 加载pcap库
+    if (load_pcap_lib() < 0) {
+        fprintf(stderr, "load pcap lib error。在windows上，请课程提供的安装npcap.dll\n");
+        return (pcap_t *)0;
+    }
+
+    // 利用上层传来的ip地址，
+    char name_buf[256];
+    if (pcap_find_device(ip, name_buf) < 0) {
+        fprintf(stderr, "pcap find error: no net card has ip: %s. \n", ip);
+        pcap_show_list();
+        return (pcap_t*)0;
+    }
+
+    // 根据名称获取ip地址、掩码等
+    char err_buf[PCAP_ERRBUF_SIZE];
+    bpf_u_int32 mask;
+    bpf_u_int32 net;
+    if (pcap_lookupnet(name_buf, &net, &mask, err_buf) == -1) {
+        printf("pcap_lookupnet error: no net card: %s\n", name_buf);
+        net = 0;
+        mask = 0;
+    }
+
+    // 打开设备
+    pcap_t * pcap = pcap_create(name_buf, err_buf);
+    if (pcap == NULL) {
+        fprintf(stderr, "pcap_create: create pcap failed %s\n net card name: %s\n", err_buf, name_buf);
+        fprintf(stderr, "Use the following:\n");
+        pcap_show_list();
+        return (pcap_t*)0;
+    }
+
+    if (pcap_set_snaplen(pcap, 65536) != 0) {
+        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    if (pcap_set_promisc(pcap, 1) != 0) {
+        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    if (pcap_set_timeout(pcap, 0) != 0) {
+        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    // 非阻塞模式读取，程序中使用查询的方式读
+    if (pcap_set_immediate_mode(pcap, 1) != 0) {
+        fprintf(stderr, "pcap_open: set im block failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    if (pcap_activate(pcap) != 0) {
+        fprintf(stderr, "pcap_open: active failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    if (pcap_setnonblock(pcap, 0, err_buf) != 0) {
+        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+
+    // 只捕获发往本接口与广播的数据帧。相当于只处理发往这张网卡的包
+    char filter_exp[256];
+    struct bpf_program fp;
+    sprintf(filter_exp,
+        "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
+        mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
+        mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+    if (pcap_compile(pcap, &fp, filter_exp, 0, net) == -1) {
+        printf("pcap_open: couldn't parse filter %s: %s\n", filter_exp, pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+    if (pcap_setfilter(pcap, &fp) == -1) {
+        printf("pcap_open: couldn't install filter %s: %s\n", filter_exp, pcap_geterr(pcap));
+        return (pcap_t*)0;
+    }
+    return pcap;
+}
+
+#if NET_BUSY_POLL
+/**
+ * 以非阻塞方式反复读取，自旋预算用完后临时切换为阻塞模式等待下一个包
+ */
+static int pcap_next_poll (pcap_t * pcap, net_poll_t * poll, struct pcap_pkthdr ** pkt_hdr, const uint8_t ** pkt_data) {
+    char err_buf[PCAP_ERRBUF_SIZE];
+
+    int err;
+    while ((err = pcap_next_ex(pcap, pkt_hdr, pkt_data)) == 0) {
+        if (!net_poll_idle(poll)) {
+            pcap_setnonblock(pcap, 0, err_buf);
+            err = pcap_next_ex(pcap, pkt_hdr, pkt_data);
+            pcap_setnonblock(pcap, 1, err_buf);
+            return err;
+        }
+    }
+
+    net_poll_busy(poll);
+    return err;
+}
+
+static pktbuf_t * netif_get_out_poll (netif_t * netif, net_poll_t * poll) {
+    while (qdisc_cnt(&netif->out_q) == 0) {
+        if (!net_poll_idle(poll)) {
+            return netif_get_out(netif, 0);
+        }
+    }
+
+    net_poll_busy(poll);
+    return netif_get_out(netif, -1);
+}
+#endif
+
+/**
+ * 将收到的数据帧拷贝到包缓存中，被网卡的过滤程序丢弃的帧不分配包缓存
+ */
+static pktbuf_t * pcap_pkt_alloc (netif_t * netif, struct pcap_pkthdr * pkt_hdr, const uint8_t * pkt_data) {
+    if (!netif_rx_filter(netif, pkt_data, pkt_hdr->caplen)) {
+        return (pktbuf_t *)0;
+    }
+
+    // pkt_hdr->ts为系统时间，与单调时钟不可比较，这里重新取时间
+    uint64_t rx_time = sys_time_ns();
+
+    pktbuf_t * buf = pktbuf_alloc(pkt_hdr->len);
+    if (buf == (pktbuf_t *)0) {
+        net_stats_netif_add(netif, NET_STAT_RX_DROP_NOBUF, 1);
+        dbg_warning(DBG_NETIF, "pktbuf alloc failed!\n");
+        return (pktbuf_t *)0;
+    }
+
+    pktbuf_write(buf, (uint8_t *)pkt_data, pkt_hdr->len);
+    buf->meta.time = rx_time;
+    net_lat_begin(buf, rx_time);
+    return buf;
+}
 
+/**
+ * 发送一个包并释放
+ */
+static void pcap_send (netif_t * netif, pcap_t * pcap, pktbuf_t * buf) {
+    // VLAN子接口与父接口的MTU相同，帧中多4字节的标签
+    uint8_t rw_buffer[ETHER_MTU + sizeof(ether_hdr_t) + 4];
+
+    int total_size = buf->total_size;
+    if (total_size > (int)sizeof(rw_buffer)) {
+        net_stats_netif_add(netif, NET_STAT_TX_ERR, 1);
+        dbg_warning(DBG_NETIF, "frame too big: %d", total_size);
+        pktbuf_free(buf);
+        return;
+    }
+
+    plat_memset(rw_buffer, 0, sizeof(rw_buffer));
+    pktbuf_read(buf, rw_buffer, total_size);
+
+    if(pcap_inject(pcap, rw_buffer, total_size) == -1) {
+        net_stats_netif_add(netif, NET_STAT_TX_ERR, 1);
+        plat_printf("pacp send failed: %s | size: %d\n", pcap_geterr(pcap), total_size);
+        pktbuf_free(buf);
+        return;
+    }
+
+    net_lat_end(buf);
+    pktbuf_free(buf);
+}
+
+/**
+ * 收发线程创建后先等待，两个线程都创建成功才开始使用网卡，否则直接退出
+ */
+typedef struct _pcap_gate_t {
+    sys_sem_t start;
+    int inited;
+    volatile int ok;
+}pcap_gate_t;
+
+static pcap_gate_t gate_tbl[NETIF_DEV_CNT];
+
+static int pcap_thread_start (netif_t * netif) {
+    pcap_gate_t * gate = gate_tbl + netif->id;
+    sys_sem_wait(&gate->start, 0);
+    return gate->ok;
+}
+
+void recv_thread (void * arg) {
     netif_t * netif = (netif_t *)arg;
+    if (!pcap_thread_start(netif)) {
+        return;
+    }
+
+    plat_printf("recv thread is running....\n");
     pcap_t * pcap = (pcap_t *)netif->ops_data;
+#if NET_BUSY_POLL
+    char err_buf[PCAP_ERRBUF_SIZE];
+    net_poll_t poll;
+    net_poll_init(&poll, NET_BUSY_POLL_US, NET_BUSY_POLL_MIN_US);
+    pcap_setnonblock(pcap, 1, err_buf);
+#endif
+
     while (1) {
         struct pcap_pkthdr * pkt_hdr;
         const uint8_t * pkt_data;
+#if NET_BUSY_POLL
+        if (pcap_next_poll(pcap, &poll, &pkt_hdr, &pkt_data) != 1) {
+            continue;
+        }
+#else
         if(pcap_next_ex(pcap, &pkt_hdr, &pkt_data) != 1) {
             continue;
         }
+#endif
 
-        pktbuf_t * buf = pktbuf_alloc(pkt_hdr->len);
+        pktbuf_t * buf = pcap_pkt_alloc(netif, pkt_hdr, pkt_data);
         if (buf == (pktbuf_t *)0) {
-            dbg_warning(DBG_NETIF, "pktbuf alloc failed!\n");
             continue;
         }
 
-        pktbuf_write(buf, (uint8_t *)pkt_data, pkt_hdr->len);
-
-        if(netif_put_in(netif, buf, 0) < 0) {
+        if(netif_put_in(netif, buf) < 0) {
             dbg_warning(DBG_NETIF, "netif %s put in failed!\n", netif->name);
             pktbuf_free(buf);
             continue;
@@ -34,32 +386,33 @@ void recv_thread (void * arg) {
 }
 
 void xmit_thread (void * arg) {
-    plat_printf("xmit thread is running....\n");
     netif_t * netif = (netif_t *)arg;
+    if (!pcap_thread_start(netif)) {
+        return;
+    }
+
+    plat_printf("xmit thread is running....\n");
     pcap_t * pcap = (pcap_t *)netif->ops_data;
-    static uint8_t rw_buffer[1500 + 6 + 6 + 2];
+#if NET_BUSY_POLL
+    net_poll_t poll;
+    net_poll_init(&poll, NET_BUSY_POLL_US, NET_BUSY_POLL_MIN_US);
+#endif
+
     while (1) {
+#if NET_BUSY_POLL
+        pktbuf_t * buf = netif_get_out_poll(netif, &poll);
+#else
         pktbuf_t * buf = netif_get_out(netif, 0);
+#endif
         if (buf == (pktbuf_t *)0) {
             continue;
         }
 
-        int total_size = buf->total_size;
-        plat_memset(rw_buffer, 0, sizeof(rw_buffer));
-        pktbuf_read(buf, rw_buffer, total_size);
-        pktbuf_free(buf);
-
-        if(pcap_inject(pcap, rw_buffer, total_size) == -1) {
-            plat_printf("pacp send failed: %s | size: %d\n", pcap_geterr(pcap), total_size);
-            continue;
-        }
+        pcap_send(netif, pcap, buf);
     }
 }
 
-
-static net_err_t netif_pacp_open (netif_t * netif, void * data) { 
-    pcap_data_t * dev_data = (pcap_data_t *)data;
-
+static net_err_t pcap_netif_open (netif_t * netif, pcap_data_t * dev_data) {
     pcap_t * pcap = pcap_device_open(dev_data->ip, dev_data->hwaddr);
     if (pcap == (pcap_t *)0) {
         dbg_error(DBG_NETIF, "pcap open failed! name: %s\n", netif->name);
@@ -70,9 +423,93 @@ static net_err_t netif_pacp_open (netif_t * netif, void * data) {
     netif->mtu = ETHER_MTU;
     netif->ops_data = pcap;
     netif_set_hwaddr(netif, (uint8_t *)dev_data->hwaddr, 6);
+    return NET_ERR_OK;
+}
+
+/**
+ * 网卡所在的NUMA节点，未知时返回-1。Linux下由/sys/class/net/<name>/device/numa_node给出
+ */
+static int pcap_numa_node (const char * ip) {
+#if defined(SYS_PLAT_LINUX)
+    char name[256], path[320];
+    if ((sys_numa_node_cnt() <= 1) || (pcap_find_device(ip, name) < 0)) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", name);
+    FILE * file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+
+    int node = -1;
+    if (fscanf(file, "%d", &node) != 1) {
+        node = -1;
+    }
+    fclose(file);
+    return node;
+#else
+    return -1;
+#endif
+}
+
+static net_err_t netif_pacp_open (netif_t * netif, void * data) { 
+    pcap_data_t * dev_data = (pcap_data_t *)data;
+    net_err_t err = pcap_netif_open(netif, dev_data);
+    if (err < 0) {
+        return err;
+    }
+
+    char name[16];
+    sys_thread_attr_t attr = {
+        .name = name,
+        .priority = dev_data->priority,
+        .stack_size = NET_THREAD_STACK,
+    };
+
+    // 未指定CPU时，收发线程绑定到网卡所在的节点，收到的包从该节点的内存池分配
+    uint64_t node_mask = 0;
+    if (!dev_data->rx_cpu_mask || !dev_data->tx_cpu_mask) {
+        int node = pcap_numa_node(dev_data->ip);
+        if (node >= 0) {
+            node_mask = sys_numa_cpu_mask(node);
+            dbg_info(DBG_NETIF, "%s on numa node %d", netif->name, node);
+        }
+    }
+
+    // 信号量只创建一次，之前失败退出的线程可能仍在使用
+    pcap_gate_t * gate = gate_tbl + netif->id;
+    if (!gate->inited) {
+        if (sys_sem_init(&gate->start, 0) < 0) {
+            dbg_error(DBG_NETIF, "create start sem failed\n");
+            pcap_close((pcap_t *)netif->ops_data);
+            return NET_ERR_SYS;
+        }
+        gate->inited = 1;
+    }
+    gate->ok = 0;
+
+    plat_sprintf(name, "net_rx%d", netif->id);
+    attr.cpu_mask = dev_data->rx_cpu_mask ? dev_data->rx_cpu_mask : node_mask;
+    if (sys_thread_create_attr(recv_thread, netif, &attr) == SYS_THREAD_INVALID) {
+        dbg_error(DBG_NETIF, "create recv thread failed\n");
+        pcap_close((pcap_t *)netif->ops_data);
+        return NET_ERR_SYS;
+    }
 
-    sys_thread_create(recv_thread, netif);
-    sys_thread_create(xmit_thread, netif);
+    plat_sprintf(name, "net_tx%d", netif->id);
+    attr.cpu_mask = dev_data->tx_cpu_mask ? dev_data->tx_cpu_mask : node_mask;
+    if (sys_thread_create_attr(xmit_thread, netif, &attr) == SYS_THREAD_INVALID) {
+        // 收线程还未使用网卡，通知其退出
+        dbg_error(DBG_NETIF, "create xmit thread failed\n");
+        sys_sem_notify(&gate->start);
+        pcap_close((pcap_t *)netif->ops_data);
+        return NET_ERR_SYS;
+    }
+
+    gate->ok = 1;
+    sys_sem_notify(&gate->start);
+    sys_sem_notify(&gate->start);
     return NET_ERR_OK;
 }
 
@@ -91,4 +528,63 @@ const netif_ops_t netdev_ops = {
     .close = netif_pacp_close,
     .open = netif_pacp_open,
     .xmit = netif_pacp_xmit,
-};
\ No newline at end of file
+};
+
+/**
+ * 轮询模式：不创建收发线程，由工作线程调用poll收包，发送在工作线程中直接完成
+ */
+static net_err_t netif_pacp_poll_open (netif_t * netif, void * data) { 
+    net_err_t err = pcap_netif_open(netif, (pcap_data_t *)data);
+    if (err < 0) {
+        return err;
+    }
+
+    char err_buf[PCAP_ERRBUF_SIZE];
+    if (pcap_setnonblock((pcap_t *)netif->ops_data, 1, err_buf) != 0) {
+        dbg_error(DBG_NETIF, "pcap set nonblock failed: %s\n", err_buf);
+        pcap_close((pcap_t *)netif->ops_data);
+        return NET_ERR_IO;
+    }
+    return NET_ERR_OK;
+}
+
+static net_err_t netif_pacp_poll_xmit (netif_t * netif) { 
+    pcap_t * pcap = (pcap_t *)netif->ops_data;
+
+    pktbuf_t * buf;
+    while ((buf = netif_get_out(netif, -1)) != (pktbuf_t *)0) {
+        pcap_send(netif, pcap, buf);
+    }
+    return NET_ERR_OK;
+}
+
+static int netif_pacp_poll (netif_t * netif, int budget) {
+    pcap_t * pcap = (pcap_t *)netif->ops_data;
+
+    // 其它线程放入输出队列的包
+    if (qdisc_cnt(&netif->out_q)) {
+        netif_pacp_poll_xmit(netif);
+    }
+
+    int cnt;
+    for (cnt = 0; cnt < budget; cnt++) {
+        struct pcap_pkthdr * pkt_hdr;
+        const uint8_t * pkt_data;
+        if (pcap_next_ex(pcap, &pkt_hdr, &pkt_data) != 1) {
+            break;
+        }
+
+        pktbuf_t * buf = pcap_pkt_alloc(netif, pkt_hdr, pkt_data);
+        if (buf) {
+            netif_recv(netif, buf);
+        }
+    }
+    return cnt;
+}
+
+const netif_ops_t netdev_poll_ops = {
+    .close = netif_pacp_close,
+    .open = netif_pacp_poll_open,
+    .xmit = netif_pacp_poll_xmit,
+    .poll = netif_pacp_poll,
+};
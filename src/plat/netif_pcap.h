@@ -3,13 +3,24 @@
 
 #include "net_err.h"
 #include "netif.h"
+#include <pcap.h>
 
 typedef struct _pacp_data_t {
     const char * ip;
     const uint8_t * hwaddr;
+
+    uint64_t rx_cpu_mask;               // 收发线程绑定的CPU集合，每位对应一个CPU，为0时绑定到网卡所在的NUMA节点
+    uint64_t tx_cpu_mask;
+    int priority;                       // 收发线程的实时优先级，为0使用普通调度
 } pcap_data_t;
 
 extern const netif_ops_t netdev_ops;
+extern const netif_ops_t netdev_poll_ops;          // 无收发线程，由工作线程轮询
+
+// PCAP网卡驱动相关函数
+int pcap_find_device(const char* ip, char* name_buf);
+int pcap_show_list(void);
+pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
 
 
 #endif
\ No newline at end of file
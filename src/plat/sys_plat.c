@@ -8,6 +8,9 @@
  * @copyright Copyright (c) 2022
  * 
  */
+#if defined(SYS_PLAT_LINUX)
+#define _GNU_SOURCE                     // pthread_attr_setaffinity_np、pthread_setname_np
+#endif
 #include "sys_plat.h"
 
 #if defined(SYS_PLAT_X86OS)
@@ -20,8 +23,7 @@
 #include "core/task.h"
 
 #define NET_TASK_NR                 3           // 如果收发均有线程，至少3个。否则1个
-#define NET_SEM_NR                  100         // 信号量数量
-#define NET_MUTEX_NR                100         // 互斥锁数量
+#define NET_MEM_SIZE                (256*1024)  // 协议栈内存池的总大小
 
 typedef struct _net_task_t {
     task_t task;
@@ -30,10 +32,8 @@ typedef struct _net_task_t {
 
 static net_task_t task_tbl[NET_TASK_NR];
 static mblock_t task_mblock;
-static sem_t sem_tbl[NET_SEM_NR];
-static mblock_t sem_mblock;
-static mutex_t mutex_tbl[NET_MUTEX_NR];
-static mblock_t mutex_mblock;
+static uint8_t mem_tbl[NET_MEM_SIZE] __attribute__((aligned(SYS_CACHE_LINE_SIZE)));
+static int mem_used;
 
 void sys_time_curr (net_time_t * time) {
     *time = sys_get_ticks();
@@ -51,45 +51,84 @@ int sys_time_goes (net_time_t * pre) {
     return diff_ms;    
 }
 
-// 计数信号量相关：由具体平台实现
-sys_sem_t sys_sem_create(int init_count) {
-    sys_sem_t sem = (sys_sem_t)mblock_alloc(&sem_mblock, -1);
-    if (sem != SYS_SEM_INVALID) {
-       sem_init(sem, init_count);
+// 单调时间：精度受限于系统时钟节拍
+uint64_t sys_time_ns (void) {
+    return (uint64_t)sys_get_ticks() * OS_TICK_MS * 1000000ULL;
+}
+
+// 内存分配：从静态内存区中顺序分配，不支持大页
+void * sys_mem_alloc(int size, int flags) {
+    size = (size + SYS_CACHE_LINE_SIZE - 1) & ~(SYS_CACHE_LINE_SIZE - 1);
+    if (mem_used + size > NET_MEM_SIZE) {
+        return (void *)0;
     }
-    return sem;
+
+    void * mem = mem_tbl + mem_used;
+    mem_used += size;
+    return mem;
+}
+
+// 静态内存区不回收
+void sys_mem_free(void * mem) {
+}
+
+// 共享内存：没有其它进程可读取，不支持
+void * sys_shm_create(const char * name, int size) {
+    return (void *)0;
+}
+
+// 可执行内存：不支持，过滤程序解释执行
+void * sys_code_alloc(const void * code, int size) {
+    return (void *)0;
+}
+
+void sys_code_free(void * mem, int size) {
+}
+
+// NUMA：单处理器，只有节点0
+int sys_numa_node_cnt (void) {
+    return 1;
+}
+
+int sys_numa_node_curr (void) {
+    return 0;
+}
+
+uint64_t sys_numa_cpu_mask (int node) {
+    return 0;
+}
+
+// 计数信号量相关：由具体平台实现
+int sys_sem_init(sys_sem_t * sem, int init_count) {
+    sem_init(sem, init_count);
+    return 0;
 }
 
-void sys_sem_free(sys_sem_t sem) {
-    mblock_free(&sem_mblock, sem);
+void sys_sem_destroy(sys_sem_t * sem) {
 }
 
-int sys_sem_wait(sys_sem_t sem, uint32_t ms) {
+int sys_sem_wait(sys_sem_t * sem, uint32_t ms) {
     return sem_wait_tmo(sem, ms);
 }
 
-void sys_sem_notify(sys_sem_t sem) {
+void sys_sem_notify(sys_sem_t * sem) {
     sem_notify(sem);
 }
 
 // 互斥信号量：由具体平台实现
-sys_mutex_t sys_mutex_create(void) {
-    sys_mutex_t m = (sys_mutex_t)mblock_alloc(&mutex_mblock, -1);
-    if (m != SYS_MUTEx_INVALID) {
-        mutex_init(m);
-    }
-    return m;
+int sys_mutex_init(sys_mutex_t * mutex) {
+    mutex_init(mutex);
+    return 0;
 }
 
-void sys_mutex_free(sys_mutex_t mutex) {
-    mblock_free(&mutex_mblock, mutex);
+void sys_mutex_destroy(sys_mutex_t * mutex) {
 }
 
-void sys_mutex_lock(sys_mutex_t mutex) {
+void sys_mutex_lock(sys_mutex_t * mutex) {
     mutex_lock(mutex);
 }
 
-void sys_mutex_unlock(sys_mutex_t mutex) {
+void sys_mutex_unlock(sys_mutex_t * mutex) {
     mutex_unlock(mutex);
 }
 
@@ -117,6 +156,11 @@ sys_thread_t sys_thread_create(sys_thread_func_t entry, void* arg) {
     return &task->task;
 }
 
+sys_thread_t sys_thread_create_attr(sys_thread_func_t entry, void* arg, const sys_thread_attr_t * attr) {
+    // 任务使用固定的堆栈和调度方式，忽略其它属性
+    return sys_thread_create(entry, arg);
+}
+
 void sys_thread_exit (int error) {
     // 不实现，加入os内核后，应用层不需要使用该接口
 }
@@ -131,50 +175,16 @@ void sys_sleep(int ms) {
 
 void sys_plat_init(void) {
     mblock_init(&task_mblock, task_tbl, sizeof(net_task_t), NET_TASK_NR, NLOCKER_NONE);
-    mblock_init(&sem_mblock, sem_tbl, sizeof(sem_t), NET_SEM_NR, NLOCKER_NONE);
-    mblock_init(&mutex_mblock, mutex_tbl, sizeof(mutex_t), NET_MUTEX_NR, NLOCKER_NONE);
 }
 	
  // windows
 #elif defined(SYS_PLAT_WINDOWS)
 
 #include <winsock.h>
-#include <tchar.h>
 #include <time.h>
-#include "pcap.h"
 
 #pragma comment(lib, "ws2_32.lib")  // 加载win32的网络库
 
-/**
- * 调整npcap的搜索路径：默认安装在系统的dll路径\npcap目录下
- * 设置该路径，以避免使用其它已经安装的winbcap版本的dll
- * 注意：要先安装npcap软件包
- */
-int load_pcap_lib() {
-    static int dll_loaded = 0;
-    _TCHAR  npcap_dir[512];
-    int size;
-
-    if (dll_loaded) {
-        return 0;
-    }
-
-    size = GetSystemDirectory(npcap_dir, 480);
-    if (!size) {
-        fprintf(stderr, "Error in GetSystemDirectory: %x", GetLastError());
-        return -1;
-    }
-
-    _tcscat_s(npcap_dir, 512, _T("\\Npcap"));
-    if (SetDllDirectory(npcap_dir) == 0) {
-        fprintf(stderr, "Error in SetDllDirectory: %x", GetLastError());
-        return -1;
-    }
-
-    dll_loaded = 1;
-    return 0;
-}
-
 /**
  * @brief 获取当前时间
  */
@@ -200,17 +210,151 @@ int sys_time_goes (net_time_t * pre) {
     return diff_ms;
 }
 
-sys_sem_t sys_sem_create(int init_count) {
-    return CreateSemaphore(NULL, init_count, 0xFFFF, NULL);
+/**
+ * @brief 获取单调递增的纳秒时间，用于测量时间间隔
+ */
+uint64_t sys_time_ns (void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER counter;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&counter);
+
+    // 分两部分计算，避免乘法溢出
+    uint64_t sec = counter.QuadPart / freq.QuadPart;
+    uint64_t rem = counter.QuadPart % freq.QuadPart;
+    return sec * 1000000000ULL + rem * 1000000000ULL / freq.QuadPart;
+}
+
+// 分配的内存前保留一个cache行，记录释放方式
+typedef struct _mem_hdr_t {
+    SIZE_T map_size;                // 非0表示由VirtualAlloc分配
+}mem_hdr_t;
+
+static void * mem_mark (void * mem, SIZE_T map_size) {
+    ((mem_hdr_t *)mem)->map_size = map_size;
+    return (uint8_t *)mem + SYS_CACHE_LINE_SIZE;
+}
+
+/**
+ * @brief 分配按cache行对齐的内存，可选使用大页
+ *
+ * 大页需要SeLockMemoryPrivilege权限，分配失败时退回普通内存
+ */
+void * sys_mem_alloc(int size, int flags) {
+    if (size < 0) {
+        return (void *)0;
+    }
+
+    int node = SYS_MEM_NODE_GET(flags);
+    SIZE_T total = (SIZE_T)size + SYS_CACHE_LINE_SIZE;
+
+    if (flags & SYS_MEM_HUGEPAGE) {
+        SIZE_T page_size = GetLargePageMinimum();
+        if (page_size) {
+            SIZE_T huge_size = (total + page_size - 1) & ~(page_size - 1);
+            DWORD type = MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES;
+            void * mem = node >= 0 ? VirtualAllocExNuma(GetCurrentProcess(), NULL, huge_size, type, PAGE_READWRITE, node)
+                                   : VirtualAlloc(NULL, huge_size, type, PAGE_READWRITE);
+            if (mem) {
+                return mem_mark(mem, 1);
+            }
+        }
+    }
+
+    if ((node >= 0) && (sys_numa_node_cnt() > 1)) {
+        void * mem = VirtualAllocExNuma(GetCurrentProcess(), NULL, total, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE, node);
+        if (mem) {
+            return mem_mark(mem, 1);
+        }
+    }
+
+    void * mem = _aligned_malloc(total, SYS_CACHE_LINE_SIZE);
+    return mem ? mem_mark(mem, 0) : (void *)0;
 }
 
-void sys_sem_free(sys_sem_t sem) {
-    CloseHandle(sem);
+void sys_mem_free(void * mem) {
+    if (!mem) {
+        return;
+    }
+
+    mem_hdr_t * hdr = (mem_hdr_t *)((uint8_t *)mem - SYS_CACHE_LINE_SIZE);
+    if (hdr->map_size) {
+        VirtualFree(hdr, 0, MEM_RELEASE);
+    } else {
+        _aligned_free(hdr);
+    }
 }
 
-int sys_sem_wait(sys_sem_t sem, uint32_t tmo_ms) {
+/**
+ * @brief 创建命名的共享内存，供其它进程只读访问，进程运行期间不释放
+ */
+void * sys_shm_create(const char * name, int size) {
+    HANDLE map = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, size, name);
+    if (map == NULL) {
+        return (void *)0;
+    }
+
+    void * mem = MapViewOfFile(map, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (mem == NULL) {
+        CloseHandle(map);
+        return (void *)0;
+    }
+    return mem;
+}
+
+/**
+ * @brief 分配可执行内存并复制代码，写入后改为只读可执行
+ */
+void * sys_code_alloc(const void * code, int size) {
+    void * mem = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (mem == NULL) {
+        return (void *)0;
+    }
+
+    DWORD old;
+    memcpy(mem, code, size);
+    if (!VirtualProtect(mem, size, PAGE_EXECUTE_READ, &old)) {
+        VirtualFree(mem, 0, MEM_RELEASE);
+        return (void *)0;
+    }
+    FlushInstructionCache(GetCurrentProcess(), mem, size);
+    return mem;
+}
+
+void sys_code_free(void * mem, int size) {
+    VirtualFree(mem, 0, MEM_RELEASE);
+}
+
+int sys_numa_node_cnt (void) {
+    ULONG highest;
+    return GetNumaHighestNodeNumber(&highest) ? (int)highest + 1 : 1;
+}
+
+int sys_numa_node_curr (void) {
+    UCHAR node;
+    return GetNumaProcessorNode((UCHAR)GetCurrentProcessorNumber(), &node) && (node != 0xFF) ? node : 0;
+}
+
+uint64_t sys_numa_cpu_mask (int node) {
+    ULONGLONG mask;
+    return GetNumaNodeProcessorMask((UCHAR)node, &mask) ? mask : 0;
+}
+
+int sys_sem_init(sys_sem_t * sem, int init_count) {
+    *sem = CreateSemaphore(NULL, init_count, 0xFFFF, NULL);
+    return *sem ? 0 : -1;
+}
+
+void sys_sem_destroy(sys_sem_t * sem) {
+    CloseHandle(*sem);
+}
+
+int sys_sem_wait(sys_sem_t * sem, uint32_t tmo_ms) {
     DWORD tmo = (tmo_ms == 0) ? INFINITE : tmo_ms;
-    DWORD  err = WaitForSingleObject(sem, tmo);
+    DWORD  err = WaitForSingleObject(*sem, tmo);
     if (err == WAIT_OBJECT_0) {
         return 0;
     }
@@ -223,55 +367,90 @@ int sys_sem_wait(sys_sem_t sem, uint32_t tmo_ms) {
     return -1;
 }
 
-void sys_sem_notify(sys_sem_t sem) {
-    ReleaseSemaphore(sem, 1, NULL);
+void sys_sem_notify(sys_sem_t * sem) {
+    ReleaseSemaphore(*sem, 1, NULL);
 }
 
 /**
- * 创建线程互斥锁
- * @return 创建的互斥信号量
+ * 初始化线程互斥锁，使用临界区，无竞争时不进入内核
+ * @param mutex 待初始化的互斥信号量
  */
-sys_mutex_t sys_mutex_create(void) {
-    sys_mutex_t mutex = CreateMutex(NULL, FALSE, NULL); // 初始不被占用
-    if (mutex == NULL) {
-        return SYS_MUTEx_INVALID;
-    }
-    return mutex;
+int sys_mutex_init(sys_mutex_t * mutex) {
+    InitializeCriticalSection(mutex);
+    return 0;
 }
 
 /**
  * 释放互斥信号量
  * @param mutex
  */
-void sys_mutex_free(sys_mutex_t locker) {
-    ReleaseMutex(locker);
+void sys_mutex_destroy(sys_mutex_t * mutex) {
+    DeleteCriticalSection(mutex);
 }
 
 /**
  * 锁定线程互斥锁
  * @param mutex 待锁定的互斥信号量
  */
-void sys_mutex_lock(sys_mutex_t locker) {
-    WaitForSingleObject(locker, INFINITE);
+void sys_mutex_lock(sys_mutex_t * mutex) {
+    EnterCriticalSection(mutex);
 }
 
 /**
  * 释放线程互斥锁
  * @param mutex 待释放的互斥信号量
  */
-void sys_mutex_unlock(sys_mutex_t locker) {
-    ReleaseMutex(locker);
+void sys_mutex_unlock(sys_mutex_t * mutex) {
+    LeaveCriticalSection(mutex);
 }
 
 sys_thread_t sys_thread_create(void (*entry)(void * arg), void* arg) {
-    return CreateThread(
+    return sys_thread_create_attr(entry, arg, (const sys_thread_attr_t *)0);
+}
+
+/**
+ * 设置线程名称，SetThreadDescription仅在Windows 10 1607之后提供，动态查找
+ */
+static void thread_set_name (HANDLE thread, const char * name) {
+    typedef HRESULT (WINAPI * set_desc_t)(HANDLE, PCWSTR);
+    set_desc_t set_desc = (set_desc_t)GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+    if (set_desc) {
+        WCHAR wname[64];
+        MultiByteToWideChar(CP_UTF8, 0, name, -1, wname, 64);
+        wname[63] = 0;
+        set_desc(thread, wname);
+    }
+}
+
+sys_thread_t sys_thread_create_attr(void (*entry)(void * arg), void* arg, const sys_thread_attr_t * attr) {
+    HANDLE thread = CreateThread(
         NULL,                           // SD
-        0,                              // initial stack size
+        attr ? attr->stack_size : 0,    // initial stack size
         (LPTHREAD_START_ROUTINE)entry,  // thread function
         arg,                            // thread argument
-        0,                              // 创建后立即运行
+        CREATE_SUSPENDED,               // 设置好属性后再运行
         NULL                            // thread identifier
         );
+    if (thread == NULL) {
+        return SYS_THREAD_INVALID;
+    }
+
+    if (attr) {
+        if (attr->cpu_mask && !SetThreadAffinityMask(thread, (DWORD_PTR)attr->cpu_mask)) {
+            printf("set thread affinity failed: %lu\n", GetLastError());
+        }
+
+        if (attr->priority > 0) {
+            SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL);
+        }
+
+        if (attr->name) {
+            thread_set_name(thread, attr->name);
+        }
+    }
+
+    ResumeThread(thread);
+    return thread;
 }
 
 /**
@@ -296,22 +475,22 @@ void sys_plat_init(void) {
 }
 
 #elif defined(SYS_PLAT_LINUX) || defined(SYS_PLAT_MAC)
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <pthread.h>
-#include <semaphore.h>
-#include "pcap.h"
-
 #include <stdio.h>
 #include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 #include <semaphore.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include "natomic.h"
 
-int load_pcap_lib(void) {
-    return 0;
-}
+#if defined(SYS_PLAT_LINUX)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define SYS_HUGEPAGE_SIZE       (2*1024*1024)
 
 /**
  * @brief 获取当前时间
@@ -338,34 +517,316 @@ int sys_time_goes (net_time_t * pre) {
     return diff_ms;
 }
 
-sys_sem_t sys_sem_create(int init_count) {
-    sys_sem_t sem = (sys_sem_t)malloc(sizeof(struct _xsys_sem_t));
-    if (!sem) {
-        return (sys_sem_t)0;
+/**
+ * @brief 获取单调递增的纳秒时间，用于测量时间间隔
+ */
+uint64_t sys_time_ns (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(SYS_PLAT_LINUX)
+#define SYS_MPOL_PREFERRED      1               // 同<numaif.h>中的MPOL_PREFERRED，不依赖libnuma
+
+/**
+ * 读取sysfs中"0-3,8-11"格式的列表，转换为位图，超过63的编号被忽略
+ */
+static uint64_t read_id_list (const char * path) {
+    FILE * file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    uint64_t mask = 0;
+    int start, end;
+    while (fscanf(file, "%d", &start) == 1) {
+        end = start;
+        int c = fgetc(file);
+        if ((c == '-') && (fscanf(file, "%d", &end) == 1)) {
+            c = fgetc(file);
+        }
+
+        for (int i = start; (i <= end) && (i < 64); i++) {
+            mask |= 1ULL << i;
+        }
+
+        if (c != ',') {
+            break;
+        }
+    }
+    fclose(file);
+    return mask;
+}
+
+/**
+ * 设置内存的首选节点，需在首次访问之前调用，页面在首次访问时从该节点分配
+ */
+static void mem_bind_node (void * mem, size_t size, int node) {
+    if ((node < 0) || (node >= 64)) {
+        return;
+    }
+
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, mem, size, SYS_MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+}
+
+int sys_numa_node_cnt (void) {
+    static int node_cnt;
+    if (node_cnt == 0) {
+        uint64_t mask = read_id_list("/sys/devices/system/node/online");
+        int cnt = 1;
+        while ((cnt < 64) && (mask >> cnt)) {
+            cnt++;
+        }
+        node_cnt = cnt;
+    }
+    return node_cnt;
+}
+
+int sys_numa_node_curr (void) {
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0) {
+        return 0;
+    }
+    return (int)node;
+}
+
+uint64_t sys_numa_cpu_mask (int node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    return read_id_list(path);
+}
+#else
+#define mem_bind_node(mem, size, node)
+
+// Mac没有NUMA
+int sys_numa_node_cnt (void) {
+    return 1;
+}
+
+int sys_numa_node_curr (void) {
+    return 0;
+}
+
+uint64_t sys_numa_cpu_mask (int node) {
+    return 0;
+}
+#endif
+
+// 分配的内存前保留一个cache行，记录释放方式
+typedef struct _mem_hdr_t {
+    size_t map_size;                // 非0表示由mmap映射
+}mem_hdr_t;
+
+static void * mem_mark (void * mem, size_t map_size) {
+    ((mem_hdr_t *)mem)->map_size = map_size;
+    return (uint8_t *)mem + SYS_CACHE_LINE_SIZE;
+}
+
+/**
+ * @brief 分配按cache行对齐的内存，可选使用大页
+ *
+ * 系统未预留大页(/proc/sys/vm/nr_hugepages)时，退回普通内存
+ */
+void * sys_mem_alloc(int size, int flags) {
+    if (size < 0) {
+        return (void *)0;
+    }
+
+    int node = SYS_MEM_NODE_GET(flags);
+    size_t total = (size_t)size + SYS_CACHE_LINE_SIZE;
+
+#ifdef MAP_HUGETLB
+    if (flags & SYS_MEM_HUGEPAGE) {
+        size_t huge_size = (total + SYS_HUGEPAGE_SIZE - 1) & ~((size_t)SYS_HUGEPAGE_SIZE - 1);
+        void * mem = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            mem_bind_node(mem, huge_size, node);
+            return mem_mark(mem, huge_size);
+        }
+    }
+#endif
+
+    // 指定节点时单独映射，保证页面不与其它分配共用
+    if ((node >= 0) && (sys_numa_node_cnt() > 1)) {
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_t map_size = (total + page_size - 1) & ~(page_size - 1);
+        void * mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            mem_bind_node(mem, map_size, node);
+            return mem_mark(mem, map_size);
+        }
+    }
+
+    void * mem;
+    if (posix_memalign(&mem, SYS_CACHE_LINE_SIZE, total) != 0) {
+        return (void *)0;
+    }
+    return mem_mark(mem, 0);
+}
+
+void sys_mem_free(void * mem) {
+    if (!mem) {
+        return;
+    }
+
+    mem_hdr_t * hdr = (mem_hdr_t *)((uint8_t *)mem - SYS_CACHE_LINE_SIZE);
+    if (hdr->map_size) {
+        munmap(hdr, hdr->map_size);
+    } else {
+        free(hdr);
+    }
+}
+
+/**
+ * @brief 创建命名的共享内存，供其它进程只读访问，进程运行期间不释放
+ *
+ * Linux下位于/dev/shm/name
+ */
+void * sys_shm_create(const char * name, int size) {
+    char path[64];
+    snprintf(path, sizeof(path), "/%s", name);
+
+    int fd = shm_open(path, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        return (void *)0;
     }
 
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return (void *)0;
+    }
+
+    void * mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return mem == MAP_FAILED ? (void *)0 : mem;
+}
+
+/**
+ * @brief 分配可执行内存并复制代码，写入后改为只读可执行，不同时可写可执行
+ */
+void * sys_code_alloc(const void * code, int size) {
+    void * mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return (void *)0;
+    }
+
+    memcpy(mem, code, size);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) < 0) {
+        munmap(mem, size);
+        return (void *)0;
+    }
+    return mem;
+}
+
+void sys_code_free(void * mem, int size) {
+    munmap(mem, size);
+}
+
+#if defined(SYS_PLAT_LINUX)
+static int futex_wait (volatile int * addr, int value, const struct timespec * deadline) {
+    // FUTEX_WAIT_BITSET使用CLOCK_MONOTONIC的绝对时间，不受系统时间调整的影响
+    return syscall(SYS_futex, addr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, value, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void futex_wake (volatile int * addr, int cnt) {
+    syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, cnt, NULL, NULL, 0);
+}
+
+static int sem_try_take (sys_sem_t * sem) {
+    int count = natomic_load(&sem->count);
+    while (count > 0) {
+        if (natomic_cas(&sem->count, &count, count - 1)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int sys_sem_init(sys_sem_t * sem, int init_count) {
+    sem->count = init_count;
+    sem->waiters = 0;
+    return 0;
+}
+
+/**
+ * 释放掉信号量
+ */
+void sys_sem_destroy(sys_sem_t * sem) {
+}
+
+/**
+ * 等待信号量
+ * @param sem 等待的信号量
+ * @param tmo 等待的超时时间，为0时一直等待
+ */
+int sys_sem_wait(sys_sem_t * sem, uint32_t tmo_ms) {
+    // 有资源时直接取走，不进入内核
+    if (sem_try_take(sem)) {
+        return 0;
+    }
+
+    struct timespec deadline;
+    if (tmo_ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += tmo_ms / 1000;
+        deadline.tv_nsec += (tmo_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    natomic_add(&sem->waiters, 1);
+    while (!sem_try_take(sem)) {
+        // 计数仍为0时才睡眠，期间有通知则立即返回重试
+        if ((futex_wait(&sem->count, 0, tmo_ms > 0 ? &deadline : NULL) < 0) && (errno == ETIMEDOUT)) {
+            natomic_add(&sem->waiters, -1);
+            return -1;
+        }
+    }
+    natomic_add(&sem->waiters, -1);
+    return 0;
+}
+
+/**
+ * 通知信号量
+ * @param sem 待通知的信号量
+ */
+void sys_sem_notify(sys_sem_t * sem) {
+    natomic_add(&sem->count, 1);
+
+    // 没有线程等待时，不进入内核
+    if (natomic_load(&sem->waiters) > 0) {
+        futex_wake(&sem->count, 1);
+    }
+}
+#else
+int sys_sem_init(sys_sem_t * sem, int init_count) {
     sem->count = init_count;
 
     int err = pthread_cond_init(&(sem->cond), NULL);
     if (err) {
-        return (sys_sem_t)0;
+        return -1;
     }
 
     err = pthread_mutex_init(&(sem->locker), NULL);
     if (err) {
-        return (sys_sem_t)0;
+        pthread_cond_destroy(&(sem->cond));
+        return -1;
     }
 
-    return sem;
+    return 0;
 }
 
 /**
  * 释放掉信号量
  */
-void sys_sem_free(sys_sem_t sem) {
+void sys_sem_destroy(sys_sem_t * sem) {
     pthread_cond_destroy(&(sem->cond));
     pthread_mutex_destroy(&(sem->locker));
-    free(sem);
 }
 
 /**
@@ -373,16 +834,26 @@ void sys_sem_free(sys_sem_t sem) {
  * @param sem 等待的信号量
  * @param tmo 等待的超时时间
  */
-int sys_sem_wait(sys_sem_t sem, uint32_t tmo_ms) {
+int sys_sem_wait(sys_sem_t * sem, uint32_t tmo_ms) {
+    struct timespec ts;
+    if (tmo_ms > 0) {
+        // pthread_cond_timedwait使用绝对时间
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        ts.tv_sec = now.tv_sec + tmo_ms / 1000;
+        ts.tv_nsec = now.tv_usec * 1000L + (tmo_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+    }
+
     pthread_mutex_lock(&(sem->locker));
 
-    if (sem->count <= 0) {
+    while (sem->count <= 0) {
         int ret;
 
         if (tmo_ms > 0) {
-            struct timespec ts;
-            ts.tv_nsec = (tmo_ms % 1000) * 1000000L;
-            ts.tv_sec = time(NULL) + tmo_ms / 1000;
             ret = pthread_cond_timedwait(&sem->cond, &sem->locker, &ts);
             if (ret == ETIMEDOUT) {
                 pthread_mutex_unlock(&(sem->locker));
@@ -406,7 +877,7 @@ int sys_sem_wait(sys_sem_t sem, uint32_t tmo_ms) {
  * 通知信号量
  * @param sem 待通知的信号量
  */
-void sys_sem_notify(sys_sem_t sem) {
+void sys_sem_notify(sys_sem_t * sem) {
     pthread_mutex_lock(&(sem->locker));
 
     sem->count++;
@@ -416,6 +887,7 @@ void sys_sem_notify(sys_sem_t sem) {
 
     pthread_mutex_unlock(&(sem->locker));
 }
+#endif
 
 /**
  * 创建一个线程
@@ -438,6 +910,93 @@ sys_thread_t sys_thread_create(void (*entry)(void * arg), void* arg) {
     return pthread;
 }
 
+typedef struct _thread_start_t {
+    sys_thread_func_t entry;
+    void * arg;
+    char name[16];
+}thread_start_t;
+
+/**
+ * 需要命名的线程从这里启动，Mac上只能由线程自己设置名称
+ */
+static void * thread_start (void * arg) {
+    thread_start_t start = *(thread_start_t *)arg;
+    free(arg);
+
+#if defined(SYS_PLAT_LINUX)
+    pthread_setname_np(pthread_self(), start.name);
+#else
+    pthread_setname_np(start.name);
+#endif
+    start.entry(start.arg);
+    return NULL;
+}
+
+/**
+ * 按指定的属性创建线程。没有实时调度的权限时（Linux下需要CAP_SYS_NICE）退回到普通调度
+ */
+sys_thread_t sys_thread_create_attr(sys_thread_func_t entry, void* arg, const sys_thread_attr_t * attr) {
+    if (!attr) {
+        return sys_thread_create(entry, arg);
+    }
+
+    pthread_attr_t pattr;
+    pthread_attr_init(&pattr);
+    if (attr->stack_size > 0) {
+        pthread_attr_setstacksize(&pattr, attr->stack_size);
+    }
+
+#if defined(SYS_PLAT_LINUX)
+    if (attr->cpu_mask) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int i = 0; i < 64; i++) {
+            if (attr->cpu_mask & (1ULL << i)) {
+                CPU_SET(i, &cpu_set);
+            }
+        }
+        pthread_attr_setaffinity_np(&pattr, sizeof(cpu_set), &cpu_set);
+    }
+#endif
+
+    if (attr->priority > 0) {
+        struct sched_param param = {.sched_priority = attr->priority};
+        pthread_attr_setinheritsched(&pattr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&pattr, SCHED_FIFO);
+        pthread_attr_setschedparam(&pattr, &param);
+    }
+
+    void * (*start)(void *) = (void* (*)(void * arg))entry;
+    void * start_arg = arg;
+    thread_start_t * start_info = (thread_start_t *)0;
+    if (attr->name) {
+        start_info = (thread_start_t *)malloc(sizeof(thread_start_t));
+        if (start_info) {
+            start_info->entry = entry;
+            start_info->arg = arg;
+            plat_strncpy(start_info->name, attr->name, sizeof(start_info->name) - 1);
+            start_info->name[sizeof(start_info->name) - 1] = '\0';
+            start = thread_start;
+            start_arg = start_info;
+        }
+    }
+
+    pthread_t pthread;
+    int err = pthread_create(&pthread, &pattr, start, start_arg);
+    if ((err == EPERM) && (attr->priority > 0)) {
+        printf("no permission for SCHED_FIFO, thread %s uses normal scheduling\n", attr->name ? attr->name : "");
+        pthread_attr_setinheritsched(&pattr, PTHREAD_INHERIT_SCHED);
+        err = pthread_create(&pthread, &pattr, start, start_arg);
+    }
+    pthread_attr_destroy(&pattr);
+
+    if (err) {
+        free(start_info);
+        return (pthread_t)0;
+    }
+    return pthread;
+}
+
 /**
  * 销毁线程
  */
@@ -452,252 +1011,100 @@ void sys_sleep(int ms) {
     usleep(1000 * ms);
 }
 
+#if defined(SYS_PLAT_LINUX)
 /**
- * 创建线程互斥锁
- * @return 创建的互斥信号量
+ * 初始化线程互斥锁
+ * @param mutex 待初始化的互斥信号量
  */
-sys_mutex_t sys_mutex_create(void) {
-    sys_mutex_t mutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-
-    int err = pthread_mutex_init(mutex, NULL);
-    if (err < 0) {
-        return (sys_mutex_t)0;
-    }
-    return mutex;
+int sys_mutex_init(sys_mutex_t * mutex) {
+    mutex->state = 0;
+    return 0;
 }
 
 /**
  * 释放互斥信号量
  * @param mutex
  */
-void sys_mutex_free(sys_mutex_t locker) {
-    pthread_mutex_destroy(locker);
-    free(locker);
+void sys_mutex_destroy(sys_mutex_t * mutex) {
 }
 
 /**
  * 锁定线程互斥锁
  * @param mutex 待锁定的互斥信号量
  */
-void sys_mutex_lock(sys_mutex_t locker) {
-    pthread_mutex_lock(locker);
+void sys_mutex_lock(sys_mutex_t * mutex) {
+    // 未被占用时直接获取，不进入内核
+    int state = 0;
+    if (natomic_cas(&mutex->state, &state, 1)) {
+        return;
+    }
+
+    // 标记有线程等待，直到取得锁
+    if (state != 2) {
+        state = natomic_xchg(&mutex->state, 2);
+    }
+
+    while (state != 0) {
+        futex_wait(&mutex->state, 2, NULL);
+        state = natomic_xchg(&mutex->state, 2);
+    }
 }
 
 /**
  * 释放线程互斥锁
  * @param mutex 待释放的互斥信号量
  */
-void sys_mutex_unlock(sys_mutex_t locker) {
-    pthread_mutex_unlock(locker);
-}
-
-
-void sys_thread_exit (int error) {
-    // 不实现，加入os内核后，应用层不需要使用该接口
-}
-
-sys_thread_t sys_thread_self (void) {
-    return pthread_self();
+void sys_mutex_unlock(sys_mutex_t * mutex) {
+    // 没有线程等待时，不进入内核
+    if (natomic_add(&mutex->state, -1) != 0) {
+        natomic_store(&mutex->state, 0);
+        futex_wake(&mutex->state, 1);
+    }
 }
-
-void sys_plat_init(void) {
+#else
+/**
+ * 初始化线程互斥锁
+ * @param mutex 待初始化的互斥信号量
+ */
+int sys_mutex_init(sys_mutex_t * mutex) {
+    return pthread_mutex_init(mutex, NULL) ? -1 : 0;
 }
 
-#endif
-
-#if defined(NET_DRIVER_PCAP)
-#include <pcap.h>
-
 /**
- * 根据ip地址查找本地网络接口列表，找到相应的名称
+ * 释放互斥信号量
+ * @param mutex
  */
-int pcap_find_device(const char* ip, char* name_buf) {
-    struct in_addr dest_ip;
-
-    inet_pton(AF_INET, ip, &dest_ip);
-
-    // 获取所有的接口列表
-    char err_buf[PCAP_ERRBUF_SIZE];
-    pcap_if_t* pcap_if_list = NULL;
-    int err = pcap_findalldevs(&pcap_if_list, err_buf);
-    if (err < 0) {
-        pcap_freealldevs(pcap_if_list);
-        return -1;
-    }
-
-    // 遍历列表
-    pcap_if_t* item;
-    for (item = pcap_if_list; item != NULL; item = item->next) {
-        if (item->addresses == NULL) {
-            continue;
-        }
-
-        // 查找地址
-        for (struct pcap_addr* pcap_addr = item->addresses; pcap_addr != NULL; pcap_addr = pcap_addr->next) {
-            // 检查ipv4地址类型
-            struct sockaddr* sock_addr = pcap_addr->addr;
-            if (sock_addr->sa_family != AF_INET) {
-                continue;
-            }
-
-            // 地址相同则返回
-            struct sockaddr_in* curr_addr = ((struct sockaddr_in*)sock_addr);
-            if (curr_addr->sin_addr.s_addr == dest_ip.s_addr) {
-                strcpy(name_buf, item->name);
-                pcap_freealldevs(pcap_if_list);
-                return 0;
-            }
-        }
-    }
-
-    pcap_freealldevs(pcap_if_list);
-    return -1;
+void sys_mutex_destroy(sys_mutex_t * mutex) {
+    pthread_mutex_destroy(mutex);
 }
 
-/*
- * 显示所有的网络接口列表，在出错时被调用
+/**
+ * 锁定线程互斥锁
+ * @param mutex 待锁定的互斥信号量
  */
-int pcap_show_list(void) {
-    char err_buf[PCAP_ERRBUF_SIZE];
-    pcap_if_t* pcapif_list = NULL;
-    int count = 0;
-
-    // 查找所有的网络接口
-    int err = pcap_findalldevs(&pcapif_list, err_buf);
-    if (err < 0) {
-        fprintf(stderr, "scan net card failed: %s\n", err_buf);
-        pcap_freealldevs(pcapif_list);
-        return -1;
-    }
-
-    printf("net card list: \n");
-
-    // 遍历所有的可用接口，输出其信息
-    for (pcap_if_t* item = pcapif_list; item != NULL; item = item->next) {
-        if (item->addresses == NULL) {
-            continue;
-        }
-
-        // 显示ipv4地址
-        for (struct pcap_addr* pcap_addr = item->addresses; pcap_addr != NULL; pcap_addr = pcap_addr->next) {
-            char str[INET_ADDRSTRLEN];
-            struct sockaddr_in* ip_addr;
-
-            struct sockaddr* sockaddr = pcap_addr->addr;
-            if (sockaddr->sa_family != AF_INET) {
-                continue;
-            }
-
-            ip_addr = (struct sockaddr_in*)sockaddr;
-            char * name = item->description;
-            if (name == NULL) {
-                name = item->name;
-            }
-            printf("%d: IP:%s name: %s, \n",
-                count++,
-                name ? name : "unknown",
-                inet_ntop(AF_INET, &ip_addr->sin_addr, str, sizeof(str))
-            );
-            break;
-        }
-    }
-
-    pcap_freealldevs(pcapif_list);
-
-    if ((pcapif_list == NULL) || (count == 0)) {
-        fprintf(stderr, "error: no net card!\n");
-        return -1;
-    }
-
-    printf("no net card found, check system configuration\n");
-    return 0;
+void sys_mutex_lock(sys_mutex_t * mutex) {
+    pthread_mutex_lock(mutex);
 }
 
 /**
- * 打开pcap设备接口
+ * 释放线程互斥锁
+ * @param mutex 待释放的互斥信号量
  */
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr) {
-    // 加载pcap库
-    if (load_pcap_lib() < 0) {
-        fprintf(stderr, "load pcap lib error。在windows上，请课程提供的安装npcap.dll\n");
-        return (pcap_t *)0;
-    }
-
-    // 利用上层传来的ip地址，
-    char name_buf[256];
-    if (pcap_find_device(ip, name_buf) < 0) {
-        fprintf(stderr, "pcap find error: no net card has ip: %s. \n", ip);
-        pcap_show_list();
-        return (pcap_t*)0;
-    }
-
-    // 根据名称获取ip地址、掩码等
-    char err_buf[PCAP_ERRBUF_SIZE];
-    bpf_u_int32 mask;
-    bpf_u_int32 net;
-    if (pcap_lookupnet(name_buf, &net, &mask, err_buf) == -1) {
-        printf("pcap_lookupnet error: no net card: %s\n", name_buf);
-        net = 0;
-        mask = 0;
-    }
-
-    // 打开设备
-    pcap_t * pcap = pcap_create(name_buf, err_buf);
-    if (pcap == NULL) {
-        fprintf(stderr, "pcap_create: create pcap failed %s\n net card name: %s\n", err_buf, name_buf);
-        fprintf(stderr, "Use the following:\n");
-        pcap_show_list();
-        return (pcap_t*)0;
-    }
-
-    if (pcap_set_snaplen(pcap, 65536) != 0) {
-        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
-
-    if (pcap_set_promisc(pcap, 1) != 0) {
-        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
-
-    if (pcap_set_timeout(pcap, 0) != 0) {
-        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
+void sys_mutex_unlock(sys_mutex_t * mutex) {
+    pthread_mutex_unlock(mutex);
+}
+#endif
 
-    // 非阻塞模式读取，程序中使用查询的方式读
-    if (pcap_set_immediate_mode(pcap, 1) != 0) {
-        fprintf(stderr, "pcap_open: set im block failed: %s\n", pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
 
-    if (pcap_activate(pcap) != 0) {
-        fprintf(stderr, "pcap_open: active failed: %s\n", pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
+void sys_thread_exit (int error) {
+    // 不实现，加入os内核后，应用层不需要使用该接口
+}
 
-    if (pcap_setnonblock(pcap, 0, err_buf) != 0) {
-        fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
+sys_thread_t sys_thread_self (void) {
+    return pthread_self();
+}
 
-    // 只捕获发往本接口与广播的数据帧。相当于只处理发往这张网卡的包
-    char filter_exp[256];
-    struct bpf_program fp;
-    sprintf(filter_exp,
-        "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
-        mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
-        mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-    if (pcap_compile(pcap, &fp, filter_exp, 0, net) == -1) {
-        printf("pcap_open: couldn't parse filter %s: %s\n", filter_exp, pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
-    if (pcap_setfilter(pcap, &fp) == -1) {
-        printf("pcap_open: couldn't install filter %s: %s\n", filter_exp, pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
-    return pcap;
+void sys_plat_init(void) {
 }
 
 #endif
-
@@ -55,12 +55,10 @@ typedef long ssize_t;
 typedef uint32_t net_time_t;      // 时间类型
 
 #define SYS_THREAD_INVALID          (task_t *)0
-#define SYS_SEM_INVALID             (sem_t *)0
-#define SYS_MUTEx_INVALID           (mutex_t *)0
 
-typedef mutex_t * sys_mutex_t;        // 互斥锁
+typedef mutex_t sys_mutex_t;          // 互斥锁
 typedef task_t * sys_thread_t;        // 线程
-typedef sem_t * sys_sem_t;            // 信号量
+typedef sem_t sys_sem_t;              // 信号量
 
 #define plat_strlen         kernel_strlen
 #define plat_strcpy         kernel_strcpy
@@ -75,24 +73,22 @@ typedef sem_t * sys_sem_t;            // 信号量
 #define plat_printf         log_printf
 
 #elif defined(SYS_PLAT_WINDOWS)
-// pcap引用了winsock.h，下面用了windows，有些宏重复了
-// 加上下面的宏可避免编译出错
+// 使用者可能同时包含winsock2.h，不引入windows.h中旧的winsock定义，避免宏重复
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
-#include <pcap.h>
 #include <stdio.h>
 #include <string.h>
 
 typedef DWORD net_time_t;      // 时间类型
 
 #define SYS_THREAD_INVALID          (HANDLE)0
-#define SYS_SEM_INVALID             (HANDLE)0
-#define SYS_MUTEx_INVALID           (HANDLE)0
 
-typedef HANDLE sys_mutex_t;         // 互斥锁
+typedef CRITICAL_SECTION sys_mutex_t;   // 互斥锁
 typedef HANDLE sys_thread_t;        // 线程
 typedef HANDLE sys_sem_t;           // 信号量
 
+#define SYS_THREAD_LOCAL    __declspec(thread)      // 线程局部变量
+
 #define plat_strlen         strlen
 #define plat_strcpy         strcpy
 #define plat_strncpy        strncpy
@@ -105,11 +101,6 @@ typedef HANDLE sys_sem_t;           // 信号量
 #define plat_vsprintf       vsprintf
 #define plat_printf         printf
 
-// PCAP网卡驱动相关函数
-int pcap_find_device(const char* ip, char* name_buf);
-int pcap_show_list(void);
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
-
 #elif defined(SYS_PLAT_LINUX) || defined(SYS_PLAT_MAC)
 
 #include <semaphore.h>
@@ -117,15 +108,12 @@ pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
 #include <unistd.h>
 #include <sys/time.h>
 #include <errno.h>
-#include <pcap.h>
 #include <string.h>
 #include <stdlib.h>
 
 typedef struct timeval net_time_t;      // 时间类型
 
 #define SYS_THREAD_INVALID          (sys_thread_t)0
-#define SYS_SEM_INVALID             (sys_sem_t)0
-#define SYS_MUTEx_INVALID           (sys_mutex_t)0
 
 #define plat_strlen         strlen
 #define plat_strcpy         strcpy
@@ -139,39 +127,81 @@ typedef struct timeval net_time_t;      // 时间类型
 #define plat_vsprintf       vsprintf
 #define plat_printf         printf
 
+#if defined(SYS_PLAT_LINUX)
+// 基于futex实现，无竞争时不进入内核
+typedef struct _xsys_sem_t {
+    volatile int count;                 // 信号量计数
+    volatile int waiters;               // 等待的线程数量
+} sys_sem_t;
+
+typedef struct _xsys_mutex_t {
+    volatile int state;                 // 0-未锁定，1-已锁定，2-已锁定且有线程等待
+} sys_mutex_t;
+#else
 typedef struct _xsys_sem_t {
     int count;                          // 信号量计数
     pthread_cond_t cond;                // 条件变量
     pthread_mutex_t locker;             // 访问C的互斥锁
-} * sys_sem_t;
+} sys_sem_t;
+
+typedef pthread_mutex_t sys_mutex_t;      // 互斥信号量
+#endif
 
 typedef pthread_t sys_thread_t;           // 线程重定义
-typedef pthread_mutex_t * sys_mutex_t;      // 互斥信号量
 
-// PCAP网卡驱动相关函数
-int pcap_find_device(const char* ip, char* name_buf);
-int pcap_show_list(void);
-pcap_t * pcap_device_open(const char* ip, const uint8_t* mac_addr);
+#define SYS_THREAD_LOCAL    __thread                // 线程局部变量
 
 #else
     #error "Unkonw platform"
 #endif // Unix/Linux
 
-sys_sem_t sys_sem_create(int init_count);
-void sys_sem_free(sys_sem_t sem);
-int sys_sem_wait(sys_sem_t sem, uint32_t ms);
-void sys_sem_notify(sys_sem_t sem);
+#define SYS_CACHE_LINE_SIZE         64              // 内存池对齐的cache行大小
+#define SYS_MEM_HUGEPAGE            (1 << 0)        // 尽量从大页内存中分配
+#define SYS_MEM_NODE(node)          (((node) + 1) << 8)             // 尽量从指定的NUMA节点分配
+#define SYS_MEM_NODE_GET(flags)     ((((flags) >> 8) & 0xFF) - 1)   // 取出节点号，未指定时为-1
+
+// 单调时间：由具体平台实现，以纳秒为单位
+uint64_t sys_time_ns (void);
+
+// 内存分配：由具体平台实现，按cache行对齐，不支持回收的平台释放时不做处理
+void * sys_mem_alloc(int size, int flags);
+void sys_mem_free(void * mem);
+void * sys_shm_create(const char * name, int size);
+
+// 可执行内存：复制代码后改为只读可执行，不支持的平台返回0
+void * sys_code_alloc(const void * code, int size);
+void sys_code_free(void * mem, int size);
+
+// NUMA拓扑：由具体平台实现，不支持的平台视为只有节点0
+int sys_numa_node_cnt (void);
+int sys_numa_node_curr (void);
+uint64_t sys_numa_cpu_mask (int node);
+
+// 计数信号量：由具体平台实现，初始化时不分配额外内存，可直接嵌入到其它结构中
+int sys_sem_init(sys_sem_t * sem, int init_count);
+void sys_sem_destroy(sys_sem_t * sem);
+int sys_sem_wait(sys_sem_t * sem, uint32_t ms);
+void sys_sem_notify(sys_sem_t * sem);
 
 // 互斥信号量：由具体平台实现
-sys_mutex_t sys_mutex_create(void);
-void sys_mutex_free(sys_mutex_t mutex);
-void sys_mutex_lock(sys_mutex_t mutex);
-void sys_mutex_unlock(sys_mutex_t mutex);
-int sys_mutex_is_valid(sys_mutex_t mutex);
+int sys_mutex_init(sys_mutex_t * mutex);
+void sys_mutex_destroy(sys_mutex_t * mutex);
+void sys_mutex_lock(sys_mutex_t * mutex);
+void sys_mutex_unlock(sys_mutex_t * mutex);
 
 // 线程相关：由具体平台实现
 typedef void (*sys_thread_func_t)(void * arg);
+
+// 线程属性，各项为0表示使用系统默认值，平台不支持的项被忽略
+typedef struct _sys_thread_attr_t {
+    const char * name;                  // 线程名称，Linux下最多15个字符
+    uint64_t cpu_mask;                  // 允许运行的CPU集合，每位对应一个CPU
+    int priority;                       // 实时优先级，大于0时使用SCHED_FIFO调度
+    int stack_size;                     // 堆栈大小，字节
+}sys_thread_attr_t;
+
 sys_thread_t sys_thread_create(sys_thread_func_t entry, void* arg);
+sys_thread_t sys_thread_create_attr(sys_thread_func_t entry, void* arg, const sys_thread_attr_t * attr);
 void sys_thread_exit (int error);
 void sys_sleep(int ms);
 sys_thread_t sys_thread_self (void);
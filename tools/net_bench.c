@@ -0,0 +1,532 @@
+/**
+ * @brief 协议栈微基准测试
+ *
+ * 覆盖pktbuf、mblock、fixq、nlist、定时器及以太网输入路径，每项测试固定操作次数，
+ * 重复多次后取中位数，每项输出一行JSON，便于脚本比较不同版本的结果
+ * 用法：net_bench [-r 重复次数] [-s 操作次数倍数] [-f 名称过滤]
+ * 结果与编译优化有关，应以Release方式构建
+ * pktbuf_numa_read比较本地(param=0)与远端(param=1)节点内存池的读取速度，应将进程绑定到
+ * 一个节点上运行，如numactl --cpunodebind=0；只有一个节点时两者相同
+ * bpf_filter比较收包过滤程序解释执行(param=0)与编译执行(param=1)，不支持编译的平台两者相同
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "net.h"
+#include "sys.h"
+#include "mblock.h"
+#include "fixq.h"
+#include "nlist.h"
+#include "pktbuf.h"
+#include "timer.h"
+#include "netif.h"
+#include "ether.h"
+#include "exmsg.h"
+#include "tools.h"
+#include "protocol.h"
+#include "net_stats.h"
+#include "net_bpf.h"
+
+#define BENCH_REPEAT_MAX    32
+#define BENCH_TIMER_MAX     100000
+#define BENCH_NODE_CNT      1024
+#define BENCH_NUMA_BUF_CNT  16384               // 约24MB的数据，超过常见的末级缓存
+#define BENCH_SKIP          UINT64_MAX          // 运行条件不满足，跳过该项测试
+
+typedef uint64_t (*bench_run_t) (int param, int ops);
+
+typedef struct _bench_t {
+    const char * name;
+    bench_run_t run;                    // 执行ops次操作，返回计时部分的耗时，ns
+    int param;                          // 数据大小、规模等，含义由各测试决定
+    int ops;
+}bench_t;
+
+static netif_t * bench_netif;
+static fixq_t ping_q, pong_q;
+static void * ping_buf[8], * pong_buf[8];
+static uint8_t data_buf[16384];
+
+/**
+ * 固定种子的随机数，保证每次运行的输入相同
+ */
+static uint32_t bench_rand (void) {
+    static uint32_t seed = 12345;
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static uint64_t mblock_alloc_free_run (int param, int ops) {
+    mblock_t mblock;
+    mblock_create(&mblock, 64, 64, param ? NLOCKER_THREAD : NLOCKER_NONE, 0);
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        void * mem = mblock_alloc(&mblock, -1);
+        mblock_free(&mblock, mem);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    mblock_destroy(&mblock);
+    return time;
+}
+
+static uint64_t nlist_insert_remove_run (int param, int ops) {
+    static nlist_node_t node[BENCH_NODE_CNT];
+    nlist_t list;
+    nlist_init(&list);
+    for (int i = 0; i < param; i++) {
+        nlist_insert_last(&list, node + i);
+    }
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        nlist_node_t * first = nlist_remove_first(&list);
+        nlist_insert_last(&list, first);
+    }
+    return sys_time_ns() - start;
+}
+
+static uint64_t pktbuf_alloc_free_run (int param, int ops) {
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_t * buf = pktbuf_alloc(param);
+        pktbuf_free(buf);
+    }
+    return sys_time_ns() - start;
+}
+
+static uint64_t pktbuf_header_run (int param, int ops) {
+    pktbuf_t * buf = pktbuf_alloc(1514);
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_add_header(buf, param, 1);
+        pktbuf_remove_header(buf, param);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    pktbuf_free(buf);
+    return time;
+}
+
+/**
+ * 非连续地添加包头后再合并，模拟协议层对分散包头的处理
+ */
+static uint64_t pktbuf_set_cont_run (int param, int ops) {
+    pktbuf_t * buf = pktbuf_alloc(1514);
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_add_header(buf, param, 0);
+        pktbuf_set_cont(buf, param + 20);
+        pktbuf_remove_header(buf, param);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    pktbuf_free(buf);
+    return time;
+}
+
+static uint64_t pktbuf_write_run (int param, int ops) {
+    pktbuf_t * buf = pktbuf_alloc(param);
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_reset_acc(buf);
+        pktbuf_write(buf, data_buf, param);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    pktbuf_free(buf);
+    return time;
+}
+
+static uint64_t pktbuf_read_run (int param, int ops) {
+    pktbuf_t * buf = pktbuf_alloc(param);
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_reset_acc(buf);
+        pktbuf_read(buf, data_buf, param);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    pktbuf_free(buf);
+    return time;
+}
+
+static uint64_t pktbuf_copy_run (int param, int ops) {
+    pktbuf_t * src = pktbuf_alloc(param);
+    pktbuf_t * dest = pktbuf_alloc(param);
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_reset_acc(src);
+        pktbuf_reset_acc(dest);
+        pktbuf_copy(dest, src, param);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    pktbuf_free(src);
+    pktbuf_free(dest);
+    return time;
+}
+
+static uint64_t pktbuf_numa_read_run (int param, int ops) {
+    static pktbuf_t * buf_tbl[BENCH_NUMA_BUF_CNT];
+
+    int local = sys_numa_node_curr();
+    pktbuf_set_node(param ? (local + 1) % sys_numa_node_cnt() : local);
+
+    int cnt = 0;
+    while (cnt < BENCH_NUMA_BUF_CNT) {
+        pktbuf_t * buf = pktbuf_alloc(1514);
+        if (!buf) {
+            break;
+        }
+        pktbuf_write(buf, data_buf, 1514);
+        buf_tbl[cnt++] = buf;
+    }
+
+    if (cnt == 0) {
+        pktbuf_set_node(-1);
+        return BENCH_SKIP;
+    }
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_t * buf = buf_tbl[i % cnt];
+        pktbuf_reset_acc(buf);
+        pktbuf_read(buf, data_buf, 1514);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    for (int i = 0; i < cnt; i++) {
+        pktbuf_free(buf_tbl[i]);
+    }
+    pktbuf_set_node(-1);
+    return time;
+}
+
+/**
+ * 对端线程：收到即原样返回
+ */
+static void pong_thread (void * arg) {
+    while (1) {
+        void * msg = fixq_recv(&ping_q, 0);
+        fixq_send(&pong_q, msg, 0);
+    }
+}
+
+static uint64_t fixq_pingpong_run (int param, int ops) {
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        fixq_send(&ping_q, data_buf, 0);
+        fixq_recv(&pong_q, 0);
+    }
+    return sys_time_ns() - start;
+}
+
+static void timer_proc (net_timer_t * timer, void * arg) {
+}
+
+static void timer_fill (net_timer_t * timer, int cnt) {
+    for (int i = 0; i < cnt; i++) {
+        net_timer_add(timer + i, "bench", timer_proc, (void *)0, 1 + bench_rand() % 10000, 0);
+    }
+}
+
+/**
+ * 逐个插入param个超时时间随机的定时器，链表随之增长，每次操作为一次插入
+ */
+static uint64_t timer_add_run (int param, int ops) {
+    static net_timer_t timer[BENCH_TIMER_MAX];
+    uint64_t time = 0;
+
+    for (int i = 0; i < ops; i += param) {
+        uint64_t start = sys_time_ns();
+        timer_fill(timer, param);
+        time += sys_time_ns() - start;
+
+        net_timer_check_tmo(10001);
+    }
+    return time;
+}
+
+/**
+ * param个定时器逐毫秒推进直至全部超时，每次操作为一个定时器的到期处理
+ */
+static uint64_t timer_expire_run (int param, int ops) {
+    static net_timer_t timer[BENCH_TIMER_MAX];
+    uint64_t time = 0;
+
+    for (int i = 0; i < ops; i += param) {
+        timer_fill(timer, param);
+
+        uint64_t start = sys_time_ns();
+        for (int ms = 0; ms <= 10000; ms++) {
+            net_timer_check_tmo(1);
+        }
+        time += sys_time_ns() - start;
+    }
+    return time;
+}
+
+/**
+ * 构造一个以太网帧，模拟驱动收到数据
+ */
+static pktbuf_t * frame_alloc (int size) {
+    pktbuf_t * buf = pktbuf_alloc(size);
+    if (buf) {
+        pktbuf_write(buf, data_buf, size);
+    }
+    return buf;
+}
+
+static uint64_t ether_in_run (int param, int ops) {
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_t * buf = frame_alloc(param);
+        if (bench_netif->link_layer->in(bench_netif, buf) < 0) {
+            pktbuf_free(buf);
+        }
+    }
+    return sys_time_ns() - start;
+}
+
+static uint64_t ether_rx_cnt (void) {
+    static net_stats_t stats;
+    net_stats_snapshot(&stats);
+    return stats.proto[NET_STATS_PROTO_ETHER][NET_STAT_RX_PKTS] + stats.proto[NET_STATS_PROTO_ETHER][NET_STAT_RX_DROP_BAD];
+}
+
+/**
+ * 经输入队列和工作线程的完整路径，计时到工作线程处理完最后一帧
+ */
+static uint64_t ether_queued_run (int param, int ops) {
+    uint64_t target = ether_rx_cnt() + ops;
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        pktbuf_t * buf;
+        while (!(buf = frame_alloc(param))) {
+            sys_sleep(0);
+        }
+        if (netif_put_in(bench_netif, buf) < 0) {
+            pktbuf_free(buf);
+            target--;
+        }
+    }
+
+    // 消息池耗尽时可能有包留在输入队列中，补发通知
+    while (ether_rx_cnt() < target) {
+        if (qdisc_cnt(&bench_netif->in_q)) {
+            exmsg_netif_in(bench_netif);
+        }
+        sys_sleep(0);
+    }
+    return sys_time_ns() - start;
+}
+
+/**
+ * 只接收广播和发往00:11:22:33:44:55的帧，随机数据的帧走完整个程序后被丢弃
+ */
+static uint64_t bpf_filter_run (int param, int ops) {
+    static const net_bpf_insn_t insn[] = {
+        NET_BPF_STMT(NET_BPF_LD | NET_BPF_W | NET_BPF_ABS, 2),
+        NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K, 0x22334455, 0, 2),
+        NET_BPF_STMT(NET_BPF_LD | NET_BPF_H | NET_BPF_ABS, 0),
+        NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K, 0x0011, 3, 4),
+        NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K, 0xFFFFFFFF, 0, 3),
+        NET_BPF_STMT(NET_BPF_LD | NET_BPF_H | NET_BPF_ABS, 0),
+        NET_BPF_JUMP(NET_BPF_JMP | NET_BPF_JEQ | NET_BPF_K, 0xFFFF, 0, 1),
+        NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 0xFFFF),
+        NET_BPF_STMT(NET_BPF_RET | NET_BPF_K, 0),
+    };
+    static net_bpf_t prog;
+
+    net_bpf_load(&prog, insn, sizeof(insn) / sizeof(insn[0]));
+    net_bpf_func_t jit = prog.jit;
+    if (!param) {
+        prog.jit = (net_bpf_func_t)0;
+    }
+
+    uint64_t start = sys_time_ns();
+    for (int i = 0; i < ops; i++) {
+        net_bpf_run(&prog, data_buf + (i & 1023), 64);
+    }
+    uint64_t time = sys_time_ns() - start;
+
+    prog.jit = jit;
+    net_bpf_unload(&prog);
+    return time;
+}
+
+static net_err_t bench_netif_open (struct _netif_t * netif, void * data) {
+    static const uint8_t hwaddr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+
+    netif->type = NETIF_TYPE_ETHER;
+    netif->mtu = ETHER_MTU;
+    netif_set_hwaddr(netif, (uint8_t *)hwaddr, ETHER_HWA_SIZE);
+    return NET_ERR_OK;
+}
+
+static void bench_netif_close (struct _netif_t * netif) {
+}
+
+static net_err_t bench_netif_xmit (struct _netif_t * netif) {
+    pktbuf_t * buf;
+    while ((buf = netif_get_out(netif, -1))) {
+        pktbuf_free(buf);
+    }
+    return NET_ERR_OK;
+}
+
+static net_err_t bench_init (void) {
+    net_pool_cfg_t cfg;
+    net_pool_cfg_default(&cfg);
+    cfg.pktbuf_blk_cnt = 8192;
+    cfg.pktbuf_buf_cnt = 1024;
+    cfg.pktbuf_slab_cnt = 4096;                 // 仅pktbuf_numa_read需要扩充
+    cfg.pktbuf_blk_max = cfg.pktbuf_blk_cnt + BENCH_NUMA_BUF_CNT * ((1514 + PKTBUF_BLK_SIZE - 1) / PKTBUF_BLK_SIZE);
+    cfg.pktbuf_buf_max = cfg.pktbuf_buf_cnt + BENCH_NUMA_BUF_CNT;
+    cfg.exmsg_msg_cnt = 256;
+    net_pool_cfg_set(&cfg);
+
+    net_init();
+
+    static const netif_ops_t bench_ops = {
+        .open = bench_netif_open,
+        .close = bench_netif_close,
+        .xmit = bench_netif_xmit,
+    };
+    bench_netif = netif_open("bench", &bench_ops, (void *)0);
+    if (!bench_netif) {
+        return NET_ERR_SYS;
+    }
+    netif_set_active(bench_netif);
+
+    // IPv4广播帧，以太网层计数后即释放
+    ether_hdr_t * hdr = (ether_hdr_t *)data_buf;
+    memcpy(hdr->dest, ether_broadcast_addr(), ETHER_HWA_SIZE);
+    memcpy(hdr->src, bench_netif->hwaddr.addr, ETHER_HWA_SIZE);
+    hdr->protocol = x_htons(NET_PROTOCOL_IPv4);
+
+    fixq_init(&ping_q, ping_buf, 8, NLOCKER_THREAD);
+    fixq_init(&pong_q, pong_buf, 8, NLOCKER_THREAD);
+    if (sys_thread_create(pong_thread, (void *)0) == SYS_THREAD_INVALID) {
+        return NET_ERR_SYS;
+    }
+    return NET_ERR_OK;
+}
+
+static int u64_cmp (const void * a, const void * b) {
+    uint64_t ta = *(const uint64_t *)a;
+    uint64_t tb = *(const uint64_t *)b;
+    return ta < tb ? -1 : ta > tb;
+}
+
+static void bench_exec (const bench_t * bench, int repeat, int scale) {
+    uint64_t time[BENCH_REPEAT_MAX];
+    int ops = bench->ops * scale;
+
+    // 预热一次，使内存池、缓存等进入稳定状态
+    uint64_t last = bench->run(bench->param, ops);
+    for (int i = 0; (i < repeat) && (last != BENCH_SKIP); i++) {
+        time[i] = bench->run(bench->param, ops);
+        last = time[i];
+    }
+
+    if (last == BENCH_SKIP) {
+        printf("{\"bench\":\"%s\",\"param\":%d,\"skipped\":true}\n", bench->name, bench->param);
+        fflush(stdout);
+        return;
+    }
+    qsort(time, repeat, sizeof(uint64_t), u64_cmp);
+
+    double ns_op = (double)time[repeat / 2] / ops;
+    printf("{\"bench\":\"%s\",\"param\":%d,\"ops\":%d,\"repeat\":%d,\"ns_op\":%.2f,\"ns_op_min\":%.2f,\"ops_sec\":%.0f}\n",
+        bench->name, bench->param, ops, repeat, ns_op, (double)time[0] / ops, ns_op > 0 ? 1e9 / ns_op : 0.0);
+    fflush(stdout);
+}
+
+int main (int argc, char ** argv) {
+    static const bench_t bench_tbl[] = {
+        {"mblock_alloc_free", mblock_alloc_free_run, 0, 1000000},
+        {"mblock_alloc_free", mblock_alloc_free_run, 1, 1000000},
+        {"nlist_insert_remove", nlist_insert_remove_run, BENCH_NODE_CNT, 1000000},
+        {"pktbuf_alloc_free", pktbuf_alloc_free_run, 64, 200000},
+        {"pktbuf_alloc_free", pktbuf_alloc_free_run, 1514, 200000},
+        {"pktbuf_alloc_free", pktbuf_alloc_free_run, 9000, 50000},
+        {"pktbuf_header", pktbuf_header_run, 14, 1000000},
+        {"pktbuf_header", pktbuf_header_run, 54, 1000000},
+        {"pktbuf_set_cont", pktbuf_set_cont_run, 14, 500000},
+        {"pktbuf_set_cont", pktbuf_set_cont_run, 54, 500000},
+        {"pktbuf_write", pktbuf_write_run, 64, 500000},
+        {"pktbuf_write", pktbuf_write_run, 1514, 200000},
+        {"pktbuf_write", pktbuf_write_run, 9000, 50000},
+        {"pktbuf_read", pktbuf_read_run, 64, 500000},
+        {"pktbuf_read", pktbuf_read_run, 1514, 200000},
+        {"pktbuf_read", pktbuf_read_run, 9000, 50000},
+        {"pktbuf_copy", pktbuf_copy_run, 64, 500000},
+        {"pktbuf_copy", pktbuf_copy_run, 1514, 200000},
+        {"pktbuf_copy", pktbuf_copy_run, 9000, 50000},
+        {"pktbuf_numa_read", pktbuf_numa_read_run, 0, 100000},
+        {"pktbuf_numa_read", pktbuf_numa_read_run, 1, 100000},
+        {"fixq_pingpong", fixq_pingpong_run, 0, 100000},
+        {"timer_add", timer_add_run, 1000, 1000},
+        {"timer_add", timer_add_run, 10000, 10000},
+        {"timer_expire", timer_expire_run, 1000, 1000},
+        {"timer_expire", timer_expire_run, 10000, 10000},
+        {"bpf_filter", bpf_filter_run, 0, 5000000},
+        {"bpf_filter", bpf_filter_run, 1, 5000000},
+        {"ether_in", ether_in_run, 64, 500000},
+        {"ether_in", ether_in_run, 1514, 200000},
+        {"ether_in_queued", ether_queued_run, 64, 200000},
+        {"ether_in_queued", ether_queued_run, 1514, 100000},
+    };
+    int repeat = 5, scale = 1;
+    const char * filter = (const char *)0;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+            repeat = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+            scale = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc)) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-r repeat] [-s scale] [-f filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if ((repeat <= 0) || (repeat > BENCH_REPEAT_MAX) || (scale <= 0)) {
+        fprintf(stderr, "repeat must be 1..%d, scale must be positive\n", BENCH_REPEAT_MAX);
+        return 1;
+    }
+
+    if (bench_init() < 0) {
+        fprintf(stderr, "bench init failed\n");
+        return 1;
+    }
+
+    // 排队路径需要工作线程，放在定时器测试之后启动，避免并发访问定时器链表
+    int started = 0;
+    for (int i = 0; i < (int)(sizeof(bench_tbl) / sizeof(bench_tbl[0])); i++) {
+        const bench_t * bench = bench_tbl + i;
+        if (filter && !strstr(bench->name, filter)) {
+            continue;
+        }
+
+        if ((bench->run == ether_queued_run) && !started) {
+            net_start();
+            started = 1;
+        }
+        bench_exec(bench, repeat, scale);
+    }
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * @brief 协议栈运行状态查看工具
+ *
+ * 以只读方式映射协议栈发布的共享内存，显示网卡、协议、内存池、队列等统计信息
+ * 用法：net_stat [-i 间隔秒数] [共享内存名称]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "net_metrics.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+
+static const net_metrics_t * metrics_open (const char * name) {
+    HANDLE map = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (map == NULL) {
+        return NULL;
+    }
+    return (const net_metrics_t *)MapViewOfFile(map, FILE_MAP_READ, 0, 0, sizeof(net_metrics_t));
+}
+
+static void sleep_sec (int sec) {
+    Sleep(sec * 1000);
+}
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const net_metrics_t * metrics_open (const char * name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/%s", name);
+
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    void * mem = mmap(NULL, sizeof(net_metrics_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return mem == MAP_FAILED ? NULL : (const net_metrics_t *)mem;
+}
+
+static void sleep_sec (int sec) {
+    sleep(sec);
+}
+#endif
+
+// 映射为只读，不能使用带写操作的原子指令
+static void read_fence (void) {
+#if defined(_MSC_VER)
+    MemoryBarrier();
+#else
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+/**
+ * 按seq读取一份一致的拷贝
+ */
+static void metrics_read (const net_metrics_t * shm, net_metrics_t * local) {
+    while (1) {
+        int seq = shm->seq;
+        if (seq & 1) {
+            continue;
+        }
+
+        read_fence();
+        memcpy(local, shm, sizeof(net_metrics_t));
+        read_fence();
+        if (shm->seq == seq) {
+            return;
+        }
+    }
+}
+
+static void metrics_show (const net_metrics_t * m) {
+    static const char * state_name[] = {"-", "closed", "opened", "active"};
+
+    printf("%-10s %-7s %12s %14s %12s %14s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n",
+        "netif", "state", "rx_pkts", "rx_bytes", "tx_pkts", "tx_bytes",
+        "nobuf", "rx_qfull", "bad", "link", "filter", "tx_qfull", "aqm", "tx_err", "in/out");
+    for (int i = 0; i < m->netif_cnt; i++) {
+        const net_metrics_netif_t * n = m->netif + i;
+        if (n->state == 0) {
+            continue;
+        }
+
+        char queue[32];
+        snprintf(queue, sizeof(queue), "%d/%d", n->in_q_cnt, n->out_q_cnt);
+        printf("%-10s %-7s %12llu %14llu %12llu %14llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu %8s\n",
+            n->name, state_name[n->state & 3],
+            (unsigned long long)n->stats[NET_STAT_RX_PKTS], (unsigned long long)n->stats[NET_STAT_RX_BYTES],
+            (unsigned long long)n->stats[NET_STAT_TX_PKTS], (unsigned long long)n->stats[NET_STAT_TX_BYTES],
+            (unsigned long long)n->stats[NET_STAT_RX_DROP_NOBUF], (unsigned long long)n->stats[NET_STAT_RX_DROP_QFULL],
+            (unsigned long long)n->stats[NET_STAT_RX_DROP_BAD], (unsigned long long)n->stats[NET_STAT_RX_DROP_LINK],
+            (unsigned long long)n->stats[NET_STAT_RX_DROP_FILTER], (unsigned long long)n->stats[NET_STAT_TX_DROP_QFULL],
+            (unsigned long long)(n->stats[NET_STAT_RX_DROP_AQM] + n->stats[NET_STAT_TX_DROP_AQM]),
+            (unsigned long long)n->stats[NET_STAT_TX_ERR], queue);
+    }
+
+    static const char * proto_name[] = {"ether", "arp", "ipv4", "vlan", "other"};
+    printf("\n%-10s %12s %14s %12s %14s %8s\n", "proto", "rx_pkts", "rx_bytes", "tx_pkts", "tx_bytes", "bad");
+    for (int i = 0; i < NET_STATS_PROTO_CNT; i++) {
+        const uint64_t * s = m->proto[i];
+        printf("%-10s %12llu %14llu %12llu %14llu %8llu\n", i < 5 ? proto_name[i] : "?",
+            (unsigned long long)s[NET_STAT_RX_PKTS], (unsigned long long)s[NET_STAT_RX_BYTES],
+            (unsigned long long)s[NET_STAT_TX_PKTS], (unsigned long long)s[NET_STAT_TX_BYTES],
+            (unsigned long long)s[NET_STAT_RX_DROP_BAD]);
+    }
+
+    printf("\n%-10s %8s %8s\n", "pool", "free", "total");
+    for (int i = 0; i < m->pool_cnt; i++) {
+        printf("%-10s %8d %8d\n", m->pool[i].name, m->pool[i].free_cnt, m->pool[i].total_cnt);
+    }
+
+    printf("\n%-10s %8s %8s\n", "queue", "cnt", "size");
+    for (int i = 0; i < m->queue_cnt; i++) {
+        printf("%-10s %8d %8d\n", m->queue[i].name, m->queue[i].cnt, m->queue[i].size);
+    }
+
+    static const char * lat_name[] = {"rx", "in_q", "msg_q", "proc", "out_q", "xmit", "total"};
+    printf("\n%-10s %12s %10s %10s %10s %10s   (us)\n", "latency", "samples", "p50", "p99", "p99.9", "max");
+    for (int i = 0; i < NET_LAT_STAGE_CNT; i++) {
+        const net_metrics_lat_t * l = m->lat + i;
+        printf("%-10s %12llu %10.1f %10.1f %10.1f %10.1f\n", i < 7 ? lat_name[i] : "?", (unsigned long long)l->count,
+            l->p50 / 1000.0, l->p99 / 1000.0, l->p999 / 1000.0, l->max / 1000.0);
+    }
+
+    printf("\npktbuf_empty %llu, pktblk_empty %llu, exmsg_empty %llu, exmsg_qfull %llu, timers %d\n",
+        (unsigned long long)m->pool_stats[NET_STAT_PKTBUF_EMPTY], (unsigned long long)m->pool_stats[NET_STAT_PKTBLK_EMPTY],
+        (unsigned long long)m->pool_stats[NET_STAT_EXMSG_EMPTY], (unsigned long long)m->pool_stats[NET_STAT_EXMSG_QFULL],
+        m->timer_cnt);
+}
+
+int main (int argc, char ** argv) {
+    const char * name = NET_METRICS_NAME;
+    int interval = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-i") == 0) && (i + 1 < argc)) {
+            interval = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            name = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [-i seconds] [name]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const net_metrics_t * shm = metrics_open(name);
+    if (!shm) {
+        fprintf(stderr, "open %s failed, is the stack running?\n", name);
+        return 1;
+    }
+
+    if ((shm->magic != NET_METRICS_MAGIC) || (shm->version != NET_METRICS_VERSION) || (shm->size != sizeof(net_metrics_t))) {
+        fprintf(stderr, "%s: layout mismatch, rebuild net_stat with the same net_cfg.h\n", name);
+        return 1;
+    }
+
+    static net_metrics_t local;
+    do {
+        metrics_read(shm, &local);
+        metrics_show(&local);
+        if (interval > 0) {
+            printf("\n");
+            sleep_sec(interval);
+        }
+    } while (interval > 0);
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+/**
+ * @brief 跟踪文件解码工具
+ *
+ * 读取dbg_trace_dump导出的文件，按时间顺序合并各线程的记录并格式化输出
+ * 用法：net_trace <trace file>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "dbg.h"
+
+#if !DBG_TRACE_ENABLE
+int main (int argc, char ** argv) {
+    fprintf(stderr, "DBG_TRACE_ENABLE is off in net_cfg.h\n");
+    return 1;
+}
+#else
+
+typedef struct _site_t {
+    dbg_trace_site_hdr_t hdr;
+    char * file;
+    char * func;
+    char * fmt;
+}site_t;
+
+typedef struct _rec_t {
+    dbg_trace_rec_t rec;
+    uint32_t thread;
+}rec_t;
+
+static site_t * site_tbl[0x10000];
+
+static char * read_str (FILE * file, int len) {
+    char * str = (char *)malloc(len + 1);
+    if (!str || (fread(str, 1, len, file) != (size_t)len)) {
+        free(str);
+        return NULL;
+    }
+    str[len] = '\0';
+    return str;
+}
+
+static int rec_cmp (const void * a, const void * b) {
+    uint64_t ta = ((const rec_t *)a)->rec.time;
+    uint64_t tb = ((const rec_t *)b)->rec.time;
+    return ta < tb ? -1 : ta > tb;
+}
+
+/**
+ * 按格式串逐段输出，每个转换说明使用记录中对应类型的参数
+ */
+static void print_rec (const site_t * site, const dbg_trace_rec_t * rec) {
+    const uint8_t * arg = rec->arg;
+    const uint8_t * end = rec->arg + rec->size;
+    const char * c = site->fmt;
+    int idx = 0;
+
+    while (*c) {
+        if (*c != '%') {
+            putchar(*c++);
+            continue;
+        }
+
+        // 取出完整的转换说明
+        char spec[32];
+        int len = 0;
+        spec[len++] = *c++;
+        while (*c && strchr("-+ #0123456789.hlzjt", *c) && (len < (int)sizeof(spec) - 2)) {
+            spec[len++] = *c++;
+        }
+        if (*c == '\0') {
+            break;
+        }
+        spec[len++] = *c++;
+        spec[len] = '\0';
+
+        if (spec[len - 1] == '%') {
+            putchar('%');
+            continue;
+        }
+
+        if ((idx >= site->hdr.arg_cnt) || (arg >= end)) {
+            fputs("<?>", stdout);
+            continue;
+        }
+
+        int type = site->hdr.arg_type[idx++];
+        if (type == DBG_ARG_STR) {
+            int str_len = *arg++;
+            char str[DBG_TRACE_ARG_SIZE + 1];
+            memcpy(str, arg, str_len);
+            str[str_len] = '\0';
+            arg += str_len;
+            printf(spec, str);
+            continue;
+        }
+
+        if (type == DBG_ARG_INT) {
+            int v;
+            memcpy(&v, arg, sizeof(v));
+            arg += sizeof(v);
+            printf(spec, v);
+            continue;
+        }
+
+        uint64_t v;
+        memcpy(&v, arg, sizeof(v));
+        arg += sizeof(v);
+        switch (type) {
+        case DBG_ARG_LONG:
+            printf(spec, (long)v);
+            break;
+        case DBG_ARG_LLONG:
+            printf(spec, (long long)v);
+            break;
+        case DBG_ARG_SIZE:
+            printf(spec, (size_t)v);
+            break;
+        case DBG_ARG_PTR:
+            printf(spec, (void *)(uintptr_t)v);
+            break;
+        case DBG_ARG_DOUBLE: {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            printf(spec, d);
+            break;
+        }
+        default:
+            fputs("<?>", stdout);
+            break;
+        }
+    }
+}
+
+int main (int argc, char ** argv) {
+    static const char * title[] = {
+        [DBG_LEVEL_NONE] = "NONE",
+        [DBG_LEVEL_ERROR] = "ERROR",
+        [DBG_LEVEL_WARNING] = "WARNING",
+        [DBG_LEVEL_INFO] = "INFO",
+    };
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    FILE * file = fopen(argv[1], "rb");
+    if (!file) {
+        fprintf(stderr, "open %s failed\n", argv[1]);
+        return 1;
+    }
+
+    dbg_trace_hdr_t hdr;
+    if ((fread(&hdr, sizeof(hdr), 1, file) != 1) || (hdr.magic != DBG_TRACE_MAGIC) || (hdr.version != DBG_TRACE_VERSION)) {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < hdr.site_cnt; i++) {
+        site_t * site = (site_t *)calloc(1, sizeof(site_t));
+        if (!site || (fread(&site->hdr, sizeof(site->hdr), 1, file) != 1)
+                || !(site->file = read_str(file, site->hdr.file_len))
+                || !(site->func = read_str(file, site->hdr.func_len))
+                || !(site->fmt = read_str(file, site->hdr.fmt_len))) {
+            fprintf(stderr, "%s: truncated site table\n", argv[1]);
+            return 1;
+        }
+        site_tbl[site->hdr.id] = site;
+    }
+
+    rec_t * rec_tbl = NULL;
+    size_t rec_cnt = 0;
+    for (uint32_t i = 0; i < hdr.ring_cnt; i++) {
+        dbg_trace_ring_hdr_t ring;
+        if (fread(&ring, sizeof(ring), 1, file) != 1) {
+            fprintf(stderr, "%s: truncated ring\n", argv[1]);
+            return 1;
+        }
+
+        rec_tbl = (rec_t *)realloc(rec_tbl, (rec_cnt + ring.rec_cnt) * sizeof(rec_t));
+        for (uint32_t j = 0; j < ring.rec_cnt; j++) {
+            rec_t * rec = rec_tbl + rec_cnt++;
+            if (fread(&rec->rec, sizeof(rec->rec), 1, file) != 1) {
+                fprintf(stderr, "%s: truncated ring\n", argv[1]);
+                return 1;
+            }
+            rec->thread = ring.thread;
+        }
+    }
+    fclose(file);
+
+    qsort(rec_tbl, rec_cnt, sizeof(rec_t), rec_cmp);
+
+    uint64_t start = rec_cnt ? rec_tbl[0].rec.time : 0;
+    for (size_t i = 0; i < rec_cnt; i++) {
+        const dbg_trace_rec_t * rec = &rec_tbl[i].rec;
+        const site_t * site = site_tbl[rec->site];
+        if (!site) {
+            continue;
+        }
+
+        const char * name = strrchr(site->file, '/');
+        const char * name2 = strrchr(site->file, '\\');
+        name = name2 > name ? name2 : name;
+        name = name ? name + 1 : site->file;
+
+        uint64_t us = (rec->time - start) / 1000;
+        printf("[%llu.%06llu] T%u %s : ( %s -- %s -- %u ) ", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000),
+            rec_tbl[i].thread, title[site->hdr.level & 3], name, site->func, site->hdr.line);
+        print_rec(site, rec);
+        putchar('\n');
+    }
+
+    free(rec_tbl);
+    return 0;
+}
+#endif